@@ -13,6 +13,7 @@
 #endif
 
 #include "SystemConfig.h"
+#include "ConsoleOut.h"
 #include "ClockManager.h"
 
 
@@ -28,26 +29,26 @@ ClockManager::ClockManager()
 void clockManPrintDigits(int digits){
   // utility function for digital clock display: prints preceding colon and leading 0
   if(digits < 10)
-    CTRL_SERIAL.print('0');
-  CTRL_SERIAL.print(digits);
+    CONSOLE.print('0');
+  CONSOLE.print(digits);
 }
 
 void clockManPrintTime()
 {
 	time_t time = now();
-	CTRL_SERIAL.print("[");
+	CONSOLE.print("[");
 	clockManPrintDigits(hour(time));
-	CTRL_SERIAL.print(":");
+	CONSOLE.print(":");
 	clockManPrintDigits(minute(time));
-	CTRL_SERIAL.print(":");
+	CONSOLE.print(":");
 	clockManPrintDigits(second(time));
-	CTRL_SERIAL.print(" ");
-	CTRL_SERIAL.print(day(time));
-	CTRL_SERIAL.print("/");
-	CTRL_SERIAL.print(month(time));
-	CTRL_SERIAL.print("/");
-	CTRL_SERIAL.print(year(time));
-	CTRL_SERIAL.println("] ");
+	CONSOLE.print(" ");
+	CONSOLE.print(day(time));
+	CONSOLE.print("/");
+	CONSOLE.print(month(time));
+	CONSOLE.print("/");
+	CONSOLE.print(year(time));
+	CONSOLE.println("] ");
 }
 
 time_t ClockManager::getTeensy3Time()
@@ -57,15 +58,15 @@ time_t ClockManager::getTeensy3Time()
 
 void ClockManager::setup()
 {
-	CTRL_SERIAL.println("Setting the RTC sync provider");
+	CONSOLE.println("Setting the RTC sync provider");
 	setSyncProvider((getExternalTime) Teensy3Clock.get);   // the function to get the time from the RTC
 	setSyncInterval(60);
-	CTRL_SERIAL.print("Syncing time : ");
+	CONSOLE.print("Syncing time : ");
 	while(timeStatus()!= timeSet)
 	{
-		CTRL_SERIAL.print(".");
+		CONSOLE.print(".");
 	}
-	CTRL_SERIAL.println(" done!");
+	CONSOLE.println(" done!");
 }
 
 void ClockManager::loop()
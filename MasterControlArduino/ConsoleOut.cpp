@@ -0,0 +1,182 @@
+/*
+
+	ConsoleOut.cpp
+	
+	Buffered console output, drained a little at a time from the loop so a long listing
+	never holds up the scheduler
+
+	Everything printed goes into a ring and drain() hands at most CONSOLE_SLICE bytes to the
+	port each time round the loop, and never more than the port says it can take without
+	waiting.  When the ring fills, whole writes are dropped rather than half lines, and once
+	there's room again a note says how much went missing.
+
+	Long listings don't print at all, they're generators: drain() asks for the next line
+	whenever there's CONSOLE_LINE_MAX free, so they never overflow however long they are.
+
+	During setup() the console is blocking, so the boot log comes out as it happens.
+	
+*/
+#include "ConsoleOut.h"
+#include "SystemConfig.h"
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+ConsoleOut::ConsoleOut(Print* port)
+{
+	_port = port;
+	_head = 0;
+	_tail = 0;
+	_blocking = true;
+	_dropped = 0;
+	_droppedTotal = 0;
+	_overflows = 0;
+	_highWater = 0;
+	_generator = NULL;
+	_context = NULL;
+	_cursor = 0;
+}
+
+size_t ConsoleOut::write(uint8_t b)
+{
+	return write(&b, 1);
+}
+
+size_t ConsoleOut::write(const uint8_t* buffer, size_t size)
+{
+	if (_blocking)
+	{
+		flush();
+		return _port->write(buffer, size);
+	}
+	reportDropped();
+	// nothing more goes in until the note about the last lot has, so the gap is always marked
+	if (_dropped > 0 || size > space())
+	{
+		if (_dropped == 0)
+			_overflows++;
+		_dropped += size;
+		_droppedTotal += size;
+		return 0;				// so a caller that cares can tell it didn't go
+	}
+	put(buffer, size);
+	if (queued() > _highWater)
+		_highWater = queued();
+	return size;
+}
+
+int ConsoleOut::availableForWrite()
+{
+	return _blocking ? _port->availableForWrite() : space();
+}
+
+void ConsoleOut::flush()
+{
+	// waits for the lot, so only for setup() and the like
+	unsigned int count;
+	while ((count = queued()) > 0)
+		send(count);
+	_port->flush();
+}
+
+void ConsoleOut::setBlocking(bool blocking)
+{
+	if (blocking)
+		flush();
+	_blocking = blocking;
+}
+
+void ConsoleOut::generate(ConsoleGenerator generator, void* context)
+{
+	if (_generator != NULL)
+		print(F("[listing cut short]\r\n"));
+	_generator = generator;
+	_context = context;
+	_cursor = 0;
+	while (_blocking && _generator != NULL)
+	{
+		if (!_generator(_context, &_cursor))
+			_generator = NULL;
+	}
+}
+
+bool ConsoleOut::generating()
+{
+	return _generator != NULL;
+}
+
+void ConsoleOut::drain()
+{
+	ConsoleOut *previous = console;
+	unsigned int count;
+	int room;
+	reportDropped();
+	if (_generator != NULL && space() >= CONSOLE_LINE_MAX && _dropped == 0)
+	{
+		// the generator prints to CONSOLE, which has to be us
+		console = this;
+		if (!_generator(_context, &_cursor))
+			_generator = NULL;
+		console = previous;
+	}
+	count = queued();
+	if (count == 0)
+		return;
+	if (count > CONSOLE_SLICE)
+		count = CONSOLE_SLICE;
+	room = _port->availableForWrite();
+	if (room <= 0)
+		return;
+	if ((unsigned int) room < count)
+		count = room;
+	send(count);
+}
+
+unsigned int ConsoleOut::queued()
+{
+	return (_head + CONSOLE_BUFFER - _tail) % CONSOLE_BUFFER;
+}
+
+void ConsoleOut::printStats()
+{
+	printf(F("Console: %u bytes queued, worst %u of %u, %lu overflows, %lu bytes dropped%s\r\n"),
+		queued(), _highWater, CONSOLE_BUFFER - 1, _overflows, _droppedTotal, _generator != NULL ? ", listing" : "");
+}
+
+unsigned int ConsoleOut::space()
+{
+	// one slot stays empty so a full ring doesn't look like an empty one
+	return CONSOLE_BUFFER - 1 - queued();
+}
+
+void ConsoleOut::put(const uint8_t* buffer, size_t size)
+{
+	size_t i;
+	for (i=0;i<size;i++)
+	{
+		_buffer[_head] = buffer[i];
+		_head = (_head + 1) % CONSOLE_BUFFER;
+	}
+}
+
+void ConsoleOut::reportDropped()
+{
+	char note[CONSOLE_DROP_NOTE];
+	int length;
+	if (_dropped == 0 || space() < CONSOLE_DROP_NOTE)
+		return;
+	length = snprintf(note, sizeof(note), "\r\n[%lu bytes dropped]\r\n", _dropped);
+	_dropped = 0;
+	put((const uint8_t*) note, length);
+}
+
+void ConsoleOut::send(unsigned int count)
+{
+	// only up to the end of the ring, the rest goes next time
+	if (count > CONSOLE_BUFFER - _tail)
+		count = CONSOLE_BUFFER - _tail;
+	_port->write(&_buffer[_tail], count);
+	_tail = (_tail + count) % CONSOLE_BUFFER;
+}
@@ -0,0 +1,63 @@
+/*
+
+	ConsoleOut.h
+	
+	Buffered console output, drained a little at a time from the loop so a long listing
+	never holds up the scheduler
+	
+*/
+
+#ifndef CONSOLEOUT_H
+#define CONSOLEOUT_H
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#define CONSOLE_BUFFER 1536				// bytes waiting to go out, for each port
+#define CONSOLE_SLICE 64				// most bytes handed to the port per drain()
+#define CONSOLE_LINE_MAX 128			// room a generator needs before it's asked for another line
+#define CONSOLE_DROP_NOTE 40			// room needed to say how much was dropped
+
+// produces the next line of a listing, moving the cursor along; returns false once it's done
+typedef bool (*ConsoleGenerator)(void* context, unsigned int* cursor);
+
+class ConsoleOut : public Print {
+	public:
+		ConsoleOut(Print* port);
+		virtual size_t write(uint8_t b);
+		virtual size_t write(const uint8_t* buffer, size_t size);
+		using Print::write;
+		virtual int availableForWrite();
+		virtual void flush();
+		void setBlocking(bool blocking);
+		void generate(ConsoleGenerator generator, void* context);
+		bool generating();
+		void drain();
+		unsigned int queued();
+		void printStats();
+	private:
+		Print* _port;
+		uint8_t _buffer[CONSOLE_BUFFER];
+		unsigned int _head;				// next byte in
+		unsigned int _tail;				// next byte out
+		bool _blocking;
+		unsigned long _dropped;			// not reported yet
+		unsigned long _droppedTotal;
+		unsigned long _overflows;
+		unsigned int _highWater;
+		ConsoleGenerator _generator;
+		void* _context;
+		unsigned int _cursor;
+		unsigned int space();
+		void put(const uint8_t* buffer, size_t size);
+		void reportDropped();
+		void send(unsigned int count);
+};
+
+// whichever session is being served, and the USB port otherwise
+extern ConsoleOut* console;
+#define CONSOLE (*console)
+
+#endif
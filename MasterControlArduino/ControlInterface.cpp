@@ -6,6 +6,7 @@
 
 */
 #include "SystemConfig.h"
+#include "ConsoleOut.h"
 #include "ControlInterface.h"
 #if defined(ARDUINO) && ARDUINO >= 100
 #include "Arduino.h"
@@ -16,66 +17,113 @@
 #include "Scheduler.h"
 #include "MotorControl.h"
 #include "ClockManager.h"
+#include "SceneStore.h"
+#include "InputTriggers.h"
+#include "OneWireSensors.h"
+#include "EventLog.h"
+#include "SerialRing.h"
 
 ControlInterface::ControlInterface()
 {
 	strncpy(delim," ",MAXDELIMETER);  // strtok_r needs a null-terminated string
 	term='\r';   // return character, default terminator for commands
 	numCommand=0;    // Number of callback handlers installed
-	clearBuffer(); 
 	started=false;
+	_numSessions=0;
+	_session=NULL;
+	_sched=NULL;
+	_systemController=NULL;
+	_motors=NULL;
+	_inputs=NULL;
+	_sensors=NULL;
 	// do whatever in here to make stuff great.
 }
 
 void ControlInterface::start(int baudrate)
 {
 	CTRL_SERIAL.begin(baudrate);
+	userSerialRx.begin(USER_BAUD);
+}
+
+bool ControlInterface::addSession(Stream* port, ConsoleOut* console)
+{
+	// add them all before the other components are connected up
+	ControlSession *session;
+	if (_numSessions >= CONTROL_MAX_SESSIONS)
+		return false;
+	session = &_sessions[_numSessions++];
+	session->port = port;
+	session->console = console;
+	session->state = MAIN_MENU;
+	session->currentSeqId = 0;
+	session->promptPending = false;
+	session->overlong = false;
+	session->linesTooLong = 0;
+	session->host.setPort(console);
+	use(session);
+	clearBuffer();
+	return true;
+}
+
+void ControlInterface::use(ControlSession* session)
+{
+	// everything printed from here on goes back to this session
+	_session = session;
+	console = session->console;
 }
 
 void ControlInterface::interactive()
 {
+	int i;
 	started=true;
-	CTRL_SERIAL.println(F("==========="));
-	CTRL_SERIAL.println(F(" H-O-L-S-T"));
-	CTRL_SERIAL.println(F("==========="));
-	CTRL_SERIAL.println(F("    from naxxfish industries"));
-	CTRL_SERIAL.println();
-	CTRL_SERIAL.print(F("Firmware Version: "));
-	CTRL_SERIAL.println(HOLST_VERSION);
-	CTRL_SERIAL.print(F("Control Interface Version: "));
-	CTRL_SERIAL.println(CONTROL_INT_VER);
-	issuePrompt();
+	eventLog.setWriter(logLine, this);
+	for (i=0;i<_numSessions;i++)
+	{
+		use(&_sessions[i]);
+		CONSOLE.println(F("==========="));
+		CONSOLE.println(F(" H-O-L-S-T"));
+		CONSOLE.println(F("==========="));
+		CONSOLE.println(F("    from naxxfish industries"));
+		CONSOLE.println();
+		CONSOLE.print(F("Firmware Version: "));
+		CONSOLE.println(HOLST_VERSION);
+		CONSOLE.print(F("Control Interface Version: "));
+		CONSOLE.println(CONTROL_INT_VER);
+		issuePrompt();
+	}
+	if (_numSessions > 0)
+		use(&_sessions[0]);
 }
 
 void ControlInterface::issuePrompt()
 {
 	const __FlashStringHelper* prompt = F("?");
 
-	if (_state == MAIN_MENU)
+	if (_session->state == MAIN_MENU)
 	{
 		prompt = F("# ");
-	} else if (_state == PROGRAM)
+	} else if (_session->state == PROGRAM)
 	{
 		prompt = F("PROG> ");
-	} else if (_state == CONTROL)
+	} else if (_session->state == CONTROL)
 	{
 		prompt = F("CTRL> ");
 	} 
-	else if (_state == PROG_ADDSEQ)
+	else if (_session->state == PROG_ADDSEQ)
 	{
 		prompt = F("PROGSEQ> ");
 	}
-	CTRL_SERIAL.printf(F("\r\n"));
+	CONSOLE.printf(F("\r\n"));
 	if (_systemController->isStopped())
 	{
-		CTRL_SERIAL.print(F("*ESTOP* "));
+		CONSOLE.print(F("*ESTOP* "));
 	}
-	CTRL_SERIAL.printf(F("%s"),prompt);
+	CONSOLE.printf(F("%s"),prompt);
 }
 
 void sendLoggingCommand(const char* logSource, char* logLine)
 {
-	CTRL_SERIAL.printf(F("(%s)> %s\n"),logSource, logLine);
+	CONSOLE.printf(F("(%s)> %s\n"),logSource, logLine);
 }
 
 boolean isIt(char* test, const char* cmd)
@@ -83,279 +131,333 @@ boolean isIt(char* test, const char* cmd)
 	return strncmp(test,cmd,SERIALCOMMANDBUFFER) == 0;
 }
 
+/*
+	Command tables - one per state, plus the ones that work anywhere.  Each table has to be in
+	strcmp() order (checked when it's compiled), as it's searched by halving.  Adding a command
+	is just a line here and its handler.
+*/
+
+#define COMMAND_COUNT(table) (sizeof(table) / sizeof(Command))
+
+static constexpr Command GLOBAL_COMMANDS[] = {
+	{"CMDSTATS",	&ControlInterface::printCommandStats,	"",		""},
+	{"ESTOP",		&ControlInterface::eStop,				"",		""},
+	{"HELP",		&ControlInterface::help,				"",		""},
+	{"HOSTSTATS",	&ControlInterface::printHostStats,		"",		""},
+	{"RESTART",		&ControlInterface::restart,				"",		""}
+};
+
+static constexpr Command MAIN_MENU_COMMANDS[] = {
+	{"CONTROL",		&ControlInterface::enterControl,		"",		""},
+	{"CTRLLOGOFF",	&ControlInterface::ctrlLogOff,			"",		""},
+	{"CTRLLOGON",	&ControlInterface::ctrlLogOn,			"",		""},
+	{"EXECUTE",		&ControlInterface::execute,				"",		""},
+	{"GETSTATUS",	&ControlInterface::getStatus,			"",		""},
+	{"GETTIME",		&ControlInterface::getTime,				"",		""},
+	{"GETVER",		&ControlInterface::getVersion,			"",		""},
+	{"LISTRUNNING",	&ControlInterface::listRunningSeq,		"",		""},
+	{"LOG",			&ControlInterface::logLevel,			"WW",	"[SCHED|CTRL|TIMING DEBUG|INFO|NOTICE|ERROR|OFF]"},
+	{"PROGRAM",		&ControlInterface::enterProgram,		"",		""},
+	{"RUN",			&ControlInterface::runSchedule,			"",		""},
+	{"SCHEDLOGOFF",	&ControlInterface::schedLogOff,			"",		""},
+	{"SCHEDLOGON",	&ControlInterface::schedLogOn,			"",		""},
+	{"SETDATE",		&ControlInterface::intSetDate,			"w",	"DD/MM/YYYY"},
+	{"SETTIME",		&ControlInterface::intSetTime,			"w",	"HH:MM:SS"},
+	{"STOP",		&ControlInterface::stopSchedule,		"",		""},
+	{"TICKOFF",		&ControlInterface::tickOff,				"",		""},
+	{"TICKON",		&ControlInterface::tickOn,				"",		""}
+};
+
+static constexpr Command CONTROL_COMMANDS[] = {
+	{"CLEARLINK",	&ControlInterface::clearLinkStats,		"N",	"[motor]"},
+	{"CLEARTRIGGERS",&ControlInterface::clearTriggers,		"",		""},
+	{"CRCMODE",		&ControlInterface::setCrcMode,			"n",	"<0|1|2>"},
+	{"DELSCENE",	&ControlInterface::deleteScene,			"n",	"<scene>"},
+	{"DISCOVER",	&ControlInterface::discoverMotors,		"",		""},
+	{"DMXLEN",		&ControlInterface::setDmxFrameLength,	"n",	"<slots>"},
+	{"DMXMERGE",	&ControlInterface::setDmxMergeMode,		"nwW",	"<first> [last] HTP|LTP"},
+	{"DMXRATE",		&ControlInterface::setDmxRefreshRate,	"n",	"<Hz, 0 for uncapped>"},
+	{"DMXSTATS",	&ControlInterface::printDmxStats,		"",		""},
+	{"EXIT",		&ControlInterface::exitMenu,			"",		""},
+	{"GETDMX",		&ControlInterface::printDmx,			"N",	"[channel]"},
+	{"GETGROUPS",	&ControlInterface::printGroupStats,		"",		""},
+	{"GETLINK",		&ControlInterface::printLinkStats,		"",		""},
+	{"GETMOTOR",	&ControlInterface::printMotor,			"n",	"<motor>"},
+	{"GROUPLEAD",	&ControlInterface::setMotorLead,		"w",	"ON|OFF"},
+	{"HISTORY",		&ControlInterface::printMotorHistory,	"nW",	"<motor> [COARSE]"},
+	{"I2CSTATS",	&ControlInterface::printI2CStats,		"",		""},
+	{"LISTI2C",		&ControlInterface::printI2CDevices,		"",		""},
+	{"RECALLSCENE",	&ControlInterface::recallScene,			"n",	"<scene>"},
+	{"RELAY",		&ControlInterface::relayToggle,			"nn",	"<relay> <0|1>"},
+	{"RELAYS",		&ControlInterface::printRelays,			"",		""},
+	{"SAVESCENE",	&ControlInterface::saveScene,			"nW",	"<scene> [name]"},
+	{"SCENES",		&ControlInterface::listScenes,			"",		""},
+	{"SENSORS",		&ControlInterface::printSensors,		"",		""},
+	{"SETDMX",		&ControlInterface::setDmx,				"nn",	"<channel> <level>"},
+	{"SETMOTOR",	&ControlInterface::setMotor,			"nnW",	"<motor> <percent> [FWD|REV]"},
+	{"THERMAL",		&ControlInterface::thermal,				"WNN",	"[MOTOR|ENCLOSURE <start> <limit>]"},
+	{"TIMERS",		&ControlInterface::printTimers,			"",		""},
+	{"TRIGGER",		&ControlInterface::addTrigger,			"wnW",	"<pin|Xn> <sequence> [FALLING|RISING|BOTH]"},
+	{"TRIGGERS",	&ControlInterface::printTriggers,		"",		""}
+};
+
+static constexpr Command PROGRAM_COMMANDS[] = {
+	{"ADDSCHED",	&ControlInterface::addSched,			"nw",	"<sequence> <schedule>"},
+	{"CLEARSCHED",	&ControlInterface::clearSched,			"",		""},
+	{"CLEARSEQ",	&ControlInterface::clearSeq,			"",		""},
+	{"EDITSEQ",		&ControlInterface::editSeq,				"n",	"<sequence>"},
+	{"EXIT",		&ControlInterface::exitMenu,			"",		""},
+	{"LISTSCHED",	&ControlInterface::listSched,			"",		""},
+	{"LISTSEQ",		&ControlInterface::listSeq,				"",		""},
+	{"LOAD",		&ControlInterface::loadSched,			"",		""},
+	{"SAVE",		&ControlInterface::saveSched,			"",		""}
+};
+
+static constexpr Command PROG_ADDSEQ_COMMANDS[] = {
+	{"ADDCUE",		&ControlInterface::addCue,				"w",	"<cue>"},
+	{"EXIT",		&ControlInterface::exitMenu,			"",		""},
+	{"LISTCUES",	&ControlInterface::listCues,			"",		""}
+};
+
+constexpr int commandCompare(const char* a, const char* b)
+{
+	return (*a != *b || *a == '\0') ? (*a - *b) : commandCompare(a + 1, b + 1);
+}
+
+template<int N> constexpr bool commandsSorted(const Command (&table)[N], int i = 1)
+{
+	return i >= N || (commandCompare(table[i - 1].name, table[i].name) < 0 && commandsSorted(table, i + 1));
+}
+
+static_assert(commandsSorted(GLOBAL_COMMANDS), "GLOBAL_COMMANDS must be in order");
+static_assert(commandsSorted(MAIN_MENU_COMMANDS), "MAIN_MENU_COMMANDS must be in order");
+static_assert(commandsSorted(CONTROL_COMMANDS), "CONTROL_COMMANDS must be in order");
+static_assert(commandsSorted(PROGRAM_COMMANDS), "PROGRAM_COMMANDS must be in order");
+static_assert(commandsSorted(PROG_ADDSEQ_COMMANDS), "PROG_ADDSEQ_COMMANDS must be in order");
+
+static CommandStats globalStats[COMMAND_COUNT(GLOBAL_COMMANDS)];
+static CommandStats mainMenuStats[COMMAND_COUNT(MAIN_MENU_COMMANDS)];
+static CommandStats controlStats[COMMAND_COUNT(CONTROL_COMMANDS)];
+static CommandStats programStats[COMMAND_COUNT(PROGRAM_COMMANDS)];
+static CommandStats progAddSeqStats[COMMAND_COUNT(PROG_ADDSEQ_COMMANDS)];
+
+static const CommandTable GLOBAL_TABLE = {GLOBAL_COMMANDS, COMMAND_COUNT(GLOBAL_COMMANDS), globalStats};
+
+// indexed by ControlState
+static const CommandTable STATE_TABLES[] = {
+	{MAIN_MENU_COMMANDS, COMMAND_COUNT(MAIN_MENU_COMMANDS), mainMenuStats},
+	{CONTROL_COMMANDS, COMMAND_COUNT(CONTROL_COMMANDS), controlStats},
+	{PROGRAM_COMMANDS, COMMAND_COUNT(PROGRAM_COMMANDS), programStats},
+	{PROG_ADDSEQ_COMMANDS, COMMAND_COUNT(PROG_ADDSEQ_COMMANDS), progAddSeqStats}
+};
+static_assert(sizeof(STATE_TABLES) / sizeof(CommandTable) == PROG_ADDSEQ + 1, "need a command table for every ControlState");
+
+static int findCommand(const CommandTable* table, const char* name)
+{
+	int low = 0, high = table->count - 1, middle, compared;
+	while (low <= high)
+	{
+		middle = (low + high) / 2;
+		compared = strcmp(name, table->commands[middle].name);
+		if (compared == 0)
+			return middle;
+		if (compared < 0)
+			high = middle - 1;
+		else
+			low = middle + 1;
+	}
+	return -1;
+}
+
+bool ControlInterface::parseArgs(const Command* command, CommandArgs* args)
+{
+	// false if something required is missing, or a number isn't one
+	const char* spec;
+	char* word;
+	char* end;
+	memset(args, 0, sizeof(CommandArgs));
+	for (spec=command->args;*spec && args->count<COMMAND_MAX_ARGS;spec++)
+	{
+		word = next();
+		if (word == NULL)
+			return !islower(*spec); // everything after an optional one is optional too
+		args->word[args->count] = word;
+		args->number[args->count] = strtol(word,&end,10);
+		if (tolower(*spec) == 'n' && (end == word || *end != '\0'))
+			return false;
+		args->count++;
+	}
+	return true;
+}
+
+bool ControlInterface::dispatch(const CommandTable* table, char* name)
+{
+	// false if the table doesn't have it
+	CommandArgs args;
+	CommandStats *stats;
+	const Command *command;
+	unsigned long started, elapsed;
+	int index = findCommand(table, name);
+	if (index < 0)
+		return false;
+	command = &table->commands[index];
+	if (!parseArgs(command, &args))
+	{
+		CONSOLE.printf("Usage: %s %s\n", command->name, command->usage);
+		return true;
+	}
+	started = micros();
+	(this->*(command->handler))(&args);
+	elapsed = micros() - started;
+	stats = &table->stats[index];
+	stats->calls++;
+	stats->lastMicros = elapsed;
+	stats->totalMicros += elapsed;
+	if (elapsed > stats->maxMicros)
+		stats->maxMicros = elapsed;
+	return true;
+}
+
 void ControlInterface::readSerial()
 {
+	// every session gets a turn each time round, and runs at most one command in it, so
+	// one port can't hold the other up; then whatever they've printed goes out a slice at a time
+	int i;
 	if (!started) return;
-		// If we're using the Hardware port, check it.   Otherwise check the user-created SoftwareSerial Port
-	while (CTRL_SERIAL.available() > 0) 
+	for (i=0;i<_numSessions;i++)
+	{
+		use(&_sessions[i]);
+		readSession();
+		CONSOLE.drain();
+	}
+	if (_numSessions > 0)
+		use(&_sessions[0]);
+}
+
+void ControlInterface::readSession()
+{
+	_session->host.poll();
+	// the prompt waits for a listing to finish coming out
+	if (_session->promptPending && !CONSOLE.generating())
+	{
+		_session->promptPending = false;
+		issuePrompt();
+	}
+	while (_session->port->available() > 0) 
 	{
 		boolean matched; 
-		inChar=CTRL_SERIAL.read();   // Read single available character, there may be more waiting
+		inChar=_session->port->read();   // Read single available character, there may be more waiting
+		// a sync byte where a command would start is the host protocol, and so is the rest of the frame
+		if (_session->host.receiving() || (_session->bufPos == 0 && (uint8_t) inChar == HOST_SYNC))
+		{
+			_session->host.receive(inChar);
+			continue;
+		}
 		#ifdef SERIALCOMMANDDEBUG
-		CTRL_SERIAL.print(inChar);   // Echo back to serial stream
+		CONSOLE.print(inChar);   // Echo back to serial stream
 		#endif
 		if (inChar==term) {     // Check for the terminator (default '\r') meaning end of command
 			#ifdef SERIALCOMMANDDEBUG
-			CTRL_SERIAL.print(F("Received: ")); 
-			CTRL_SERIAL.println(buffer);
+			CONSOLE.print(F("Received: ")); 
+			CONSOLE.println(_session->buffer);
 		    #endif
-			bufPos=0;           // Reset to start of buffer
-			token = strtok_r(buffer,delim,&last);   // Search for command at start of buffer
+			_session->bufPos=0;           // Reset to start of buffer
+			if (_session->overlong)
+			{
+				// half a command could do anything, so none of it is run
+				_session->overlong = false;
+				_session->linesTooLong++;
+				CONSOLE.println();
+				CONSOLE.printf(F("$ LINE TOO LONG, %d CHARACTERS MAX\r\n"), SERIALCOMMANDBUFFER - 1);
+				clearBuffer();
+				issuePrompt();
+				return;
+			}
+			token = strtok_r(_session->buffer,delim,&last);   // Search for command at start of buffer
 			if (token == NULL) 
 			{
 					issuePrompt();
 					return;
 			}
-			matched=false; 
-			CTRL_SERIAL.println();
-			/* Global Commands */
-			
-			if (isIt(token,"ESTOP"))
-			{
-				CTRL_SERIAL.println(F("!!! STOP !!!"));
-				_sched->stop();
-				_systemController->eStop();
-				matched=true;
-			}
-			
-			if (isIt(token,"RESTART"))
-			{
-				CTRL_SERIAL.println(F("Resetting from ESTOP"));
-				_systemController->restart();
-				CTRL_SERIAL.println(F("You may now restart the schedule with the RUN command when you're ready"));
-				matched=true;				
-			}
-			
-			if (_state == MAIN_MENU)
-			{
-				/* Main Menu commands */
-				if (isIt(token,"EXECUTE"))
-				{
-					_sched->execute();
-					matched=true;
-				}
-				if (isIt(token,"TICKON"))
-				{
-					_clockManager->setTicking(true);
-					matched=true;
-				}
-				if (isIt(token,"TICKOFF"))
-				{
-					_clockManager->setTicking(false);
-					matched=true;
-				}
-				if (isIt(token,"SCHEDLOGON"))
-				{
-						debugEnable(true);
-						matched=true;
-				}
-				if (isIt(token,"SCHEDLOGOFF"))
-				{
-						debugEnable(false);
-						matched=true;
-				}
-				if (isIt(token,"CTRLLOGON"))
-				{
-					controlLogging(true);
-					matched=true;
-				}
-				if (isIt(token,"CTRLLOGOFF"))
-				{
-					controlLogging(false);
-					matched=true;
-				}
-				if (isIt(token,"GETSTATUS"))
-				{
-					getStatus();
-					matched=true;
-				}
-				if (isIt(token,"GETVER"))
-				{
-					getVersion();
-					matched=true;
-				}
-				if (isIt(token,"RUN"))
-				{
-					runSchedule();
-					matched=true;
-				}
-				if (isIt(token,"STOP"))
-				{
-					stopSchedule();
-					matched=true;
-				}
-				if (isIt(token,"GETTIME"))
-				{
-					getTime();
-					matched=true;
-				}
-				if (isIt(token,"SETTIME"))
-				{
-					intSetTime();
-					matched=true;
-				}	
-				if (isIt(token,"LISTRUNNING"))
-				{
-					listRunningSeq();
-					matched=true;
-				}
-				if (isIt(token,"SETDATE"))
-				{
-					intSetDate();
-					matched=true;
-				}				
-				/* State transitions */
-				if (isIt(token,"CONTROL"))
-				{
-					matched=true;
-					_state = CONTROL;
-
-				}
-				if (isIt(token,"PROGRAM"))
-				{
-					matched=true;
-					_state = PROGRAM;
-
-				}
-				
-			} else if (_state == CONTROL)
-			{
-				if(isIt(token,"RELAY"))
-				{
-					matched=true;
-					relayToggle();
-				}
-				if(isIt(token,"SETMOTOR"))
-				{
-					matched=true;
-					setMotor();
-				}
-				if(isIt(token,"GETMOTOR"))
-				{
-					matched=true;
-					printMotor();
-				}
-				if (isIt(token,"GETDMX"))
-				{
-					matched=true;
-					printDmx();
-				}
-				if (isIt(token,"SETDMX"))
-				{
-					matched=true;
-					setDmx();
-				}
-				if (isIt(token,"LISTI2C"))
-				{
-					matched=true;
-					printI2CDevices();
-				}
-				/* State transitions */
-				if (isIt(token,"EXIT"))
-				{
-					matched=true;
-					_state = MAIN_MENU;
-
-				}
-				
-			} else if (_state == PROGRAM)
-			{
-				if (isIt(token,"LISTSEQ"))
-				{
-					matched=true;
-					listSeq();
-				}
-				if (isIt(token,"CLEARSEQ"))
-				{
-					matched=true;
-					clearSeq();
-				}
-				if (isIt(token,"ADDSCHED"))
-				{
-					matched=true;
-					addSched();
-				}
-				if (isIt(token,"CLEARSCHED"))
-				{
-					matched=true;
-					clearSched();
-				}		
-				if (isIt(token,"LISTSCHED"))
-				{
-					matched=true;
-					listSched();
-				}					
-				if (isIt(token,"SAVE"))
-				{
-					matched=true;
-					saveSched();
-				}
-				if (isIt(token,"LOAD"))
-				{
-					matched=true;
-					loadSched();
-				}						
-				/* State transitions */
-				if (isIt(token,"EDITSEQ"))
-				{
-					matched=true;
-					addSeq();
-					_state = PROG_ADDSEQ;
-				}
-				if (isIt(token,"EXIT"))
-				{
-					matched=true;
-					_state = MAIN_MENU;
-				}
-			} else if (_state == PROG_ADDSEQ)
-			{
-				if (isIt(token,"LISTCUES"))
-				{
-					listCues();
-					matched=true;
-				}
-				if (isIt(token,"ADDCUE"))
-				{
-					matched=true;
-					addCue();
-				}
-
-				/* State Transitions */
-				if (isIt(token,"EXIT"))
-				{
-					matched=true;
-					_state = PROGRAM;
-				}				
-			}
-			
+			CONSOLE.println();
+			matched = dispatch(&GLOBAL_TABLE, token) || dispatch(&STATE_TABLES[_session->state], token);
 			if (matched==false) {
-				CTRL_SERIAL.println("$ INVALID COMMAND");
-				clearBuffer(); 
-				issuePrompt();
-			} else {
-				clearBuffer();
-				issuePrompt();
+				CONSOLE.println("$ INVALID COMMAND");
 			}
-
+			clearBuffer();
+			if (CONSOLE.generating())
+				_session->promptPending = true;
+			else
+				issuePrompt();
+			return;			// the other sessions' turn, the rest of the input waits
 		}
 		if (inChar == 127 || inChar == 8)
 		{
-			if (bufPos > 0)
+			if (_session->bufPos > 0)
 			{
-				CTRL_SERIAL.write(inChar);
-				buffer[bufPos--] = '\0';
+				CONSOLE.write(inChar);
+				_session->buffer[--_session->bufPos] = '\0';
 			}
 		}
 		if (isprint(inChar))   // Only printable characters into the buffer
 		{
-			CTRL_SERIAL.write(inChar);
-			buffer[bufPos++]=inChar;   // Put character into buffer
-			buffer[bufPos]='\0';  // Null terminate
-			if (bufPos > SERIALCOMMANDBUFFER-1) bufPos=0; // wrap buffer around if full  
+			if (_session->bufPos >= SERIALCOMMANDBUFFER-1)
+			{
+				_session->overlong = true;	// said so when the line ends
+				continue;
+			}
+			CONSOLE.write(inChar);
+			_session->buffer[_session->bufPos++]=inChar;   // Put character into buffer
+			_session->buffer[_session->bufPos]='\0';  // Null terminate
 		}
 	}
 }
 
+void ControlInterface::printCommands(const CommandTable* table)
+{
+	int i;
+	for (i=0;i<table->count;i++)
+		CONSOLE.printf(F("%s %s\r\n"), table->commands[i].name, table->commands[i].usage);
+}
+
+void ControlInterface::help(CommandArgs* args)
+{
+	printCommands(&STATE_TABLES[_session->state]);
+	printCommands(&GLOBAL_TABLE);
+}
+
+void ControlInterface::printStats(const CommandTable* table)
+{
+	int i;
+	CommandStats *stats;
+	for (i=0;i<table->count;i++)
+	{
+		stats = &table->stats[i];
+		if (stats->calls == 0)
+			continue;
+		CONSOLE.printf(F("%-14s %6lu calls, last %lu us, average %lu us, worst %lu us\r\n"), table->commands[i].name,
+			stats->calls, stats->lastMicros, stats->totalMicros / stats->calls, stats->maxMicros);
+	}
+}
+
+void ControlInterface::printHostStats(CommandArgs* args)
+{
+	_session->host.printStats();
+}
+
+void ControlInterface::printCommandStats(CommandArgs* args)
+{
+	// every command that's been run since boot, and how long it took
+	unsigned int i;
+	printStats(&GLOBAL_TABLE);
+	for (i=0;i<sizeof(STATE_TABLES) / sizeof(CommandTable);i++)
+		printStats(&STATE_TABLES[i]);
+	CONSOLE.printStats();
+	for (i=0;i<(unsigned int) _numSessions;i++)
+		CONSOLE.printf(F("Session %u: %lu lines too long\r\n"), i, _sessions[i].linesTooLong);
+	userSerialRx.printStats();
+}
+
 //
 // Initialize the command buffer being processed to all null characters
 //
@@ -363,9 +465,9 @@ void ControlInterface::clearBuffer()
 {
 	for (int i=0; i<SERIALCOMMANDBUFFER; i++) 
 	{
-		buffer[i]='\0';
+		_session->buffer[i]='\0';
 	}
-	bufPos=0; 
+	_session->bufPos=0; 
 }
 
 // Retrieve the next token ("word" or "argument") from the Command buffer.  
@@ -379,141 +481,239 @@ char *ControlInterface::next()
 
 void ControlInterface::setSched(Scheduler* sched)
 {
+	int i;
 	_sched = sched;
+	for (i=0;i<_numSessions;i++)
+		_sessions[i].host.setSched(sched);
 }
 
 void ControlInterface::setSystemController(SystemControl* controller)
 {
+	int i;
 	_systemController = controller;
+	for (i=0;i<_numSessions;i++)
+		_sessions[i].host.setSystemController(controller);
 }
 /* Application methods below */
 
-void ControlInterface::getVersion()
+void ControlInterface::eStop(CommandArgs* args)
+{
+	CONSOLE.println(F("!!! STOP !!!"));
+	_sched->stop();
+	_systemController->eStop();
+}
+
+void ControlInterface::restart(CommandArgs* args)
+{
+	CONSOLE.println(F("Resetting from ESTOP"));
+	_systemController->restart();
+	CONSOLE.println(F("You may now restart the schedule with the RUN command when you're ready"));
+}
+
+void ControlInterface::enterControl(CommandArgs* args)
+{
+	_session->state = CONTROL;
+}
+
+void ControlInterface::enterProgram(CommandArgs* args)
+{
+	_session->state = PROGRAM;
+}
+
+void ControlInterface::exitMenu(CommandArgs* args)
 {
-	CTRL_SERIAL.print(F("Firmware version: "));
-	CTRL_SERIAL.println(HOLST_VERSION);
+	// back up a level
+	_session->state = (_session->state == PROG_ADDSEQ) ? PROGRAM : MAIN_MENU;
 }
 
-void ControlInterface::getStatus()
+void ControlInterface::execute(CommandArgs* args)
 {
+	_sched->execute();
+}
+
+void ControlInterface::tickOn(CommandArgs* args)
+{
+	_clockManager->setTicking(true);
+}
+
+void ControlInterface::tickOff(CommandArgs* args)
+{
+	_clockManager->setTicking(false);
+}
+
+void ControlInterface::schedLogOn(CommandArgs* args)
+{
+	debugEnable(true);
+}
+
+void ControlInterface::schedLogOff(CommandArgs* args)
+{
+	debugEnable(false);
+}
+
+void ControlInterface::ctrlLogOn(CommandArgs* args)
+{
+	controlLogging(true);
+}
+
+void ControlInterface::ctrlLogOff(CommandArgs* args)
+{
+	controlLogging(false);
+}
+
+void ControlInterface::getVersion(CommandArgs* args)
+{
+	CONSOLE.print(F("Firmware version: "));
+	CONSOLE.println(HOLST_VERSION);
+}
+
+void ControlInterface::getStatus(CommandArgs* args)
+{
+	int i;
 	// read the system board information out
-	CTRL_SERIAL.println(F("System Status"));
-	CTRL_SERIAL.printf(F("Firmware Revision: %s ; HW Revision: %d\r\n"),HOLST_VERSION,HW_REV);
-	CTRL_SERIAL.printf(F("Temperature: %.2f\r\n"),_systemController->getTemperatureC());
-	CTRL_SERIAL.printf(F("CPU Temperature: %.2f\r\n"),_systemController->getInternalTemperatureC());
+	CONSOLE.println(F("System Status"));
+	CONSOLE.printf(F("Firmware Revision: %s ; HW Revision: %d\r\n"),HOLST_VERSION,HW_REV);
+	CONSOLE.printf(F("Temperature: %.2f\r\n"),_systemController->getTemperatureC());
+	CONSOLE.printf(F("CPU Temperature: %.2f\r\n"),_systemController->getInternalTemperatureC());
+	CONSOLE.printf(F("Loop: %lu us average, worst %lu us in the last second, %lu us since boot\r\n"),_systemController->getLoopMicros(),
+		_systemController->getLoopWorstMicros(),_systemController->getLoopWorstEverMicros());
+	for (i=0;_sensors != NULL && i<_sensors->numSensors();i++)
+	{
+		if (_sensors->getSensor(i)->valid)
+			CONSOLE.printf(F("Sensor %d: %.2f\r\n"), i + 1, _sensors->milliC(i) / 1000.0);
+	}
 	if (_systemController->isStopped())
 	{
-		CTRL_SERIAL.println(F("ESTOP is engaged"));
+		CONSOLE.println(F("ESTOP is engaged"));
 	}
 }
 
-void ControlInterface::runSchedule()
+void ControlInterface::runSchedule(CommandArgs* args)
 {
-	CTRL_SERIAL.println("Telling the schedule to run");
+	CONSOLE.println("Telling the schedule to run");
 	if (_sched != NULL)
 	{
 		_sched->start();
 	}
 }
 
-void ControlInterface::stopSchedule()
+void ControlInterface::stopSchedule(CommandArgs* args)
 {
-	CTRL_SERIAL.println("Telling the schedule to run");
+	CONSOLE.println("Telling the schedule to run");
 	if (_sched != NULL)
 	{
 		_sched->stop();
 	}
 }
 
-void ControlInterface::relayToggle()
+void ControlInterface::relayToggle(CommandArgs* args)
 {
-	String relayNumberStr = String(next());
-	String stateStr = String(next());
-	unsigned long relayNumber = relayNumberStr.toInt();
-	unsigned long state = 0;
-	if (stateStr.equals("1"))
-	{
-		state = 100;
-	}
-	_systemController->setRelay(relayNumber,state,0);
-
+	unsigned long state = (args->number[1] == 1) ? 100 : 0;
+	_systemController->setRelay(args->number[0],state,0);
 }
 
 void ControlInterface::debugEnable(bool offon)
 {
-	if (_sched != NULL)
+	eventLog.setLevel(LOG_SCHED, offon ? LOG_LEVEL_DEBUG : LOG_LEVEL_NOTICE);
+}
+
+void ControlInterface::controlLogging(bool offon)
+{
+	eventLog.setLevel(LOG_CTRL, offon ? LOG_LEVEL_DEBUG : LOG_LEVEL_NOTICE);
+}
+
+void ControlInterface::logLevel(CommandArgs* args)
+{
+	// LOG on its own shows the levels, LOG <subsystem> <level> sets one
+	int subsystem, level;
+	if (args->count > 0)
 	{
-		_sched->_debugging = offon;
+		subsystem = EventLog::findSubsystem(args->word[0]);
+		level = (args->count > 1) ? EventLog::findLevel(args->word[1]) : -1;
+		if (subsystem < 0 || level < 0)
+		{
+			CONSOLE.println(F("Usage: LOG [SCHED|CTRL|TIMING DEBUG|INFO|NOTICE|ERROR|OFF]"));
+			return;
+		}
+		eventLog.setLevel(subsystem, level);
 	}
+	eventLog.printStats();
 }
 
-void ControlInterface::controlLogging(bool offon)
+void ControlInterface::logLine(void* context, const char* line)
 {
-	if (_systemController != NULL)
+	// log lines go to every session
+	ControlInterface *ctrl = (ControlInterface*) context;
+	ControlSession *current = ctrl->_session;
+	int i;
+	for (i=0;i<ctrl->_numSessions;i++)
 	{
-		_systemController->loggingEnable(offon);
+		ctrl->use(&ctrl->_sessions[i]);
+		CONSOLE.print(line);
 	}
+	if (current != NULL)
+		ctrl->use(current);
 }
 
 void printDigits(int digits){
   // utility function for digital clock display: prints preceding colon and leading 0
   if(digits < 10)
-    CTRL_SERIAL.print('0');
-  CTRL_SERIAL.print(digits);
+    CONSOLE.print('0');
+  CONSOLE.print(digits);
 }
 
 void printTime()
 {
 	time_t t = now();
 	printDigits(hour(t));
-	CTRL_SERIAL.print(":");
+	CONSOLE.print(":");
 	printDigits(minute(t));
-	CTRL_SERIAL.print(":");
+	CONSOLE.print(":");
 	printDigits(second(t));
-	CTRL_SERIAL.print(" ");
-	CTRL_SERIAL.print(day(t));
-	CTRL_SERIAL.print("/");
-	CTRL_SERIAL.print(month(t));
-	CTRL_SERIAL.print("/");
-	CTRL_SERIAL.print(year(t)); 
+	CONSOLE.print(" ");
+	CONSOLE.print(day(t));
+	CONSOLE.print("/");
+	CONSOLE.print(month(t));
+	CONSOLE.print("/");
+	CONSOLE.print(year(t)); 
 }
 
-void ControlInterface::getTime()
+void ControlInterface::getTime(CommandArgs* args)
 {
 	printTime();
-	CTRL_SERIAL.println();
+	CONSOLE.println();
 
 	if (timeStatus() == timeNotSet)
 	{
-		CTRL_SERIAL.println("Time is NOT set from RTC!");
+		CONSOLE.println("Time is NOT set from RTC!");
 	} else if (timeStatus() == timeSet)
 	{
-		CTRL_SERIAL.println("Time has been set from RTC");
+		CONSOLE.println("Time has been set from RTC");
 	} else if (timeStatus() ==timeNeedsSync)
 	{
-		CTRL_SERIAL.println("Time has been set, but sync has failed, so it may not be accurate");
+		CONSOLE.println("Time has been set, but sync has failed, so it may not be accurate");
 	}
 }
 
 void ControlInterface::print2digits(int number) {
 	  if (number >= 0 && number < 10) {
-		CTRL_SERIAL.write('0');
+		CONSOLE.write('0');
 	  }
-	  CTRL_SERIAL.print(number);
+	  CONSOLE.print(number);
 }
 
-void ControlInterface::intSetTime()
+void ControlInterface::intSetTime(CommandArgs* args)
 {
 	int Hour, Min, Sec;
 	tmElements_t tm;
 	time_t oldTime = now();
 	//time_t newTime;
 	breakTime(oldTime,tm);
-	char* inStr = next();
+	char* inStr = args->word[0];
 	
 	if (sscanf(inStr,"%d:%d:%d:",&Hour,&Min,&Sec) !=3)
 	{
-		CTRL_SERIAL.println("Couldn't read your time, did you use the right format? HH:MM:SS");
+		CONSOLE.println("Couldn't read your time, did you use the right format? HH:MM:SS");
 		return;
 	}
 	//tm.Hour = Hour;
@@ -524,23 +724,23 @@ void ControlInterface::intSetTime()
 	Teensy3Clock.set( now() ); 	// set the RTC
 	if( timeStatus() == timeSet)
 	{
-		CTRL_SERIAL.println("Set RTC successfully!");
-		getTime();
+		CONSOLE.println("Set RTC successfully!");
+		getTime(NULL);
 	}
 }
 
-void ControlInterface::intSetDate()
+void ControlInterface::intSetDate(CommandArgs* args)
 {
 	tmElements_t tm;
 	time_t oldTime = now();
 	//time_t newTime;
 	breakTime(oldTime,tm);
 	int Month, Day, Year;
-	char* inStr = next();
+	char* inStr = args->word[0];
 
 	if (sscanf(inStr, "%d/%d/%d",  &Day, &Month, &Year) != 3) 
 	{
-	  CTRL_SERIAL.println("Couldn't read your date, did you use the right format? DD/MM/YYYY");
+	  CONSOLE.println("Couldn't read your date, did you use the right format? DD/MM/YYYY");
 	  return;
 	};
 
@@ -552,157 +752,160 @@ void ControlInterface::intSetDate()
 	
 	if( timeStatus() == timeSet)
 	{
-		CTRL_SERIAL.println("Set RTC successfully!");
-		getTime();
+		CONSOLE.println("Set RTC successfully!");
+		getTime(NULL);
 	}
 }
 
 
 
-void ControlInterface::addSeq()
+void ControlInterface::editSeq(CommandArgs* args)
 {
-	char* seqId = next();
-	currentSeqId = strtol(seqId,NULL,10);
-	CTRL_SERIAL.printf("Adding sequence %d\n",currentSeqId);
+	_session->currentSeqId = args->number[0];
+	CONSOLE.printf("Adding sequence %d\n",_session->currentSeqId);
+	_session->state = PROG_ADDSEQ;
 }
 
-void ControlInterface::clearSeq()
+void ControlInterface::clearSeq(CommandArgs* args)
 {
 	// all of them!
-	CTRL_SERIAL.println("Removing ALL sequences!");
+	CONSOLE.println("Removing ALL sequences!");
 	_sched->sequenceClearAll();
 }
 
-void ControlInterface::listSeq()
+void ControlInterface::listSeq(CommandArgs* args)
 {
 	// do a list of all available sequences
 	Sequence *seq;
 	int i;
-	CTRL_SERIAL.println("Sequences");
+	CONSOLE.println("Sequences");
 	for(i=0;i<_sched->_numSequences;i++)
 	{
 		seq = &_sched->_sequences[i];
-		CTRL_SERIAL.printf("%i [%d] (num cues: %d)\n",seq->sequenceId,i,seq->numCues);
+		CONSOLE.printf("%i [%d] (num cues: %d)\n",seq->sequenceId,i,seq->numCues);
 	}
-	CTRL_SERIAL.println("----------------------");
+	CONSOLE.println("----------------------");
 }
 
-void ControlInterface::addCue()
+void ControlInterface::addCue(CommandArgs* args)
 {
-	char* cue = next();
-	String cueString = String(cue);
-	if (!cueString.substring(0,1).equals("$"))
+	char* cue = args->word[0];
+	if (cue[0] != '$')
 	{
-		CTRL_SERIAL.println("Invalid cue specification, must start with $");
+		CONSOLE.println("Invalid cue specification, must start with $");
 	}
-	_sched->sequenceAppendCue(currentSeqId,cue);
+	_sched->sequenceAppendCue(_session->currentSeqId,cue);
 }
 
-void ControlInterface::listCues()
+void ControlInterface::listCues(CommandArgs* args)
 {
 	int i;
-	Sequence *seq = _sched->sequenceGet(currentSeqId);
+	Sequence *seq = _sched->sequenceGet(_session->currentSeqId);
 	if (seq == NULL)
 	{
-		CTRL_SERIAL.printf("Sequence %i not yet created, add a cue first please!",currentSeqId);
+		CONSOLE.printf("Sequence %i not yet created, add a cue first please!",_session->currentSeqId);
 		return;
 	}
-	CTRL_SERIAL.printf("Sequence: %i (total cues: %d)\n",currentSeqId,seq->numCues);
+	CONSOLE.printf("Sequence: %i (total cues: %d)\n",_session->currentSeqId,seq->numCues);
 	for (i=0;i<seq->numCues;i++)
 	{
-		CTRL_SERIAL.printf("%s\n",seq->cues[i]);
+		CONSOLE.printf("%s\n",seq->cues[i]);
 	}
-	CTRL_SERIAL.print("------------------------------------\n");
+	CONSOLE.print("------------------------------------\n");
 }
 
 void ControlInterface::printSeq(long seqIdToPrint)
 {
-	CTRL_SERIAL.printf("I'm printing sequence %d\n",seqIdToPrint);
+	CONSOLE.printf("I'm printing sequence %d\n",seqIdToPrint);
 	// print a sequence
 }
 
-void ControlInterface::addSched()
+void ControlInterface::addSched(CommandArgs* args)
 {
-
-	char* strSeqId = next();
-	char* schedDef = next();
-	long seqId = strtol(strSeqId,NULL,10);
-	CTRL_SERIAL.printf("Adding a schedule for sequence %d - %s\n",seqId,schedDef);
+	long seqId = args->number[0];
+	char* schedDef = args->word[1];
+	CONSOLE.printf("Adding a schedule for sequence %d - %s\n",seqId,schedDef);
 	_sched->scheduleAdd(seqId,schedDef);
 }
 
-void ControlInterface::clearSched()
+void ControlInterface::clearSched(CommandArgs* args)
 {
-	CTRL_SERIAL.println("Clearing the schedule!");
+	CONSOLE.println("Clearing the schedule!");
 	_sched->scheduleClear();
-	CTRL_SERIAL.println("Cleared");
+	CONSOLE.println("Cleared");
 }
 
-void ControlInterface::saveSched()
+void ControlInterface::saveSched(CommandArgs* args)
 {
-	CTRL_SERIAL.println("Saving schedule to SD card");
+	CONSOLE.println("Saving schedule to SD card");
 	if (_sched->saveToSD())
 	{
-		CTRL_SERIAL.println("Saved.");
+		CONSOLE.println("Saved.");
 	} else {
-		CTRL_SERIAL.println("Did NOT save successfully!");
+		CONSOLE.println("Did NOT save successfully!");
 	}
 }
 
-void ControlInterface::loadSched()
+void ControlInterface::loadSched(CommandArgs* args)
 {
-	CTRL_SERIAL.println("Loading schedule and sequences from SD card");
+	CONSOLE.println("Loading schedule and sequences from SD card");
 	if(!_sched->loadFromSD())
 	{
-		CTRL_SERIAL.println("Did NOT load schedule successfully!");
+		CONSOLE.println("Did NOT load schedule successfully!");
 	} else {
-		CTRL_SERIAL.println("Loaded.");
+		CONSOLE.println("Loaded.");
 	}
 }
 
-void ControlInterface::listSched()
+void ControlInterface::listSched(CommandArgs* args)
 {
 	// do a list of all available sequences
+	CONSOLE.println("Schedules");
+	CONSOLE.generate(scheduleLine, this);
+}
+
+bool ControlInterface::scheduleLine(void* context, unsigned int* cursor)
+{
+	ControlInterface *ctrl = (ControlInterface*) context;
 	Schedule *mySched;
-	int i;
-	CTRL_SERIAL.println("Schedules");
-	for(i=0;i<_sched->_numSchedules;i++)
+	if ((int) *cursor >= ctrl->_sched->_numSchedules)
 	{
-		mySched = &_sched->_schedule[i];
-		CTRL_SERIAL.printf("[%d] Seq:%i (%s)\n",i,mySched->sequenceId,mySched->schedDef);
+		CONSOLE.println("----------------------");
+		return false;
 	}
-	CTRL_SERIAL.println("----------------------");
+	mySched = &ctrl->_sched->_schedule[*cursor];
+	CONSOLE.printf("[%d] Seq:%i (%s)\n",*cursor,mySched->sequenceId,mySched->schedDef);
+	(*cursor)++;
+	return true;
 }
 
-void ControlInterface::listRunningSeq()
+void ControlInterface::listRunningSeq(CommandArgs* args)
 {
 	RunningSequence *ptr;
 	int i;
-	CTRL_SERIAL.println("Running Sequences");
+	CONSOLE.println("Running Sequences");
 	for (i=0;i<SCHEDULER_MAX_RUNNING_SEQUENCES;i++)
 	{
 		ptr = _sched->_currentlyRunningSlots[i];
 		if (ptr == NULL)
 			continue;
-		CTRL_SERIAL.printf("Sequence [%d] started %d\r\n", ptr->running->sequenceId, ptr->milliStarted);
+		CONSOLE.printf("Sequence [%d] started %d\r\n", ptr->running->sequenceId, ptr->milliStarted);
 	}
 }
 
 void ControlInterface::printTimestamp()
 {
   // digital clock display of the time
-	CTRL_SERIAL.print("[");
+	CONSOLE.print("[");
 	printTime();
-	CTRL_SERIAL.print("] - ");
+	CONSOLE.print("] - ");
 }
 
-void ControlInterface::setMotor()
+void ControlInterface::setMotor(CommandArgs* args)
 {
-	char* inDevId = next();
-	char* inPercent = next();
-	char devId = (char) String(inDevId).toInt();
-	unsigned long percent = String(inPercent).toInt();
-	char* direction = next();
+	char devId = (char) args->number[0];
+	unsigned long percent = args->number[1];
+	char* direction = args->word[2];
 	if (direction == NULL)
 	{	
 		_systemController->sendMotorCommand(devId,percent,0);
@@ -716,13 +919,22 @@ void ControlInterface::setMotor()
 		}
 	}
 	printTimestamp();
-	CTRL_SERIAL.printf("Set motor %d to %d%%\n",devId,percent);
+	CONSOLE.printf("Set motor %d to %d%%\n",devId,percent);
 }
 
 void ControlInterface::printLog(String logline)
 {
-	printTimestamp();
-	CTRL_SERIAL.println(logline);
+	// every session sees the log
+	ControlSession *current = _session;
+	int i;
+	for (i=0;i<_numSessions;i++)
+	{
+		use(&_sessions[i]);
+		printTimestamp();
+		CONSOLE.println(logline);
+	}
+	if (current != NULL)
+		use(current);
 }
 
 void ControlInterface::setClockManager(ClockManager* clockManager)
@@ -730,28 +942,110 @@ void ControlInterface::setClockManager(ClockManager* clockManager)
 		_clockManager = clockManager;
 }
 
+void ControlInterface::setInputTriggers(InputTriggers* inputs)
+{
+	_inputs = inputs;
+}
+
+void ControlInterface::setOneWireSensors(OneWireSensors* sensors)
+{
+	_sensors = sensors;
+}
+
 void ControlInterface::setMotorControl(MotorControl* motors)
 {
+	int i;
 	_motors = motors;
+	for (i=0;i<_numSessions;i++)
+		_sessions[i].host.setMotorControl(motors);
 }
 
-void ControlInterface::printMotor()
+void ControlInterface::printMotor(CommandArgs* args)
 {
-	char* strMotorId = next();
-	char devId = String(strMotorId).toInt();
+	char devId = args->number[0];
 	if (_motors == NULL)
 	{
-		CTRL_SERIAL.println("No motor controller running!");
+		CONSOLE.println("No motor controller running!");
 		return;
 	}
 	_motors->printMotor(devId);
 }
 
+void ControlInterface::discoverMotors(CommandArgs* args)
+{
+	int found, before;
+	if (_motors == NULL)
+	{
+		CONSOLE.println("No motor controller running!");
+		return;
+	}
+	CONSOLE.println("Sweeping for motors");
+	before = _motors->numMotors();
+	found = _motors->sweepMotors(MOTORS_DISCOVERY_FIRST_ID, MOTORS_DISCOVERY_LAST_ID);
+	_motors->saveMotorCache();
+	CONSOLE.printf("%d motors answered, %d of them new\n", found, _motors->numMotors() - before);
+}
+void ControlInterface::printLinkStats(CommandArgs* args)
+{
+	if (_motors == NULL)
+	{
+		CONSOLE.println("No motor controller running!");
+		return;
+	}
+	_motors->printLinkStats();
+}
 
-void ControlInterface::printDmx()
+void ControlInterface::clearLinkStats(CommandArgs* args)
 {
-	char* param = next();
-	int channel = String(param).toInt();
+	char devId = args->number[0];
+	if (_motors == NULL)
+	{
+		CONSOLE.println("No motor controller running!");
+		return;
+	}
+	if (args->word[0] == NULL)
+		_motors->clearLinkStats();
+	else if (!_motors->clearLinkStats(devId))
+		CONSOLE.printf("No motor %d\n", devId);
+}
+
+void ControlInterface::printGroupStats(CommandArgs* args)
+{
+	_motors->printGroupStats();
+}
+
+void ControlInterface::setCrcMode(CommandArgs* args)
+{
+	int mode = args->number[0];
+	if (mode < MOTORS_CRC_OFF || mode > MOTORS_CRC_FULL)
+	{
+		CONSOLE.println("CRC mode must be 0 (off), 1 (commands) or 2 (commands and responses)");
+		return;
+	}
+	_motors->setCrcMode((MotorCrcMode) mode);
+	CONSOLE.printf("Motor CRC mode set to %d\n", mode);
+}
+void ControlInterface::setMotorLead(CommandArgs* args)
+{
+	bool enabled = isIt(args->word[0],"ON");
+	_systemController->setMotorLead(enabled);
+	CONSOLE.printf("Motor group lead %s (applies to sequences started from now)\n", enabled ? "on" : "off");
+}
+void ControlInterface::printMotorHistory(CommandArgs* args)
+{
+	char devId = args->number[0];
+	char* resolution = args->word[1];
+	if (_motors == NULL)
+	{
+		CONSOLE.println("No motor controller running!");
+		return;
+	}
+	_motors->printHistory(devId, resolution != NULL && isIt(resolution,"COARSE"), &_session->history);
+}
+
+void ControlInterface::printDmx(CommandArgs* args)
+{
+	int channel = args->number[0];
 	if (channel == 0)
 	{
 		_systemController->printDmxChannels();
@@ -759,17 +1053,201 @@ void ControlInterface::printDmx()
 		_systemController->printDmxChannel(channel);
 	}
 }
-void ControlInterface::printI2CDevices()
+void ControlInterface::printI2CDevices(CommandArgs* args)
 {
 	_systemController->printI2CDevices();
 }
 
-void ControlInterface::setDmx()
+void ControlInterface::setDmx(CommandArgs* args)
 {
-	char* param = next();
-	char channel = (char) String(param).toInt();
-	param = next();
-	char value = (char) String(param).toInt();
+	unsigned int channel = args->number[0];
+	char value = (char) args->number[1];
 	_systemController->setDMX(channel,value);
 }
 
+void ControlInterface::printDmxStats(CommandArgs* args)
+{
+	_systemController->printDmxStats();
+}
+
+void ControlInterface::setDmxFrameLength(CommandArgs* args)
+{
+	int frameLength = args->number[0];
+	if (frameLength < 1 || frameLength > DMX_MAX_CHANNELS)
+	{
+		CONSOLE.printf("Frame length must be between 1 and %d\n", DMX_MAX_CHANNELS);
+		return;
+	}
+	_systemController->setDmxFrameLength(frameLength);
+	CONSOLE.printf("DMX frames are now %d slots\n", frameLength);
+}
+
+void ControlInterface::setDmxRefreshRate(CommandArgs* args)
+{
+	unsigned int hz = args->number[0];
+	_systemController->setDmxRefreshRate(hz);
+	if (hz == 0)
+		CONSOLE.println("DMX refresh rate uncapped");
+	else
+		CONSOLE.printf("DMX refresh rate capped at %d Hz\n", hz);
+}
+
+void ControlInterface::setDmxMergeMode(CommandArgs* args)
+{
+	// DMXMERGE <first> [last] HTP|LTP
+	unsigned int first = args->number[0];
+	unsigned int last = first;
+	char* strMode = args->word[1];
+	if (args->word[2] != NULL)
+	{
+		last = args->number[1];
+		strMode = args->word[2];
+	}
+	if (first < 1 || last < first || last > DMX_MAX_CHANNELS)
+	{
+		CONSOLE.println("Usage: DMXMERGE <first> [last] HTP|LTP");
+		return;
+	}
+	if (isIt(strMode,"LTP"))
+	{
+		_systemController->setDmxMergeMode(first,last,true);
+	} else if (isIt(strMode,"HTP"))
+	{
+		_systemController->setDmxMergeMode(first,last,false);
+	} else {
+		CONSOLE.println("Merge mode is HTP or LTP");
+		return;
+	}
+	CONSOLE.printf("Channels %d-%d now merge %s\n", first, last, strMode);
+}
+
+void ControlInterface::printRelays(CommandArgs* args)
+{
+	_systemController->printRelays();
+}
+
+void ControlInterface::printI2CStats(CommandArgs* args)
+{
+	_systemController->printI2CStats();
+}
+
+void ControlInterface::printTimers(CommandArgs* args)
+{
+	_systemController->printTimedActions();
+}
+
+void ControlInterface::listScenes(CommandArgs* args)
+{
+	_systemController->listScenes();
+}
+
+void ControlInterface::saveScene(CommandArgs* args)
+{
+	int number = args->number[0];
+	char* name = args->word[1];
+	if (number < 0 || number >= SCENES_MAX)
+	{
+		CONSOLE.printf("Usage: SAVESCENE <0-%d> [name]\n", SCENES_MAX - 1);
+		return;
+	}
+	if (_systemController->saveScene(number, name))
+		CONSOLE.printf("Saved scene %d\n", number);
+	else
+		CONSOLE.println("Couldn't save the scene");
+}
+
+void ControlInterface::recallScene(CommandArgs* args)
+{
+	int number = args->number[0];
+	if (!_systemController->recallScene(number, 0))
+		CONSOLE.printf("Couldn't recall scene %d\n", number);
+}
+
+void ControlInterface::deleteScene(CommandArgs* args)
+{
+	int number = args->number[0];
+	if (_systemController->deleteScene(number))
+		CONSOLE.printf("Deleted scene %d\n", number);
+	else
+		CONSOLE.printf("No scene %d\n", number);
+}
+
+void ControlInterface::addTrigger(CommandArgs* args)
+{
+	// TRIGGER <pin|Xn> <sequence> [FALLING|RISING|BOTH] - Xn is pin n on the relay expanders
+	char* strPin = args->word[0];
+	unsigned long seqId = args->number[1];
+	char* strEdge = args->word[2];
+	uint8_t source = INPUT_SOURCE_PIN;
+	uint8_t edge = INPUT_EDGE_FALLING;
+	long pin;
+	if (strPin[0] == 'X' || strPin[0] == 'x')
+	{
+		source = INPUT_SOURCE_EXPANDER;
+		strPin++;
+	}
+	if (strEdge != NULL && isIt(strEdge, "RISING"))
+		edge = INPUT_EDGE_RISING;
+	if (strEdge != NULL && isIt(strEdge, "BOTH"))
+		edge = INPUT_EDGE_BOTH;
+	if (_sched->sequenceGet(seqId) == NULL)
+	{
+		CONSOLE.printf("No sequence %lu\n", seqId);
+		return;
+	}
+	pin = String(strPin).toInt();
+	if (pin < 0 || pin > 255)
+	{
+		CONSOLE.printf("There's no pin %s\n", strPin);
+		return;
+	}
+	if (!_inputs->add(source, pin, edge, seqId))
+	{
+		CONSOLE.println("Couldn't add the trigger");
+		return;
+	}
+	_inputs->save();
+	CONSOLE.printf("Sequence %lu triggered by %s%s\n", seqId, source == INPUT_SOURCE_PIN ? "pin " : "X", strPin);
+}
+
+void ControlInterface::printTriggers(CommandArgs* args)
+{
+	_inputs->print();
+}
+
+void ControlInterface::clearTriggers(CommandArgs* args)
+{
+	_inputs->clear();
+	_inputs->save();
+	CONSOLE.println("Cleared input triggers");
+}
+
+void ControlInterface::printSensors(CommandArgs* args)
+{
+	_sensors->print();
+}
+
+void ControlInterface::thermal(CommandArgs* args)
+{
+	// THERMAL on its own shows the derating; THERMAL <MOTOR|ENCLOSURE> <start> <limit> (whole degrees) changes it
+	char* strZone = args->word[0];
+	int start = args->number[1];
+	int limit = args->number[2];
+	if (strZone == NULL)
+	{
+		_motors->printThermal();
+		return;
+	}
+	if (args->count < 3 || !(isIt(strZone, "MOTOR") || isIt(strZone, "ENCLOSURE")))
+	{
+		CONSOLE.println("Usage: THERMAL [MOTOR|ENCLOSURE <start> <limit>]");
+		return;
+	}
+	if (limit <= start)
+	{
+		CONSOLE.println("The limit has to be above the start");
+		return;
+	}
+	_motors->setThermalLimits(isIt(strZone, "ENCLOSURE"), start * 10, limit * 10);
+	CONSOLE.printf("%s derating from %dC to %dC\n", isIt(strZone, "ENCLOSURE") ? "Enclosure" : "Motor", start, limit);
+}
@@ -19,6 +19,10 @@
 #include "Scheduler.h"
 #include "MotorControl.h"
 #include "ClockManager.h"
+#include "InputTriggers.h"
+#include "OneWireSensors.h"
+#include "HostProtocol.h"
+#include "ConsoleOut.h"
 
 #define CONTROL_INT_VER "0.1"
 #define SERIALCOMMANDBUFFER 254
@@ -31,62 +35,158 @@ enum ControlState {
 				PROG_ADDSEQ
 			};
 
+#define COMMAND_MAX_ARGS 4
+#define CONTROL_MAX_SESSIONS 2			// USB and the user serial port
+
+// one per port the CLI is on, each with its own mode; output goes back to the console it came from
+typedef struct _controlSession {
+	Stream* port;
+	ConsoleOut* console;
+	char buffer[SERIALCOMMANDBUFFER];	// Buffer of stored characters while waiting for terminator character
+	int bufPos;							// Current position in the buffer
+	bool overlong;						// the line didn't fit, the rest of it's thrown away
+	unsigned long linesTooLong;
+	ControlState state;
+	long currentSeqId;
+	bool promptPending;					// a listing is still coming out
+	HistoryListing history;				// HISTORY's place in its listing
+	HostProtocol host;
+} ControlSession;
+
+// what a command got given, already checked against its argument letters
+typedef struct _commandArgs {
+	int count;
+	char* word[COMMAND_MAX_ARGS];		// as typed, NULL if it wasn't given
+	long number[COMMAND_MAX_ARGS];		// the same as a number, for 'n' arguments
+} CommandArgs;
+
+class ControlInterface;
+typedef void (ControlInterface::*CommandHandler)(CommandArgs* args);
+
+typedef struct _command {
+	const char* name;
+	CommandHandler handler;
+	const char* args;					// one letter per argument: n number, w word; capitals are optional
+	const char* usage;
+} Command;
+
+typedef struct _commandStats {
+	unsigned long calls;
+	unsigned long lastMicros;
+	unsigned long maxMicros;
+	unsigned long totalMicros;
+} CommandStats;
+
+// each state's commands, sorted by name so they can be found with a binary search
+typedef struct _commandTable {
+	const Command* commands;
+	int count;
+	CommandStats* stats;
+} CommandTable;
+
 class ControlInterface{
 		public:
 			ControlInterface();
 			void start(int baudrate);
+			bool addSession(Stream* port, ConsoleOut* console);
 			void interactive();
 			void readSerial();
 			void clearBuffer();
 			void issuePrompt();
 			char* next();
 			
-			// application methods
-			void runSchedule();
-			void stopSchedule();
-			void getVersion();
-			void getStatus();
-			void getTime();
-			void intSetTime();
-			void intSetDate();
-			void addSeq();
-			void listSeq();
-			void clearSeq();
-			void listCues();
-			void addCue();
-			void addSched();
-			void clearSched();
-			void saveSched();
-			void loadSched();
-			void listSched();
-			void listRunningSeq();
-			void printDmx();
-			void printI2CDevices();
-			void setDmx();
-			void debugEnable(bool offon);
+			// commands
+			void eStop(CommandArgs* args);
+			void restart(CommandArgs* args);
+			void help(CommandArgs* args);
+			void printCommandStats(CommandArgs* args);
+			void printHostStats(CommandArgs* args);
+			void exitMenu(CommandArgs* args);
+			// main menu
+			void enterControl(CommandArgs* args);
+			void enterProgram(CommandArgs* args);
+			void execute(CommandArgs* args);
+			void tickOn(CommandArgs* args);
+			void tickOff(CommandArgs* args);
+			void schedLogOn(CommandArgs* args);
+			void schedLogOff(CommandArgs* args);
+			void ctrlLogOn(CommandArgs* args);
+			void ctrlLogOff(CommandArgs* args);
+			void logLevel(CommandArgs* args);
+			void runSchedule(CommandArgs* args);
+			void stopSchedule(CommandArgs* args);
+			void getVersion(CommandArgs* args);
+			void getStatus(CommandArgs* args);
+			void getTime(CommandArgs* args);
+			void intSetTime(CommandArgs* args);
+			void intSetDate(CommandArgs* args);
+			void listRunningSeq(CommandArgs* args);
+			// control
+			void relayToggle(CommandArgs* args);
+			void setMotor(CommandArgs* args);
+			void printMotor(CommandArgs* args);
+			void discoverMotors(CommandArgs* args);
+			void printLinkStats(CommandArgs* args);
+			void clearLinkStats(CommandArgs* args);
+			void setCrcMode(CommandArgs* args);
+			void printGroupStats(CommandArgs* args);
+			void setMotorLead(CommandArgs* args);
+			void printMotorHistory(CommandArgs* args);
+			void printDmx(CommandArgs* args);
+			void setDmx(CommandArgs* args);
+			void printDmxStats(CommandArgs* args);
+			void setDmxFrameLength(CommandArgs* args);
+			void setDmxRefreshRate(CommandArgs* args);
+			void setDmxMergeMode(CommandArgs* args);
+			void printRelays(CommandArgs* args);
+			void printI2CStats(CommandArgs* args);
+			void printI2CDevices(CommandArgs* args);
+			void printTimers(CommandArgs* args);
+			void thermal(CommandArgs* args);
+			void printSensors(CommandArgs* args);
+			void addTrigger(CommandArgs* args);
+			void printTriggers(CommandArgs* args);
+			void clearTriggers(CommandArgs* args);
+			void listScenes(CommandArgs* args);
+			void saveScene(CommandArgs* args);
+			void recallScene(CommandArgs* args);
+			void deleteScene(CommandArgs* args);
+			// program
+			void editSeq(CommandArgs* args);
+			void listSeq(CommandArgs* args);
+			void clearSeq(CommandArgs* args);
+			void addSched(CommandArgs* args);
+			void clearSched(CommandArgs* args);
+			void saveSched(CommandArgs* args);
+			void loadSched(CommandArgs* args);
+			void listSched(CommandArgs* args);
+			void listCues(CommandArgs* args);
+			void addCue(CommandArgs* args);
 			// helpers
+			void debugEnable(bool offon);
+			void controlLogging(bool offon);
 			void printLog(String logline);
 			void print2digits(int number);
 			void printSeq(long seqId);
 			void setSched(Scheduler *sched);
-			void relayToggle();
 			void setSystemController(SystemControl* controller);
 			void setClockManager(ClockManager* clockManager);
-			void controlLogging(bool offon);
-			void setMotor();
+			void setInputTriggers(InputTriggers* inputs);
+			void setOneWireSensors(OneWireSensors* sensors);
 			void setMotorControl(MotorControl* motors);
-			void printMotor();
 		private:
 			char inChar;          // A character read from the serial stream 
-			char buffer[SERIALCOMMANDBUFFER];   // Buffer of stored characters while waiting for terminator character
-			int  bufPos;                        // Current position in the buffer
 			char delim[MAXDELIMETER];           // null-terminated list of character to be used as delimeters for tokenizing (default " ")
 			char term;                          // Character that signals end of command (default '\r')
 			char *token;                        // Returned token from the command buffer as returned by strtok_r
 			char *last;                         // State variable used by strtok_r during processing
-			long currentSeqId;
 			int numCommand;
-			ControlState _state;
+			ControlSession _sessions[CONTROL_MAX_SESSIONS];
+			int _numSessions;
+			ControlSession* _session;			// the one being served
+			void use(ControlSession* session);
+			void readSession();
+			static void logLine(void* context, const char* line);
 			Scheduler* _sched;
 			void printTimestamp();
 			void printDigits(int digits);
@@ -94,6 +194,13 @@ class ControlInterface{
 			SystemControl *_systemController;
 			MotorControl *_motors;
 			ClockManager *_clockManager;
+			InputTriggers *_inputs;
+			OneWireSensors *_sensors;
+			static bool scheduleLine(void* context, unsigned int* cursor);
+			bool dispatch(const CommandTable* table, char* name);
+			bool parseArgs(const Command* command, CommandArgs* args);
+			void printCommands(const CommandTable* table);
+			void printStats(const CommandTable* table);
 };
 
 #endif
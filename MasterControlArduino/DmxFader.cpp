@@ -0,0 +1,132 @@
+/*
+
+	DmxFader.cpp
+	
+	Fades DMX channels from one level to another, a little further every DMX frame
+
+	All integer: a fade's progress is a 16.16 number from 0 to 1.0 (0x10000), worked
+	out from the time since it started, then shaped by the curve and used to
+	interpolate a 16.16 level between the start and target.
+	
+*/
+#include "DmxFader.h"
+#include "SystemConfig.h"
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#define FADE_ONE 0x10000UL
+
+DmxFader::DmxFader()
+{
+	_numFades = 0;
+	_lastMicros = 0;
+	_maxMicros = 0;
+}
+
+bool DmxFader::start(uint16_t channel, uint8_t from, uint8_t to, unsigned long duration, DmxFadeCurve curve)
+{
+	// duration is in ms; a new fade on a channel replaces whatever it was already doing
+	DmxFade *fade;
+	cancel(channel);
+	if (duration == 0 || _numFades >= DMX_MAX_FADES)
+		return false;
+	fade = &_fades[_numFades++];
+	fade->channel = channel;
+	fade->start = from;
+	fade->target = to;
+	fade->curve = (curve < DMX_CURVE_COUNT) ? curve : DMX_CURVE_LINEAR;
+	fade->started = millis();
+	fade->rate = 0xFFFFFFFFUL / duration;
+	return true;
+}
+
+void DmxFader::remove(int index)
+{
+	// keep the active fades packed by moving the last one into the gap
+	_fades[index] = _fades[--_numFades];
+}
+
+void DmxFader::cancel(uint16_t channel)
+{
+	int i;
+	for (i=0;i<_numFades;i++)
+	{
+		if (_fades[i].channel == channel)
+		{
+			remove(i);
+			return;
+		}
+	}
+}
+
+void DmxFader::cancelAll()
+{
+	_numFades = 0;
+}
+
+static uint32_t applyCurve(uint8_t curve, uint32_t p)
+{
+	// p and the result are 16.16, 0 to 1.0
+	uint32_t p2;
+	switch (curve)
+	{
+		case DMX_CURVE_SCURVE:
+			// 3p^2 - 2p^3 = p^2 (3 - 2p)
+			p2 = (uint32_t)(((uint64_t) p * p) >> 16);
+			return (uint32_t)(((uint64_t) p2 * (3 * FADE_ONE - 2 * p)) >> 16);
+		case DMX_CURVE_SQUARE:
+			return (uint32_t)(((uint64_t) p * p) >> 16);
+		default:
+			return p;
+	}
+}
+
+int DmxFader::update(unsigned long now, uint8_t* levels)
+{
+	// Call once per DMX frame.  Writes the new level of every fading channel into
+	// levels (indexed by channel) and returns how many fades are still running.
+	unsigned long started = micros();
+	unsigned long elapsed;
+	uint32_t progress;
+	int32_t level;
+	DmxFade *fade;
+	int i = 0;
+	while (i < _numFades)
+	{
+		fade = &_fades[i];
+		elapsed = now - fade->started;
+		// rate * elapsed reaches 2^32 at the end of the fade, so check before it wraps
+		if (elapsed >= 0xFFFFFFFFUL / fade->rate)
+		{
+			levels[fade->channel] = fade->target;
+			remove(i);
+			continue; // the fade moved into this slot needs doing too
+		}
+		progress = (fade->rate * elapsed) >> 16;
+		level = ((int32_t) fade->start << 16) + ((int32_t) fade->target - fade->start) * (int32_t) applyCurve(fade->curve, progress);
+		levels[fade->channel] = (level + 0x8000) >> 16;
+		i++;
+	}
+	_lastMicros = micros() - started;
+	if (_lastMicros > _maxMicros)
+		_maxMicros = _lastMicros;
+	return _numFades;
+}
+
+int DmxFader::activeFades()
+{
+	return _numFades;
+}
+
+unsigned long DmxFader::getLastMicros()
+{
+	return _lastMicros;
+}
+
+unsigned long DmxFader::getMaxMicros()
+{
+	return _maxMicros;
+}
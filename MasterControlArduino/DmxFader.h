@@ -0,0 +1,53 @@
+/*
+
+	DmxFader.h
+	
+	Fades DMX channels from one level to another, a little further every DMX frame
+	
+*/
+
+#ifndef DMXFADER_H
+#define DMXFADER_H
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#define DMX_MAX_FADES 256
+
+enum DmxFadeCurve {
+	DMX_CURVE_LINEAR,
+	DMX_CURVE_SCURVE,					// smoothstep - eases in and out
+	DMX_CURVE_SQUARE,					// square law - closer to how brightness is perceived
+	DMX_CURVE_COUNT
+};
+
+typedef struct _dmxFade {
+	uint16_t channel;
+	uint8_t start;
+	uint8_t target;
+	uint8_t curve;
+	uint32_t started;					// millis() when the fade began
+	uint32_t rate;						// fraction of the fade per ms, as a 0.32 fixed point number
+} DmxFade;
+
+class DmxFader{
+	public:
+		DmxFader();
+		bool start(uint16_t channel, uint8_t from, uint8_t to, unsigned long duration, DmxFadeCurve curve);
+		void cancel(uint16_t channel);
+		void cancelAll();
+		int update(unsigned long now, uint8_t* levels);
+		int activeFades();
+		unsigned long getLastMicros();
+		unsigned long getMaxMicros();
+	private:
+		DmxFade _fades[DMX_MAX_FADES];	// active fades are kept packed at the front
+		int _numFades;
+		unsigned long _lastMicros;
+		unsigned long _maxMicros;
+		void remove(int index);
+};
+
+#endif
@@ -0,0 +1,480 @@
+/*
+
+	DmxPort.cpp
+
+	DMX512 in and out on the hardware UART (DMX_SERIAL), so frames go out without the CPU's help
+
+	Each output frame is a state machine driven by interrupts:
+	 - BREAK: the TX pin is switched over to a GPIO and held low
+	 - MAB: ...then high, and given back to the UART
+	 - DATA: DMA feeds the start code and slots into the UART
+	 - LAST: DMA has finished, wait for the last slot to leave the shift register
+	then the buffers are swapped if there's a new frame, and the next break starts - straight away,
+	or from a timer if the refresh rate has been capped and the frame was quicker than that.
+	The break is made on the pin rather than by slowing the UART down because the receiver
+	shares the baud rate, and would lose whatever came in while it was changed.
+
+	Input comes in a byte per interrupt; a break shows up as a framing error with a zero,
+	and ends the frame.  Complete frames are double buffered like the output.
+
+	output() merges the desk with our own cue levels a word (four channels) at a time.
+
+*/
+#include "DmxPort.h"
+#include "SystemConfig.h"
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+DmxPort* DmxPort::_instance = NULL;
+
+DmxPort::DmxPort()
+{
+	memset(_universe, 0, sizeof(_universe));
+	_front = 0;
+	_back = 1;
+	_pending = false;
+	_txState = DMX_TX_IDLE;
+	_frameLength = DMX_UNIVERSE_SIZE;
+	_refreshRate = 0;
+	_minPeriod = DMX_MIN_FRAME_PERIOD;
+	_frameStarted = 0;
+	_frames = 0;
+	_isrCycles = 0;
+	_lastFrames = 0;
+	_lastIsrCycles = 0;
+	_lastUpdate = 0;
+	_frameRate = 0;
+	_cpuLoad = 0;
+	memset(_input, 0, sizeof(_input));
+	_inputFront = 0;
+	_rxIndex = DMX_RX_IGNORE;	// nothing counts until the first break
+	_inputSlots = 0;
+	_inputFrames = 0;
+	_inputLast = 0;
+	_inputErrors = 0;
+	memset(_ltp, 0, sizeof(_ltp));
+	memset(_inputOwns, 0, sizeof(_inputOwns));
+	memset(_lastInput, 0, sizeof(_lastInput));
+	memset(_lastCues, 0, sizeof(_lastCues));
+	_mergedFrame = 0;
+	_mergedActive = false;
+	_remerge = false;
+	_mergeMicros = 0;
+}
+
+void DmxPort::begin(int frameLength)
+{
+	_instance = this;
+	setFrameLength(frameLength);
+	// the pin's direction and level stay put while the UART has it, ready for the break
+	pinMode(DMX_TX_PIN, OUTPUT);
+	digitalWriteFast(DMX_TX_PIN, HIGH);
+	// let the core set up the pins, clocks and 9 bit mode (the 9th bit is the second stop bit)...
+	DMX_SERIAL.begin(DMX_BAUD, SERIAL_8N2);
+	// ...then take the UART over
+	UART2_C2 = UART_C2_TE | UART_C2_RE | UART_C2_RIE;
+	attachInterruptVector(IRQ_UART2_STATUS, uartIsr);
+	_dma.destination(UART2_D);
+	_dma.triggerAtHardwareEvent(DMAMUX_SOURCE_UART2_TX);
+	_dma.interruptAtCompletion();
+	_dma.disableOnCompletion();
+	_dma.attachInterrupt(dmaIsr);
+	// the cycle counter is used to measure how much time the interrupts take
+	ARM_DEMCR |= ARM_DEMCR_TRCENA;
+	ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+	_lastUpdate = millis();
+	(void) UART2_S1;
+	startBreak();
+}
+
+void DmxPort::setFrameLength(int frameLength)
+{
+	// picked up at the start of the next frame
+	_frameLength = constrain(frameLength, 1, DMX_UNIVERSE_SIZE);
+}
+
+int DmxPort::getFrameLength()
+{
+	return _frameLength;
+}
+
+void DmxPort::setRefreshRate(unsigned int hz)
+{
+	unsigned long period = DMX_MIN_FRAME_PERIOD;
+	if (hz > 0 && 1000000UL / hz > period)
+		period = 1000000UL / hz;
+	_refreshRate = hz;
+	_minPeriod = period;
+}
+
+unsigned int DmxPort::getRefreshRate()
+{
+	return _refreshRate;
+}
+
+void DmxPort::startBreak()
+{
+	_frameStarted = micros();
+	_txState = DMX_TX_BREAK;
+	digitalWriteFast(DMX_TX_PIN, LOW);
+	DMX_TX_PIN_CONFIG = PORT_PCR_DSE | PORT_PCR_SRE | PORT_PCR_MUX(1);
+	_timer.begin(timerIsr, DMX_BREAK_MICROS);
+}
+
+void DmxPort::startData()
+{
+	DMX_TX_PIN_CONFIG = PORT_PCR_DSE | PORT_PCR_SRE | PORT_PCR_MUX(3);
+	_txState = DMX_TX_DATA;
+	_dma.sourceBuffer(_universe[_front], _frameLength + 1);
+	_dma.enable();
+	UART2_C5 |= UART_C5_TDMAS;
+	UART2_C2 |= UART_C2_TIE;
+}
+
+void DmxPort::endFrame()
+{
+	uint8_t swap;
+	unsigned long elapsed;
+	UART2_C2 &= ~UART_C2_TCIE;
+	_frames++;
+	if (_pending)
+	{
+		// the committed frame goes out next, and the back buffer starts off as a copy of it
+		swap = _front;
+		_front = _back;
+		_back = swap;
+		memcpy(_universe[_back], _universe[_front], sizeof(_universe[0]));
+		_pending = false;
+	}
+	elapsed = micros() - _frameStarted;
+	if (elapsed < _minPeriod)
+	{
+		_txState = DMX_TX_IDLE; // hold the line at mark until it's time for the next frame
+		_timer.begin(timerIsr, _minPeriod - elapsed);
+		return;
+	}
+	startBreak();
+}
+
+void DmxPort::timerIsr()
+{
+	DmxPort *port = _instance;
+	uint32_t started = ARM_DWT_CYCCNT;
+	switch (port->_txState)
+	{
+		case DMX_TX_IDLE:
+			port->startBreak();
+			break;
+		case DMX_TX_BREAK:
+			digitalWriteFast(DMX_TX_PIN, HIGH);
+			port->_txState = DMX_TX_MAB;
+			port->_timer.begin(timerIsr, DMX_MAB_MICROS);
+			break;
+		case DMX_TX_MAB:
+			port->_timer.end();
+			port->startData();
+			break;
+		default:
+			port->_timer.end();
+	}
+	port->_isrCycles += ARM_DWT_CYCCNT - started;
+}
+
+void DmxPort::uartIsr()
+{
+	DmxPort *port = _instance;
+	uint32_t started = ARM_DWT_CYCCNT;
+	uint8_t status = UART2_S1;
+	if (status & (UART_S1_RDRF | UART_S1_FE | UART_S1_OR))
+	{
+		// reading S1 then D clears the flags
+		port->receive(status, UART2_D);
+	}
+	if ((UART2_C2 & UART_C2_TCIE) && (status & UART_S1_TC) && port->_txState == DMX_TX_LAST)
+	{
+		port->endFrame();
+	}
+	port->_isrCycles += ARM_DWT_CYCCNT - started;
+}
+
+void DmxPort::receive(uint8_t status, uint8_t data)
+{
+	uint8_t back = _inputFront ^ 1;
+	if (status & UART_S1_FE)
+	{
+		if (data != 0)
+		{
+			_inputErrors++;
+			_rxIndex = DMX_RX_IGNORE;
+			return;
+		}
+		// break - whatever came before it was a whole frame
+		if (_rxIndex > 1 && _rxIndex != DMX_RX_IGNORE)
+		{
+			_inputSlots = _rxIndex - 1;
+			_inputFront = back;
+			_inputFrames++;
+			_inputLast = millis();
+		}
+		_rxIndex = 0;
+		return;
+	}
+	if (status & UART_S1_OR)
+	{
+		// lost a byte, so the slots after it would be in the wrong place
+		_inputErrors++;
+		_rxIndex = DMX_RX_IGNORE;
+		return;
+	}
+	if (_rxIndex == 0 && data != 0)
+	{
+		// not dimmer levels (RDM, text packets and so on)
+		_rxIndex = DMX_RX_IGNORE;
+		return;
+	}
+	if (_rxIndex <= DMX_UNIVERSE_SIZE)
+		_input[back][_rxIndex++] = data;
+}
+
+void DmxPort::dmaIsr()
+{
+	// every slot has been handed to the UART, wait for the last one to finish
+	DmxPort *port = _instance;
+	uint32_t started = ARM_DWT_CYCCNT;
+	port->_dma.clearInterrupt();
+	UART2_C2 &= ~UART_C2_TIE;
+	UART2_C5 &= ~UART_C5_TDMAS;
+	port->_txState = DMX_TX_LAST;
+	UART2_C2 |= UART_C2_TCIE;
+	port->_isrCycles += ARM_DWT_CYCCNT - started;
+}
+
+void DmxPort::setChannel(int channel, uint8_t value)
+{
+	// channels are 1-512, and only ever written into the back buffer
+	if (channel < 1 || channel > DMX_UNIVERSE_SIZE)
+		return;
+	__disable_irq(); // don't let a buffer swap happen under our feet
+	_universe[_back][channel] = value;
+	__enable_irq();
+}
+
+uint8_t DmxPort::getChannel(int channel)
+{
+	if (channel < 1 || channel > DMX_UNIVERSE_SIZE)
+		return 0;
+	return _universe[_back][channel];
+}
+
+void DmxPort::commit()
+{
+	// send the back buffer as the next frame
+	_pending = true;
+}
+
+void DmxPort::update()
+{
+	// call regularly; works out the frame rate and interrupt load once a second
+	unsigned long now = millis();
+	unsigned long elapsed = now - _lastUpdate;
+	unsigned long frames, cycles;
+	if (elapsed < 1000)
+		return;
+	frames = _frames;
+	cycles = _isrCycles;
+	_frameRate = (frames - _lastFrames) * 1000 / elapsed;
+	_cpuLoad = (cycles - _lastIsrCycles) / ((F_CPU / 1000000) * elapsed);
+	_lastFrames = frames;
+	_lastIsrCycles = cycles;
+	_lastUpdate = now;
+}
+
+unsigned long DmxPort::getFrameCount()
+{
+	return _frames;
+}
+
+unsigned int DmxPort::getFrameRate()
+{
+	return _frameRate;
+}
+
+unsigned int DmxPort::getCpuLoad()
+{
+	return _cpuLoad;
+}
+
+static inline uint32_t load32(const uint8_t* p)
+{
+	uint32_t value;
+	memcpy(&value, p, 4); // channels start at 1, so the words aren't aligned
+	return value;
+}
+
+static inline void store32(uint8_t* p, uint32_t value)
+{
+	memcpy(p, &value, 4);
+}
+
+static inline uint32_t max8(uint32_t a, uint32_t b)
+{
+	// the larger of each pair of bytes: b + (a - b, stopping at zero)
+#if defined(__ARM_ARCH_7EM__)
+	uint32_t difference;
+	asm ("uqsub8 %0, %1, %2" : "=r" (difference) : "r" (a), "r" (b));
+	return b + difference;
+#else
+	uint32_t result = 0;
+	int i;
+	for (i=0;i<32;i+=8)
+		result |= max((a >> i) & 0xFF, (b >> i) & 0xFF) << i;
+	return result;
+#endif
+}
+
+// four bits of a channel bitmap to a mask of the matching bytes
+static const uint32_t NIBBLE_MASK[16] = {
+	0x00000000, 0x000000FF, 0x0000FF00, 0x0000FFFF,
+	0x00FF0000, 0x00FF00FF, 0x00FFFF00, 0x00FFFFFF,
+	0xFF000000, 0xFF0000FF, 0xFF00FF00, 0xFF00FFFF,
+	0xFFFF0000, 0xFFFF00FF, 0xFFFFFF00, 0xFFFFFFFF
+};
+
+uint32_t DmxPort::mergeWord(int word, uint32_t cue, uint32_t in)
+{
+	// channels word*4+1 to word*4+4
+	int shift = (word & 1) * 4;
+	uint8_t ltp = (_ltp[word >> 1] >> shift) & 0x0F;
+	uint32_t ltpMask, ownMask, changed;
+	uint8_t owns;
+	int i;
+	if (ltp == 0)
+		return max8(cue, in); // the usual case, all HTP
+	owns = (_inputOwns[word >> 1] >> shift) & 0x0F;
+	changed = (in ^ _lastInput[word]) | (cue ^ _lastCues[word]);
+	if (changed)
+	{
+		for (i=0;i<4;i++)
+		{
+			// if both change in the same frame the cue wins
+			if (((cue ^ _lastCues[word]) >> (i * 8)) & 0xFF)
+				owns &= ~(1 << i);
+			else if (((in ^ _lastInput[word]) >> (i * 8)) & 0xFF)
+				owns |= 1 << i;
+		}
+		_inputOwns[word >> 1] = (_inputOwns[word >> 1] & ~(0x0F << shift)) | (owns << shift);
+	}
+	ltpMask = NIBBLE_MASK[ltp];
+	ownMask = NIBBLE_MASK[ltp & owns];
+	return (max8(cue, in) & ~ltpMask) | (in & ownMask) | (cue & ltpMask & ~ownMask);
+}
+
+void DmxPort::output(const uint8_t* cues, bool changed)
+{
+	// Merge our cue levels (indexed by channel, 1-512) with the desk into the next frame.
+	// Only does anything if the cues changed, a new input frame arrived, or the input was lost.
+	// Interrupts stay on for all but a few instructions, so the input and output keep running.
+	unsigned long started = micros();
+	bool active = inputActive();
+	uint8_t input[DMX_UNIVERSE_SIZE + 1];
+	uint8_t *universe;
+	unsigned long frame;
+	int slots, word;
+	uint32_t cue, in;
+	if (!changed && !_remerge && active == _mergedActive && (!active || _inputFrames == _mergedFrame))
+		return;
+	if (!active && _mergedActive)
+	{
+		// the desk has gone, give its LTP channels back - and forget its levels, or them all
+		// going to 0 would look like the desk changing them and take them straight back again
+		memset(_inputOwns, 0, sizeof(_inputOwns));
+		memset(_lastInput, 0, sizeof(_lastInput));
+	}
+	// take a copy of the last input frame; if another one came in while copying, the
+	// interrupt may have started on the buffer we were reading, so go again
+	do {
+		__disable_irq();
+		frame = _inputFrames;
+		slots = active ? _inputSlots : 0;
+		universe = _input[_inputFront];
+		__enable_irq();
+		memcpy(&input[1], &universe[1], slots);
+	} while (frame != _inputFrames);
+	memset(&input[slots + 1], 0, DMX_UNIVERSE_SIZE - slots);
+	// nothing's committed while this runs, so the buffers can't be swapped under it;
+	// whatever was committed before is redone here anyway
+	__disable_irq();
+	_pending = false;
+	universe = _universe[_back];
+	__enable_irq();
+	_mergedFrame = frame;
+	for (word=0;word<DMX_UNIVERSE_SIZE / 4;word++)
+	{
+		cue = load32(&cues[word * 4 + 1]);
+		in = load32(&input[word * 4 + 1]);
+		store32(&universe[word * 4 + 1], mergeWord(word, cue, in));
+		_lastCues[word] = cue;
+		_lastInput[word] = in;
+	}
+	_pending = true;
+	_mergedActive = active;
+	_remerge = false;
+	_mergeMicros = micros() - started;
+}
+
+void DmxPort::setMergeMode(int first, int last, DmxMergeMode mode)
+{
+	int channel;
+	first = constrain(first, 1, DMX_UNIVERSE_SIZE);
+	last = constrain(last, first, DMX_UNIVERSE_SIZE);
+	for (channel=first;channel<=last;channel++)
+	{
+		if (mode == DMX_MERGE_LTP)
+			_ltp[(channel - 1) >> 3] |= 1 << ((channel - 1) & 7);
+		else
+			_ltp[(channel - 1) >> 3] &= ~(1 << ((channel - 1) & 7));
+	}
+	_remerge = true;
+}
+
+DmxMergeMode DmxPort::getMergeMode(int channel)
+{
+	if (channel < 1 || channel > DMX_UNIVERSE_SIZE)
+		return DMX_MERGE_HTP;
+	return (_ltp[(channel - 1) >> 3] >> ((channel - 1) & 7)) & 1 ? DMX_MERGE_LTP : DMX_MERGE_HTP;
+}
+
+uint8_t DmxPort::getInputChannel(int channel)
+{
+	if (channel < 1 || channel > _inputSlots || !inputActive())
+		return 0;
+	return _input[_inputFront][channel];
+}
+
+bool DmxPort::inputActive()
+{
+	return _inputFrames > 0 && millis() - _inputLast < DMX_INPUT_TIMEOUT;
+}
+
+unsigned long DmxPort::getInputFrameCount()
+{
+	return _inputFrames;
+}
+
+int DmxPort::getInputSlots()
+{
+	return _inputSlots;
+}
+
+unsigned long DmxPort::getInputErrors()
+{
+	return _inputErrors;
+}
+
+unsigned long DmxPort::getMergeMicros()
+{
+	return _mergeMicros;
+}
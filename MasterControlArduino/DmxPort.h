@@ -0,0 +1,115 @@
+/*
+
+	DmxPort.h
+
+	DMX512 in and out on the hardware UART (DMX_SERIAL), so frames go out without the CPU's help
+
+*/
+
+#ifndef DMXPORT_H
+#define DMXPORT_H
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+#include <DMAChannel.h>
+#include "SystemConfig.h"
+
+#define DMX_UNIVERSE_SIZE 512
+#define DMX_BAUD 250000
+#define DMX_TX_PIN 8				// TX3, taken off the UART to send the break
+#define DMX_TX_PIN_CONFIG CORE_PIN8_CONFIG
+#define DMX_BREAK_MICROS 176		// line low on the GPIO; DMX512 wants 92us at least, 176 is the usual
+#define DMX_MAB_MICROS 12			// line high on the GPIO, then the start bit follows a couple of us
+									// later (timer interrupt, DMA handing the UART the start code), so ~14us
+#define DMX_MIN_FRAME_PERIOD 1204	// us, shortest break-to-break time DMX512 allows
+#define DMX_INPUT_TIMEOUT 1000		// ms without a frame before the input is treated as gone
+#define DMX_RX_IGNORE (DMX_UNIVERSE_SIZE + 2)	// _rxIndex while waiting for the next break
+
+enum DmxTxState {
+	DMX_TX_IDLE,
+	DMX_TX_BREAK,					// line held low as a GPIO
+	DMX_TX_MAB,						// line high as a GPIO, mark after break
+	DMX_TX_DATA,					// DMA feeding the start code and slots to the UART
+	DMX_TX_LAST						// last slot in the shift register
+};
+
+enum DmxMergeMode {
+	DMX_MERGE_HTP,					// highest takes precedence, between the desk and the cues
+	DMX_MERGE_LTP					// latest takes precedence - whichever changed last
+};
+
+class DmxPort{
+	public:
+		DmxPort();
+		void begin(int frameLength);
+		void setFrameLength(int frameLength);
+		int getFrameLength();
+		void setRefreshRate(unsigned int hz);
+		unsigned int getRefreshRate();
+		void setChannel(int channel, uint8_t value);
+		uint8_t getChannel(int channel);
+		void commit();
+		void output(const uint8_t* cues, bool changed);
+		void setMergeMode(int first, int last, DmxMergeMode mode);
+		DmxMergeMode getMergeMode(int channel);
+		uint8_t getInputChannel(int channel);
+		bool inputActive();
+		unsigned long getInputFrameCount();
+		int getInputSlots();
+		unsigned long getInputErrors();
+		unsigned long getMergeMicros();
+		void update();
+		unsigned long getFrameCount();
+		unsigned int getFrameRate();
+		unsigned int getCpuLoad();
+		static void uartIsr();
+		static void dmaIsr();
+		static void timerIsr();
+	private:
+		// [0] is the start code, [1..512] the slots
+		uint8_t _universe[2][DMX_UNIVERSE_SIZE + 1];
+		volatile uint8_t _front;		// being transmitted
+		volatile uint8_t _back;		// being written by setChannel()
+		volatile bool _pending;		// back buffer has been committed, swap at the end of this frame
+		volatile DmxTxState _txState;
+		volatile int _frameLength;		// slots sent per frame, shorter frames go out more often
+		unsigned int _refreshRate;		// Hz, 0 for as fast as the frame length allows
+		volatile unsigned long _minPeriod;	// us from one break to the next
+		volatile unsigned long _frameStarted;
+		IntervalTimer _timer;			// break, MAB and the gap between frames
+		volatile unsigned long _frames;
+		volatile unsigned long _isrCycles;
+		unsigned long _lastFrames;
+		unsigned long _lastIsrCycles;
+		unsigned long _lastUpdate;
+		unsigned int _frameRate;		// frames per second, measured over the last second
+		unsigned int _cpuLoad;			// 0.1% of the CPU spent in the DMX interrupts
+		DMAChannel _dma;
+		// input, [0] is the start code like the output
+		uint8_t _input[2][DMX_UNIVERSE_SIZE + 1];
+		volatile uint8_t _inputFront;	// last complete frame
+		volatile int _rxIndex;			// next slot in the back buffer, or DMX_RX_IGNORE
+		volatile int _inputSlots;
+		volatile unsigned long _inputFrames;
+		volatile unsigned long _inputLast;
+		volatile unsigned long _inputErrors;
+		// merge state, one bit or byte per channel
+		uint8_t _ltp[DMX_UNIVERSE_SIZE / 8];
+		uint8_t _inputOwns[DMX_UNIVERSE_SIZE / 8];	// LTP channels the desk changed last
+		uint32_t _lastInput[DMX_UNIVERSE_SIZE / 4];
+		uint32_t _lastCues[DMX_UNIVERSE_SIZE / 4];
+		unsigned long _mergedFrame;
+		bool _mergedActive;
+		bool _remerge;
+		unsigned long _mergeMicros;
+		void startBreak();
+		void startData();
+		void endFrame();
+		void receive(uint8_t status, uint8_t data);
+		uint32_t mergeWord(int word, uint32_t cue, uint32_t in);
+		static DmxPort* _instance;
+};
+
+#endif
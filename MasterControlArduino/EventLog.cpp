@@ -0,0 +1,275 @@
+/*
+
+	EventLog.cpp
+
+	Leveled logging for each subsystem that costs next to nothing when it's turned off
+
+	An entry in the ring is its length, level, subsystem, millis() and a pointer to the format,
+	followed by the arguments: four bytes for each number, strings copied in with their NUL.
+	poll() takes one entry at a time, walks its format to pull the arguments back out in the
+	right sizes, and hands the finished line to the writer.  If the ring's full the new entry
+	is dropped, and a note saying how many went takes their place once there's room.
+
+*/
+#include "EventLog.h"
+#include "SystemConfig.h"
+#include "ConsoleOut.h"
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+#include <Time.h>
+
+#define LOG_HEADER (7 + sizeof(const char*))	// length, level, subsystem, millis (4), format
+
+static const char* const SUBSYSTEM_NAMES[LOG_SUBSYSTEMS] = {"SCHED", "CTRL", "TIMING"};
+static const char* const LEVEL_NAMES[] = {"DEBUG", "INFO", "NOTICE", "ERROR", "OFF"};
+
+EventLog::EventLog()
+{
+	int i;
+	for (i=0;i<LOG_SUBSYSTEMS;i++)
+		_levels[i] = LOG_LEVEL_NOTICE;
+	_head = 0;
+	_tail = 0;
+	_recorded = 0;
+	_dropped = 0;
+	_droppedTotal = 0;
+	_writer = NULL;
+	_context = NULL;
+}
+
+void EventLog::setLevel(uint8_t subsystem, uint8_t level)
+{
+	if (subsystem < LOG_SUBSYSTEMS && level <= LOG_LEVEL_OFF)
+		_levels[subsystem] = level;
+}
+
+uint8_t EventLog::getLevel(uint8_t subsystem)
+{
+	return _levels[subsystem];
+}
+
+int EventLog::findSubsystem(const char* name)
+{
+	int i;
+	for (i=0;i<LOG_SUBSYSTEMS;i++)
+	{
+		if (strcasecmp(name, SUBSYSTEM_NAMES[i]) == 0)
+			return i;
+	}
+	return -1;
+}
+
+int EventLog::findLevel(const char* name)
+{
+	int i;
+	for (i=0;i<=LOG_LEVEL_OFF;i++)
+	{
+		if (strcasecmp(name, LEVEL_NAMES[i]) == 0)
+			return i;
+	}
+	return -1;
+}
+
+void EventLog::setWriter(LogWriter writer, void* context)
+{
+	_writer = writer;
+	_context = context;
+}
+
+int EventLog::start(uint8_t* entry, uint8_t level, uint8_t subsystem, const char* format)
+{
+	uint32_t stamp = millis();
+	entry[1] = level;
+	entry[2] = subsystem;
+	memcpy(&entry[3], &stamp, 4);
+	memcpy(&entry[7], &format, sizeof(format));
+	return LOG_HEADER;
+}
+
+int EventLog::pack(uint8_t* entry, int length, int value)
+{
+	return pack(entry, length, (long) value);
+}
+
+int EventLog::pack(uint8_t* entry, int length, unsigned int value)
+{
+	return pack(entry, length, (unsigned long) value);
+}
+
+int EventLog::pack(uint8_t* entry, int length, long value)
+{
+	return pack(entry, length, (unsigned long) value);
+}
+
+int EventLog::pack(uint8_t* entry, int length, unsigned long value)
+{
+	uint32_t word = value;
+	if (length + 4 > LOG_MAX_ENTRY)
+		return length;				// no room, it'll print as 0
+	memcpy(&entry[length], &word, 4);
+	return length + 4;
+}
+
+int EventLog::pack(uint8_t* entry, int length, double value)
+{
+	float number = value;
+	uint32_t word;
+	memcpy(&word, &number, 4);
+	return pack(entry, length, (unsigned long) word);
+}
+
+int EventLog::pack(uint8_t* entry, int length, const char* value)
+{
+	int i;
+	if (length >= LOG_MAX_ENTRY)
+		return length;
+	for (i=0;value != NULL && value[i] != '\0' && i < LOG_MAX_STRING && length < LOG_MAX_ENTRY - 1;i++)
+		entry[length++] = value[i];
+	entry[length++] = '\0';
+	return length;
+}
+
+int EventLog::pack(uint8_t* entry, int length, const String& value)
+{
+	return pack(entry, length, value.c_str());
+}
+
+void EventLog::commit(const uint8_t* entry, int length)
+{
+	uint8_t note[LOG_HEADER + 4];
+	unsigned int i;
+	_recorded++;
+	if ((unsigned int) length + (_dropped > 0 ? sizeof(note) : 0) > LOG_BUFFER - 1 - queued())
+	{
+		_dropped++;
+		_droppedTotal++;
+		return;
+	}
+	if (_dropped > 0)
+	{
+		// goes in where the gap is
+		start(note, LOG_LEVEL_NOTICE, entry[2], "[%lu log entries dropped]");
+		pack(note, LOG_HEADER, _dropped);
+		_dropped = 0;
+		commit(note, sizeof(note));
+		_recorded--;
+	}
+	_buffer[_head] = length;
+	_head = (_head + 1) % LOG_BUFFER;
+	for (i=1;i<(unsigned int) length;i++)
+	{
+		_buffer[_head] = entry[i];
+		_head = (_head + 1) % LOG_BUFFER;
+	}
+}
+
+unsigned int EventLog::queued()
+{
+	return (_head + LOG_BUFFER - _tail) % LOG_BUFFER;
+}
+
+void EventLog::get(uint8_t* entry, int length)
+{
+	int i;
+	for (i=0;i<length;i++)
+	{
+		entry[i] = _buffer[_tail];
+		_tail = (_tail + 1) % LOG_BUFFER;
+	}
+}
+
+int EventLog::format(const uint8_t* entry, int length, char* line, int size)
+{
+	// the format again, with the arguments taken out of the entry as each conversion needs them
+	const char* format;
+	const char* string;
+	char spec[12];
+	char conversion;
+	int at = LOG_HEADER, out = 0, n, written;
+	uint32_t word;
+	float number;
+	memcpy(&format, &entry[7], sizeof(format));
+	while (*format != '\0' && out < size - 1)
+	{
+		if (*format != '%' || format[1] == '%')
+		{
+			line[out++] = *format;
+			format += (*format == '%') ? 2 : 1;
+			continue;
+		}
+		n = 0;
+		while (*format != '\0' && strchr("diouxXcsfeEgG", *format) == NULL && n < (int) sizeof(spec) - 2)
+			spec[n++] = *format++;
+		if (*format == '\0')
+			break;
+		conversion = *format++;
+		spec[n++] = conversion;
+		spec[n] = '\0';
+		if (conversion == 's')
+		{
+			string = (at < length) ? (const char*) &entry[at] : "";
+			at += strlen(string) + 1;
+			written = snprintf(&line[out], size - out, spec, string);
+		} else {
+			word = 0;
+			if (at + 4 <= length)
+				memcpy(&word, &entry[at], 4);
+			at += 4;
+			if (strchr("feEgG", conversion) != NULL)
+			{
+				memcpy(&number, &word, 4);
+				written = snprintf(&line[out], size - out, spec, (double) number);
+			} else if (strchr(spec, 'l') != NULL)
+				written = snprintf(&line[out], size - out, spec, (conversion == 'd' || conversion == 'i') ? (long) (int32_t) word : (unsigned long) word);
+			else
+				written = snprintf(&line[out], size - out, spec, (int) word);
+		}
+		if (written > 0)
+			out += (written < size - out) ? written : size - out - 1;
+	}
+	line[out] = '\0';
+	return out;
+}
+
+void EventLog::poll()
+{
+	// call every time round the loop; prints one entry at most
+	uint8_t entry[LOG_MAX_ENTRY];
+	char line[LOG_LINE_MAX];
+	uint32_t stamp;
+	time_t t;
+	int n;
+	if (_writer == NULL)
+		return;
+	if (queued() == 0)
+	{
+		// nothing's come in since, so the gap's at the end
+		if (_dropped > 0)
+		{
+			snprintf(line, sizeof(line), "[%lu log entries dropped]\r\n", _dropped);
+			_dropped = 0;
+			_writer(_context, line);
+		}
+		return;
+	}
+	entry[0] = _buffer[_tail];
+	get(entry, entry[0]);
+	memcpy(&stamp, &entry[3], 4);
+	t = now() - (millis() - stamp) / 1000;
+	n = snprintf(line, sizeof(line), "%s> %02d:%02d:%02d %c ", SUBSYSTEM_NAMES[entry[2]], hour(t), minute(t), second(t), LEVEL_NAMES[entry[1]][0]);
+	n += format(entry, entry[0], &line[n], sizeof(line) - n - 2);
+	strcpy(&line[n], "\r\n");
+	_writer(_context, line);
+}
+
+void EventLog::printStats()
+{
+	int i;
+	for (i=0;i<LOG_SUBSYSTEMS;i++)
+		CONSOLE.printf(F("%-8s %s\r\n"), SUBSYSTEM_NAMES[i], LEVEL_NAMES[_levels[i]]);
+	CONSOLE.printf(F("Log: %lu entries, %lu dropped, %u bytes waiting, compiled down to %s\r\n"),
+		_recorded, _droppedTotal, queued(), LEVEL_NAMES[LOG_MIN_LEVEL]);
+}
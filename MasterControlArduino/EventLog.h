@@ -0,0 +1,105 @@
+/*
+
+	EventLog.h
+
+	Leveled logging for each subsystem that costs next to nothing when it's turned off
+
+*/
+
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+#include "SystemConfig.h"
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_NOTICE 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_OFF 4
+
+// anything below this isn't even compiled in; set it in SystemConfig.h for a release build
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// subsystems, each with its own level that can be changed at run time
+#define LOG_SCHED 0						// the scheduler working out what to run
+#define LOG_CTRL 1						// cues as they're carried out
+#define LOG_TIMING 2					// how long each part of the loop takes
+#define LOG_SUBSYSTEMS 3
+
+#define LOG_BUFFER 1024					// bytes of log entries waiting to be printed
+#define LOG_MAX_ENTRY 64				// biggest single entry, header and all
+#define LOG_MAX_STRING 24				// longest string argument kept, the rest is cut off
+#define LOG_LINE_MAX 128
+
+/*
+	LOG_DEBUG(LOG_SCHED, "Found a free slot, %d", slot) checks the subsystem's level before
+	anything else, so none of the arguments are worked out unless it's going to be kept.  Then
+	it only copies the arguments into the ring; poll() does the formatting later, from the loop.
+	The format has to be a string literal.  Numbers go in as 32 bits (%f gets a float), and
+	strings (%s) are copied, so they don't have to be around by the time it's printed.
+*/
+#define LOG_AT(level, subsystem, format, ...) \
+	do { \
+		if ((level) >= LOG_MIN_LEVEL && eventLog.enabled((level), (subsystem))) \
+			eventLog.record((level), (subsystem), "" format, ##__VA_ARGS__); \
+	} while (0)
+#define LOG_DEBUG(subsystem, format, ...) LOG_AT(LOG_LEVEL_DEBUG, subsystem, format, ##__VA_ARGS__)
+#define LOG_INFO(subsystem, format, ...) LOG_AT(LOG_LEVEL_INFO, subsystem, format, ##__VA_ARGS__)
+#define LOG_NOTICE(subsystem, format, ...) LOG_AT(LOG_LEVEL_NOTICE, subsystem, format, ##__VA_ARGS__)
+#define LOG_ERROR(subsystem, format, ...) LOG_AT(LOG_LEVEL_ERROR, subsystem, format, ##__VA_ARGS__)
+
+// gets each line as it's formatted
+typedef void (*LogWriter)(void* context, const char* line);
+
+class EventLog{
+	public:
+		EventLog();
+		inline bool enabled(uint8_t level, uint8_t subsystem) { return level >= _levels[subsystem]; }
+		template<typename... Args> void record(uint8_t level, uint8_t subsystem, const char* format, Args... args)
+		{
+			uint8_t entry[LOG_MAX_ENTRY];
+			int length = start(entry, level, subsystem, format);
+			int packed[] = {0, (length = pack(entry, length, args))...};
+			(void) packed;
+			commit(entry, length);
+		}
+		void setLevel(uint8_t subsystem, uint8_t level);
+		uint8_t getLevel(uint8_t subsystem);
+		static int findSubsystem(const char* name);
+		static int findLevel(const char* name);
+		void setWriter(LogWriter writer, void* context);
+		void poll();
+		void printStats();
+	private:
+		uint8_t _levels[LOG_SUBSYSTEMS];
+		uint8_t _buffer[LOG_BUFFER];
+		unsigned int _head;
+		unsigned int _tail;
+		unsigned long _recorded;
+		unsigned long _dropped;			// not reported yet
+		unsigned long _droppedTotal;
+		LogWriter _writer;
+		void* _context;
+		int start(uint8_t* entry, uint8_t level, uint8_t subsystem, const char* format);
+		int pack(uint8_t* entry, int length, int value);
+		int pack(uint8_t* entry, int length, unsigned int value);
+		int pack(uint8_t* entry, int length, long value);
+		int pack(uint8_t* entry, int length, unsigned long value);
+		int pack(uint8_t* entry, int length, double value);
+		int pack(uint8_t* entry, int length, const char* value);
+		int pack(uint8_t* entry, int length, const String& value);
+		void commit(const uint8_t* entry, int length);
+		unsigned int queued();
+		void get(uint8_t* entry, int length);
+		int format(const uint8_t* entry, int length, char* line, int size);
+};
+
+extern EventLog eventLog;
+
+#endif
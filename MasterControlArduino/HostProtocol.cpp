@@ -0,0 +1,472 @@
+/*
+
+	HostProtocol.cpp
+	
+	Binary framed protocol for show control software, on the same port as the CLI
+
+	ControlInterface hands bytes over from the moment it sees HOST_SYNC at the start of a line,
+	so typing at the CLI still works.  Frames are handled as soon as they're complete, straight
+	from the main loop, and the reply goes back in one write.
+	
+*/
+#include "HostProtocol.h"
+#include "ConsoleOut.h"
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+HostProtocol::HostProtocol()
+{
+	_port = NULL;
+	_sched = NULL;
+	_systemController = NULL;
+	_motors = NULL;
+	_rxIndex = 0;
+	_lastByte = 0;
+	_txLength = 0;
+	_telemetryInterval = 0;
+	_lastTelemetry = 0;
+	_statusInterval = 0;
+	_statusFields = 0;
+	_lastStatus = 0;
+	_lastKeyframe = 0;
+	_statusSequence = 0;
+	_statusFrames = 0;
+	_statusFull = true;
+	_sentState = 0;
+	_sentSequenceCount = 0;
+	_sentDmxFrames = 0;
+	_sentLoop[0] = _sentLoop[1] = 0;
+	_sentMotorCount = 0;
+	_frames = 0;
+	_crcErrors = 0;
+	_timeouts = 0;
+}
+
+void HostProtocol::setPort(Print* port)
+{
+	_port = port;
+}
+
+void HostProtocol::setSched(Scheduler* sched)
+{
+	_sched = sched;
+}
+
+void HostProtocol::setSystemController(SystemControl* controller)
+{
+	_systemController = controller;
+}
+
+void HostProtocol::setMotorControl(MotorControl* motors)
+{
+	_motors = motors;
+}
+
+uint16_t HostProtocol::crc16(const uint8_t* data, int length)
+{
+	uint16_t crc = 0xFFFF;
+	int i, bit;
+	for (i=0;i<length;i++)
+	{
+		crc ^= (uint16_t) data[i] << 8;
+		for (bit=0;bit<8;bit++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+bool HostProtocol::receiving()
+{
+	// true while we're part way through a frame, so the bytes are ours
+	if (_rxIndex > 0 && millis() - _lastByte > HOST_FRAME_TIMEOUT)
+	{
+		_rxIndex = 0;
+		_timeouts++;
+	}
+	return _rxIndex > 0;
+}
+
+void HostProtocol::receive(uint8_t c)
+{
+	_lastByte = millis();
+	if (_rxIndex == 0 && c != HOST_SYNC)
+		return;
+	_rx[_rxIndex++] = c;
+	if (_rxIndex == 2 && _rx[1] > HOST_MAX_PAYLOAD)
+	{
+		// can't be a frame of ours, wait for the next sync
+		_rxIndex = 0;
+		return;
+	}
+	if (_rxIndex < HOST_HEADER || _rxIndex < HOST_HEADER + _rx[1] + 2)
+		return;
+	handleFrame();
+	_rxIndex = 0;
+}
+
+void HostProtocol::begin(uint8_t status)
+{
+	_txLength = 0;
+	add(status);
+}
+
+void HostProtocol::add(uint8_t value)
+{
+	if (_txLength < HOST_MAX_PAYLOAD)
+		_tx[HOST_HEADER + _txLength++] = value;
+}
+
+void HostProtocol::add16(uint16_t value)
+{
+	add(value & 0xFF);
+	add(value >> 8);
+}
+
+void HostProtocol::add32(unsigned long value)
+{
+	add16(value & 0xFFFF);
+	add16(value >> 16);
+}
+
+bool HostProtocol::send(uint8_t requestId, uint8_t type)
+{
+	// true if the whole frame was taken
+	uint16_t crc;
+	_tx[0] = HOST_SYNC;
+	_tx[1] = _txLength;
+	_tx[2] = requestId;
+	_tx[3] = type;
+	crc = crc16(&_tx[1], HOST_HEADER - 1 + _txLength);
+	_tx[HOST_HEADER + _txLength] = crc & 0xFF;
+	_tx[HOST_HEADER + _txLength + 1] = crc >> 8;
+	// in one write, so the console queues the whole frame behind any text or drops all of it
+	if (_port == NULL)
+		return false;
+	return _port->write(_tx, HOST_HEADER + _txLength + 2) == (size_t) (HOST_HEADER + _txLength + 2);
+}
+
+void HostProtocol::handleFrame()
+{
+	uint8_t length = _rx[1];
+	uint8_t requestId = _rx[2];
+	uint8_t type = _rx[3];
+	uint8_t *payload = &_rx[HOST_HEADER];
+	uint16_t crc = payload[length] | (payload[length + 1] << 8);
+	unsigned int channel, i, count, bit;
+	uint8_t bits;
+	unsigned long sequenceId;
+	MotorController *motor;
+	_frames++;
+	if (crc16(&_rx[1], HOST_HEADER - 1 + length) != crc)
+	{
+		_crcErrors++;
+		begin(HOST_BAD_CRC);
+		send(requestId, type | HOST_REPLY);
+		return;
+	}
+	begin(HOST_OK);
+	switch (type)
+	{
+		case HOST_PING:
+			for (i=0;HOLST_VERSION[i] != '\0';i++)
+				add(HOLST_VERSION[i]);
+			break;
+		case HOST_DMX_SET:
+			channel = payload[0] | (payload[1] << 8);
+			if (length < 3)
+				begin(HOST_BAD_LENGTH);
+			else if (channel < 1 || channel + length - 3 > DMX_MAX_CHANNELS)
+				begin(HOST_BAD_ARGUMENT);
+			else if (_systemController->isStopped())
+				begin(HOST_REFUSED);
+			else
+			{
+				for (i=2;i<length;i++)
+					_systemController->setDMX(channel++, payload[i]);
+			}
+			break;
+		case HOST_DMX_GET:
+			channel = payload[0] | (payload[1] << 8);
+			count = payload[2];
+			if (length != 3)
+				begin(HOST_BAD_LENGTH);
+			else if (channel < 1 || channel + count - 1 > DMX_MAX_CHANNELS || count > HOST_MAX_PAYLOAD - 1)
+				begin(HOST_BAD_ARGUMENT);
+			else
+			{
+				for (i=0;i<count;i++)
+					add(_systemController->getDMX(channel + i));
+			}
+			break;
+		case HOST_RELAY_SET:
+			if (length != 2)
+				begin(HOST_BAD_LENGTH);
+			else if (payload[0] < 1 || payload[0] > _systemController->numRelays())
+				begin(HOST_BAD_ARGUMENT);
+			else if (_systemController->isStopped())
+				begin(HOST_REFUSED);
+			else
+				_systemController->setRelay(payload[0], payload[1] ? 100 : 0, 0);
+			break;
+		case HOST_RELAY_GET:
+			count = _systemController->numRelays();
+			add(count);
+			for (i=0;i<count;i+=8)
+			{
+				bits = 0;
+				for (bit=0;bit<8 && i+bit<count;bit++)
+				{
+					if (_systemController->isRelayOn(i + bit + 1))
+						bits |= 1 << bit;
+				}
+				add(bits);
+			}
+			break;
+		case HOST_MOTOR_SET:
+			if (length != 3)
+				begin(HOST_BAD_LENGTH);
+			else if (_motors->getMotor(payload[0]) == NULL || payload[1] > 100)
+				begin(HOST_BAD_ARGUMENT);
+			else if (_systemController->isStopped())
+				begin(HOST_REFUSED);
+			else
+				_systemController->sendMotorCommand(payload[0], payload[1], 0, payload[2] != 0);
+			break;
+		case HOST_MOTOR_GET:
+			motor = (length == 1) ? _motors->getMotor(payload[0]) : NULL;
+			if (length != 1)
+				begin(HOST_BAD_LENGTH);
+			else if (motor == NULL)
+				begin(HOST_BAD_ARGUMENT);
+			else
+			{
+				add(motor->online);
+				add(motor->targetDirection);
+				add(motor->targetPercent);
+				add(motor->requestedPercent);
+				add16(motor->speed);
+				add16(motor->temperature);
+				add16(motor->errorStatus);
+				add16(motor->inputVoltage);
+			}
+			break;
+		case HOST_SEQ_START:
+		case HOST_SEQ_STOP:
+			sequenceId = payload[0] | (payload[1] << 8) | ((unsigned long) payload[2] << 16) | ((unsigned long) payload[3] << 24);
+			if (length != 4)
+				begin(HOST_BAD_LENGTH);
+			else if (_sched->sequenceGet(sequenceId) == NULL)
+				begin(HOST_BAD_ARGUMENT);
+			else if (type == HOST_SEQ_START && !_sched->startSequenceNow(sequenceId))
+				begin(HOST_REFUSED); // already running, stopped, or no free slot
+			else if (type == HOST_SEQ_STOP && !_sched->stopSequence(sequenceId))
+				begin(HOST_REFUSED);
+			break;
+		case HOST_TELEMETRY_SUBSCRIBE:
+			if (length != 2)
+			{
+				begin(HOST_BAD_LENGTH);
+				break;
+			}
+			_telemetryInterval = payload[0] | (payload[1] << 8);
+			if (_telemetryInterval != 0 && _telemetryInterval < HOST_MIN_TELEMETRY)
+				_telemetryInterval = HOST_MIN_TELEMETRY;
+			_lastTelemetry = millis() - _telemetryInterval; // first one straight away
+			add16(_telemetryInterval);
+			break;
+		case HOST_STATUS_SUBSCRIBE:
+			if (length != 3)
+			{
+				begin(HOST_BAD_LENGTH);
+				break;
+			}
+			_statusInterval = payload[0] | (payload[1] << 8);
+			_statusFields = payload[2] & HOST_FIELD_ALL;
+			if (_statusInterval != 0 && _statusInterval < HOST_MIN_TELEMETRY)
+				_statusInterval = HOST_MIN_TELEMETRY;
+			_statusFull = true;			// subscribing again is how to catch up after a lost frame
+			_lastStatus = millis() - _statusInterval;
+			add16(_statusInterval);
+			break;
+		default:
+			begin(HOST_UNKNOWN_TYPE);
+	}
+	send(requestId, type | HOST_REPLY);
+}
+
+void HostProtocol::sendTelemetry()
+{
+	// flags (bit 0 ESTOP, bit 1 schedule running), running sequences, DMX frame rate (2),
+	// board temperature (2), CPU temperature (2) in 0.1 deg C, number of motors, then for each
+	// motor: id, target %, temperature (2), error status (2)
+	MotorCommand targets[MOTORS_MAX_DEVICES];
+	MotorController *motor;
+	int i, count;
+	_txLength = 0;
+	add((_systemController->isStopped() ? 1 : 0) | (_sched->isRunning() ? 2 : 0));
+	add(_sched->_numRunningSequences);
+	add16(_systemController->getDmxFrameRate());
+	add16((int16_t) (_systemController->getTemperatureC() * 10));
+	add16((int16_t) (_systemController->getInternalTemperatureMilliC() / 100));
+	count = _motors->getTargets(targets, MOTORS_MAX_DEVICES);
+	add(count);
+	for (i=0;i<count;i++)
+	{
+		motor = _motors->getMotor(targets[i].deviceId);
+		add(motor->deviceId);
+		add(motor->targetPercent);
+		add16(motor->temperature);
+		add16(motor->errorStatus);
+	}
+	send(0, HOST_TELEMETRY);
+}
+
+bool HostProtocol::motorChanged(int index)
+{
+	MotorController *motor = _motors->getMotorAt(index);
+	HostMotorStatus *sent = &_sentMotors[index];
+	return sent->speed != (uint16_t) motor->speed || sent->temperature != (uint16_t) motor->temperature
+		|| sent->errorStatus != (uint16_t) motor->errorStatus;
+}
+
+void HostProtocol::sendStatus()
+{
+	// status sequence number, then the fields that follow (| HOST_STATUS_FULL if that's all the
+	// subscribed ones), then each of those as HOST_FIELD_* says.  A field that hasn't changed since
+	// the last frame is left out, and a frame with nothing in it isn't sent at all.
+	unsigned long sequences[SCHEDULER_MAX_RUNNING_SEQUENCES];
+	unsigned long dmxFrames;
+	uint16_t loop[2];
+	uint8_t state, fields = 0;
+	int i, count = 0, motors, changed = 0;
+	bool full = _statusFull || millis() - _lastKeyframe >= HOST_STATUS_KEYFRAME;
+	MotorController *motor;
+
+	state = (_systemController->isStopped() ? 1 : 0) | (_sched->isRunning() ? 2 : 0);
+	for (i=0;i<SCHEDULER_MAX_RUNNING_SEQUENCES;i++)
+	{
+		if (_sched->_currentlyRunningSlots[i] != NULL)
+			sequences[count++] = _sched->_currentlyRunningSlots[i]->running->sequenceId;
+	}
+	dmxFrames = _systemController->getDmxFrameCount();
+	loop[0] = min(_systemController->getLoopMicros(), 0xFFFFUL);
+	loop[1] = min(_systemController->getLoopWorstMicros(), 0xFFFFUL);
+	motors = _motors->numMotors();
+	if ((_statusFields & HOST_FIELD_MOTORS) && motors != _sentMotorCount)
+		full = true;			// found another one, so which is which has moved
+	for (i=0;i<motors;i++)
+	{
+		if (full || motorChanged(i))
+			changed++;
+	}
+
+	if (full || state != _sentState)
+		fields |= HOST_FIELD_STATE;
+	if (full || count != _sentSequenceCount || memcmp(sequences, _sentSequences, count * sizeof(unsigned long)) != 0)
+		fields |= HOST_FIELD_SEQUENCES;
+	if (full || dmxFrames != _sentDmxFrames)
+		fields |= HOST_FIELD_DMX;
+	if (changed > 0 || full)
+		fields |= HOST_FIELD_MOTORS;
+	if (full || loop[0] != _sentLoop[0] || loop[1] != _sentLoop[1])
+		fields |= HOST_FIELD_LOOP;
+	fields &= _statusFields;
+	if (fields == 0)
+		return;
+
+	_txLength = 0;
+	add(_statusSequence);
+	add(fields | (full ? HOST_STATUS_FULL : 0));
+	if (fields & HOST_FIELD_STATE)
+		add(state);
+	if (fields & HOST_FIELD_SEQUENCES)
+	{
+		add(count);
+		for (i=0;i<count;i++)
+			add32(sequences[i]);
+	}
+	if (fields & HOST_FIELD_DMX)
+		add32(dmxFrames);
+	if (fields & HOST_FIELD_MOTORS)
+	{
+		add(changed);
+		for (i=0;i<motors;i++)
+		{
+			if (!full && !motorChanged(i))
+				continue;
+			motor = _motors->getMotorAt(i);
+			add(motor->deviceId);
+			add16(motor->speed);
+			add16(motor->temperature);
+			add16(motor->errorStatus);
+		}
+	}
+	if (fields & HOST_FIELD_LOOP)
+	{
+		add16(loop[0]);
+		add16(loop[1]);
+	}
+	// the console was full and dropped it, so the next one's against the same snapshot
+	if (!send(0, HOST_STATUS))
+		return;
+
+	_statusSequence++;
+	_statusFrames++;
+	if (fields & HOST_FIELD_STATE)
+		_sentState = state;
+	if (fields & HOST_FIELD_SEQUENCES)
+	{
+		for (i=0;i<count;i++)
+			_sentSequences[i] = sequences[i];
+		_sentSequenceCount = count;
+	}
+	if (fields & HOST_FIELD_DMX)
+		_sentDmxFrames = dmxFrames;
+	if (fields & HOST_FIELD_MOTORS)
+	{
+		for (i=0;i<motors;i++)
+		{
+			motor = _motors->getMotorAt(i);
+			_sentMotors[i].speed = motor->speed;
+			_sentMotors[i].temperature = motor->temperature;
+			_sentMotors[i].errorStatus = motor->errorStatus;
+		}
+		_sentMotorCount = motors;
+	}
+	if (fields & HOST_FIELD_LOOP)
+	{
+		_sentLoop[0] = loop[0];
+		_sentLoop[1] = loop[1];
+	}
+	if (full)
+	{
+		_statusFull = false;
+		_lastKeyframe = millis();
+	}
+}
+
+void HostProtocol::poll()
+{
+	// call every time round the loop
+	if (_rxIndex > 0)
+		return;
+	if (_telemetryInterval != 0 && millis() - _lastTelemetry >= _telemetryInterval)
+	{
+		_lastTelemetry = millis();
+		sendTelemetry();
+	}
+	if (_statusInterval != 0 && millis() - _lastStatus >= _statusInterval)
+	{
+		_lastStatus = millis();
+		sendStatus();
+	}
+}
+
+void HostProtocol::printStats()
+{
+	CONSOLE.printf(F("Host frames: %lu, CRC errors %lu, timeouts %lu, telemetry every %u ms\r\n"), _frames, _crcErrors, _timeouts, _telemetryInterval);
+	CONSOLE.printf(F("Status every %u ms, fields 0x%02x, %lu frames sent\r\n"), _statusInterval, _statusFields, _statusFrames);
+}
@@ -0,0 +1,127 @@
+/*
+
+	HostProtocol.h
+	
+	Binary framed protocol for show control software, on the same port as the CLI
+	
+*/
+
+#ifndef HOSTPROTOCOL_H
+#define HOSTPROTOCOL_H
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+#include "SystemConfig.h"
+#include "Scheduler.h"
+#include "SystemControl.h"
+#include "MotorControl.h"
+
+/*
+	A frame is:  A5 <length> <request id> <type> <length bytes of payload> <CRC16 lo> <CRC16 hi>
+	The CRC is CRC-16/CCITT (0x1021, starting at FFFF) over everything after the A5.  Multi byte
+	values are little endian.  Replies have the request's id and type | 0x80, and start their
+	payload with a HostStatus.
+*/
+#define HOST_SYNC 0xA5
+#define HOST_HEADER 4					// sync, length, request id, type
+#define HOST_MAX_PAYLOAD 128
+#define HOST_FRAME_TIMEOUT 100			// ms between bytes before a half-received frame is dropped
+#define HOST_MIN_TELEMETRY 50			// ms, fastest telemetry can be asked for
+
+#define HOST_PING 0x01					// -> status, firmware version
+#define HOST_DMX_SET 0x10				// channel (2), levels (1 each, up to the end of the frame)
+#define HOST_DMX_GET 0x11				// channel (2), count (1) -> status, levels
+#define HOST_RELAY_SET 0x20				// relay (1), on (1)
+#define HOST_RELAY_GET 0x21				// -> status, number of relays, 1 bit each (relay 1 is bit 0 of the first byte)
+#define HOST_MOTOR_SET 0x30				// motor (1), percent (1), forward (1)
+#define HOST_MOTOR_GET 0x31				// motor (1) -> status, online, forward, target %, requested %, speed (2), temperature (2), error status (2), Vin (2)
+#define HOST_SEQ_START 0x40				// sequence (4)
+#define HOST_SEQ_STOP 0x41				// sequence (4)
+#define HOST_TELEMETRY_SUBSCRIBE 0x50	// interval in ms (2), 0 to stop
+#define HOST_STATUS_SUBSCRIBE 0x51		// interval in ms (2), fields (1), 0 interval to stop -> status, interval (2)
+#define HOST_TELEMETRY 0x60				// sent unasked with request id 0, see sendTelemetry()
+#define HOST_STATUS 0x61				// sent unasked with request id 0, only what's changed, see sendStatus()
+#define HOST_REPLY 0x80
+
+// fields a status subscription can ask for, in the order they come in a HOST_STATUS frame
+#define HOST_FIELD_STATE 0x01			// flags (bit 0 ESTOP, bit 1 schedule running)
+#define HOST_FIELD_SEQUENCES 0x02		// count, then each running sequence id (4)
+#define HOST_FIELD_DMX 0x04				// DMX frames sent (4)
+#define HOST_FIELD_MOTORS 0x08			// count, then each motor that's changed: id, speed (2), temperature (2), error status (2)
+#define HOST_FIELD_LOOP 0x10			// time round the main loop in us: average (2), worst (2)
+#define HOST_FIELD_ALL 0x1F
+#define HOST_STATUS_FULL 0x80			// set in a frame's fields when it has everything, changed or not
+#define HOST_STATUS_KEYFRAME 5000		// ms between full status frames, so a lost one doesn't matter for long
+
+// what a status frame last said about a motor
+typedef struct _hostMotorStatus {
+	uint16_t speed;
+	uint16_t temperature;
+	uint16_t errorStatus;
+} HostMotorStatus;
+
+enum HostStatus {
+	HOST_OK,
+	HOST_BAD_CRC,
+	HOST_UNKNOWN_TYPE,
+	HOST_BAD_LENGTH,
+	HOST_BAD_ARGUMENT,
+	HOST_REFUSED						// ESTOP engaged, or nothing free to do it with
+};
+
+class HostProtocol{
+	public:
+		HostProtocol();
+		void setPort(Print* port);
+		void setSched(Scheduler* sched);
+		void setSystemController(SystemControl* controller);
+		void setMotorControl(MotorControl* motors);
+		bool receiving();
+		void receive(uint8_t c);
+		void poll();
+		void printStats();
+	private:
+		Print* _port;
+		Scheduler* _sched;
+		SystemControl* _systemController;
+		MotorControl* _motors;
+		uint8_t _rx[HOST_HEADER + HOST_MAX_PAYLOAD + 2];
+		int _rxIndex;
+		unsigned long _lastByte;
+		uint8_t _tx[HOST_HEADER + HOST_MAX_PAYLOAD + 2];
+		int _txLength;					// payload so far
+		unsigned int _telemetryInterval;
+		unsigned long _lastTelemetry;
+		unsigned int _statusInterval;
+		uint8_t _statusFields;
+		unsigned long _lastStatus;
+		unsigned long _lastKeyframe;
+		uint8_t _statusSequence;		// counts status frames, so the host can tell if it's missed one
+		unsigned long _statusFrames;
+		bool _statusFull;				// next one has everything
+		// what was last sent, to compare against
+		uint8_t _sentState;
+		uint8_t _sentSequenceCount;
+		unsigned long _sentSequences[SCHEDULER_MAX_RUNNING_SEQUENCES];
+		unsigned long _sentDmxFrames;
+		uint16_t _sentLoop[2];
+		uint8_t _sentMotorCount;
+		HostMotorStatus _sentMotors[MOTORS_MAX_DEVICES];
+		unsigned long _frames;
+		unsigned long _crcErrors;
+		unsigned long _timeouts;
+		void handleFrame();
+		void begin(uint8_t status);
+		void add(uint8_t value);
+		void add16(uint16_t value);
+		bool send(uint8_t requestId, uint8_t type);
+		void sendTelemetry();
+		void sendStatus();
+		bool motorChanged(int index);
+		void add32(unsigned long value);
+		static uint16_t crc16(const uint8_t* data, int length);
+};
+
+#endif
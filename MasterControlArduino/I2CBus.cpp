@@ -0,0 +1,324 @@
+/*
+
+	I2CBus.cpp
+	
+	Queued, interrupt driven I2C so a slow or missing device never holds up the main loop
+
+	Requests are a write of up to I2C_MAX_DATA bytes, a read of up to I2C_MAX_DATA bytes,
+	or a write then a repeated start and a read.  The I2C0 interrupt walks each one through
+	its bytes; poll() (from the main loop) hands finished ones to their callbacks, starts the
+	next, and gives up on any that have taken longer than I2C_TIMEOUT.
+
+	Wire is only used to set up the pins and the clock, then its hardware is ours.
+	
+*/
+#include "I2CBus.h"
+#include "SystemConfig.h"
+#include "ConsoleOut.h"
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+#include <Wire.h>
+
+I2CBus* I2CBus::_instance = NULL;
+
+I2CBus::I2CBus()
+{
+	_head = 0;
+	_tail = 0;
+	_phase = I2C_PHASE_IDLE;
+	_txIndex = 0;
+	_rxIndex = 0;
+	_numDevices = 0;
+	_busResets = 0;
+}
+
+void I2CBus::begin()
+{
+	_instance = this;
+	Wire.begin();
+	Wire.setClock(I2C_CLOCK);
+	attachInterruptVector(IRQ_I2C0, isr);
+	NVIC_ENABLE_IRQ(IRQ_I2C0);
+	I2C0_C1 = I2C_C1_IICEN;
+}
+
+bool I2CBus::queue(uint8_t address, const uint8_t* tx, uint8_t txLength, uint8_t rxLength, I2CCallback callback, void* context)
+{
+	// false if the queue's full; the callback gets the request back when it's done
+	uint8_t next = (_tail + 1) % I2C_QUEUE_SIZE;
+	I2CRequest *request;
+	if (next == _head || txLength > I2C_MAX_DATA || rxLength > I2C_MAX_DATA)
+		return false;
+	request = &_queue[_tail];
+	request->address = address;
+	if (txLength > 0)
+		memcpy(request->tx, tx, txLength);
+	request->txLength = txLength;
+	request->rxLength = rxLength;
+	request->status = I2C_PENDING;
+	request->queued = micros();
+	request->callback = callback;
+	request->context = context;
+	_tail = next;
+	if (_phase == I2C_PHASE_IDLE)
+		start();
+	return true;
+}
+
+uint8_t I2CBus::transfer(uint8_t address, const uint8_t* tx, uint8_t txLength, uint8_t* rx, uint8_t rxLength)
+{
+	// Waits for the result - only for setup, where nothing else is going on yet.
+	// Returns the I2CStatus.
+	I2CRequest *request;
+	uint8_t slot = _tail;
+	uint8_t status;
+	while (!queue(address, tx, txLength, rxLength, NULL, NULL))
+		poll();
+	request = &_queue[slot];
+	while (request->status == I2C_PENDING)
+		poll();
+	status = request->status;
+	if (status == I2C_OK && rxLength > 0)
+		memcpy(rx, request->rx, rxLength);
+	if (_head == slot)
+		poll(); // take it off the queue
+	return status;
+}
+
+void I2CBus::start()
+{
+	// put the request at the head of the queue on the bus
+	I2CRequest *request = &_queue[_head];
+	if (_head == _tail || request->status != I2C_PENDING)
+		return; // nothing to do, or it's finished and waiting for poll()
+	if (I2C0_S & I2C_S_BUSY)
+		return; // someone else still has the bus, poll() will try again
+	request->started = micros();
+	_txIndex = 0;
+	_rxIndex = 0;
+	I2C0_S = I2C_S_IICIF | I2C_S_ARBL;
+	I2C0_C1 = I2C_C1_IICEN | I2C_C1_IICIE | I2C_C1_MST | I2C_C1_TX; // start condition
+	if (request->txLength > 0 || request->rxLength == 0)
+	{
+		_phase = I2C_PHASE_WRITE;
+		I2C0_D = request->address << 1;
+	} else {
+		_phase = I2C_PHASE_READ_ADDRESS;
+		I2C0_D = (request->address << 1) | 1;
+	}
+}
+
+void I2CBus::stop()
+{
+	I2C0_C1 = I2C_C1_IICEN; // dropping MST sends the stop
+}
+
+void I2CBus::recover()
+{
+	// Turns the module off and frees the bus.  A device that was part way through sending us
+	// a byte when we gave up still holds SDA low, and will until it's been clocked out - so SCL
+	// is clocked by hand until it lets go, then a stop puts every device back to waiting for a
+	// start.  Takes ~100us; poll() has the I2C interrupt off while it does.
+	int i;
+	I2C0_C1 = 0;
+	pinMode(I2C_SDA_PIN, INPUT);
+	pinMode(I2C_SCL_PIN, OUTPUT_OPENDRAIN);
+	digitalWrite(I2C_SCL_PIN, HIGH);
+	delayMicroseconds(I2C_RECOVERY_HALF);
+	for (i=0;i<I2C_RECOVERY_CLOCKS && digitalRead(I2C_SDA_PIN) == LOW;i++)
+	{
+		digitalWrite(I2C_SCL_PIN, LOW);
+		delayMicroseconds(I2C_RECOVERY_HALF);
+		digitalWrite(I2C_SCL_PIN, HIGH);
+		delayMicroseconds(I2C_RECOVERY_HALF);
+	}
+	// stop: SDA goes high while SCL is high
+	pinMode(I2C_SDA_PIN, OUTPUT_OPENDRAIN);
+	digitalWrite(I2C_SCL_PIN, LOW);
+	digitalWrite(I2C_SDA_PIN, LOW);
+	delayMicroseconds(I2C_RECOVERY_HALF);
+	digitalWrite(I2C_SCL_PIN, HIGH);
+	delayMicroseconds(I2C_RECOVERY_HALF);
+	digitalWrite(I2C_SDA_PIN, HIGH);
+	delayMicroseconds(I2C_RECOVERY_HALF);
+	// and back to the I2C module, as Wire set them up
+	I2C_SDA_PIN_CONFIG = PORT_PCR_MUX(2) | PORT_PCR_ODE | PORT_PCR_SRE | PORT_PCR_DSE;
+	I2C_SCL_PIN_CONFIG = PORT_PCR_MUX(2) | PORT_PCR_ODE | PORT_PCR_SRE | PORT_PCR_DSE;
+	I2C0_C1 = I2C_C1_IICEN;
+}
+
+void I2CBus::finish(I2CStatus status)
+{
+	I2CRequest *request = &_queue[_head];
+	request->finished = micros();
+	request->status = status;
+	_phase = I2C_PHASE_IDLE;
+}
+
+void I2CBus::isr()
+{
+	_instance->interrupt();
+}
+
+void I2CBus::interrupt()
+{
+	I2CRequest *request = &_queue[_head];
+	uint8_t status = I2C0_S;
+	I2C0_S = I2C_S_IICIF;
+	if (_phase == I2C_PHASE_IDLE)
+		return;
+	if (status & I2C_S_ARBL)
+	{
+		I2C0_S = I2C_S_ARBL;
+		stop();
+		finish(I2C_ARBITRATION_LOST);
+		return;
+	}
+	switch (_phase)
+	{
+		case I2C_PHASE_WRITE:
+			if (status & I2C_S_RXAK)
+			{
+				stop();
+				finish(I2C_NACK);
+			} else if (_txIndex < request->txLength)
+			{
+				I2C0_D = request->tx[_txIndex++];
+			} else if (request->rxLength > 0)
+			{
+				_phase = I2C_PHASE_READ_ADDRESS;
+				I2C0_C1 |= I2C_C1_RSTA;
+				I2C0_D = (request->address << 1) | 1;
+			} else {
+				stop();
+				finish(I2C_OK);
+			}
+			break;
+		case I2C_PHASE_READ_ADDRESS:
+			if (status & I2C_S_RXAK)
+			{
+				stop();
+				finish(I2C_NACK);
+				break;
+			}
+			_phase = I2C_PHASE_READ;
+			// switch to receiving; the last byte gets a NAK so the device lets go
+			if (request->rxLength == 1)
+				I2C0_C1 = I2C_C1_IICEN | I2C_C1_IICIE | I2C_C1_MST | I2C_C1_TXAK;
+			else
+				I2C0_C1 = I2C_C1_IICEN | I2C_C1_IICIE | I2C_C1_MST;
+			(void) I2C0_D; // a dummy read clocks in the first byte
+			break;
+		case I2C_PHASE_READ:
+			if (_rxIndex == request->rxLength - 1)
+			{
+				stop(); // before reading D, or another byte gets clocked in
+				request->rx[_rxIndex++] = I2C0_D;
+				finish(I2C_OK);
+				break;
+			}
+			if (_rxIndex == request->rxLength - 2)
+				I2C0_C1 |= I2C_C1_TXAK;
+			request->rx[_rxIndex++] = I2C0_D;
+			break;
+		default:
+			break;
+	}
+}
+
+void I2CBus::poll()
+{
+	// call every time round the loop
+	I2CRequest *request;
+	I2CRequest done;
+	if (_head == _tail)
+		return;
+	request = &_queue[_head];
+	if (request->status == I2C_PENDING)
+	{
+		// the interrupt could finish it between looking and acting, so it's held off and
+		// looked at again before anything's decided
+		NVIC_DISABLE_IRQ(IRQ_I2C0);
+		if (request->status == I2C_PENDING && _phase == I2C_PHASE_IDLE)
+		{
+			start(); // wasn't able to start it before
+			if (_phase == I2C_PHASE_IDLE && micros() - request->queued > I2C_TIMEOUT)
+			{
+				// the bus has been busy all this time - a device is holding SDA low
+				recover();
+				request->finished = micros();
+				request->status = I2C_TIMEOUT_ERROR;
+				_busResets++;
+			}
+		} else if (request->status == I2C_PENDING && micros() - request->started > I2C_TIMEOUT)
+		{
+			// a device is stretching the clock for ever, or we've lost track - reset the module
+			recover();
+			_phase = I2C_PHASE_IDLE;
+			request->finished = micros();
+			request->status = I2C_TIMEOUT_ERROR;
+			_busResets++;
+		}
+		NVIC_ENABLE_IRQ(IRQ_I2C0);
+		if (request->status == I2C_PENDING)
+			return;
+	}
+	// done - free the slot before the callback, so it can queue the next one
+	done = *request;
+	_head = (_head + 1) % I2C_QUEUE_SIZE;
+	record(&done);
+	if (_head != _tail)
+		start();
+	if (done.callback != NULL)
+		done.callback(&done);
+}
+
+void I2CBus::record(I2CRequest* request)
+{
+	// only devices that have answered at least once get a slot, so a bus scan doesn't fill the table
+	I2CDeviceStats *device = NULL;
+	unsigned long elapsed = request->finished - request->queued;
+	int i;
+	for (i=0;i<_numDevices;i++)
+	{
+		if (_devices[i].address == request->address)
+			device = &_devices[i];
+	}
+	if (device == NULL)
+	{
+		if (request->status != I2C_OK || _numDevices >= I2C_MAX_DEVICES)
+			return;
+		device = &_devices[_numDevices++];
+		memset(device, 0, sizeof(I2CDeviceStats));
+		device->address = request->address;
+	}
+	device->transfers++;
+	if (request->status == I2C_TIMEOUT_ERROR)
+		device->timeouts++;
+	else if (request->status != I2C_OK)
+		device->errors++;
+	device->lastMicros = elapsed;
+	if (elapsed > device->maxMicros)
+		device->maxMicros = elapsed;
+}
+
+int I2CBus::queued()
+{
+	return (_tail + I2C_QUEUE_SIZE - _head) % I2C_QUEUE_SIZE;
+}
+
+void I2CBus::printStats()
+{
+	int i;
+	I2CDeviceStats *device;
+	CONSOLE.printf(F("I2C at %lu kHz, %d queued, %lu bus resets\r\n"), (unsigned long) I2C_CLOCK / 1000, queued(), _busResets);
+	for (i=0;i<_numDevices;i++)
+	{
+		device = &_devices[i];
+		CONSOLE.printf(F("0x%02x: %lu transfers, %lu errors, %lu timeouts, last %lu us, worst %lu us\r\n"),
+			device->address, device->transfers, device->errors, device->timeouts, device->lastMicros, device->maxMicros);
+	}
+}
@@ -0,0 +1,99 @@
+/*
+
+	I2CBus.h
+	
+	Queued, interrupt driven I2C so a slow or missing device never holds up the main loop
+	
+*/
+
+#ifndef I2CBUS_H
+#define I2CBUS_H
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#define I2C_CLOCK 400000
+#define I2C_QUEUE_SIZE 16
+#define I2C_MAX_DATA 4					// bytes each way in one request
+#define I2C_TIMEOUT 2000				// us for a whole transfer, clock stretching and all
+#define I2C_MAX_DEVICES 16				// devices we keep stats for
+#define I2C_SDA_PIN 18
+#define I2C_SDA_PIN_CONFIG CORE_PIN18_CONFIG
+#define I2C_SCL_PIN 19
+#define I2C_SCL_PIN_CONFIG CORE_PIN19_CONFIG
+#define I2C_RECOVERY_CLOCKS 9			// enough for a device to finish any byte it's in the middle of
+#define I2C_RECOVERY_HALF 5				// us each half of a clock while recovering, 100 kHz
+
+enum I2CStatus {
+	I2C_PENDING,
+	I2C_OK,
+	I2C_NACK,							// nobody answered, or the device refused a byte
+	I2C_ARBITRATION_LOST,
+	I2C_TIMEOUT_ERROR
+};
+
+enum I2CPhase {
+	I2C_PHASE_IDLE,
+	I2C_PHASE_WRITE,					// address for writing or a data byte has gone out
+	I2C_PHASE_READ_ADDRESS,				// address for reading has gone out
+	I2C_PHASE_READ						// receiving
+};
+
+struct _i2cRequest;
+typedef void (*I2CCallback)(struct _i2cRequest* request);
+
+typedef struct _i2cRequest {
+	uint8_t address;
+	uint8_t tx[I2C_MAX_DATA];
+	uint8_t txLength;
+	uint8_t rx[I2C_MAX_DATA];
+	uint8_t rxLength;
+	volatile uint8_t status;			// I2CStatus
+	unsigned long queued;				// micros()
+	unsigned long started;
+	unsigned long finished;
+	I2CCallback callback;				// called from poll(), not the interrupt
+	void* context;
+} I2CRequest;
+
+typedef struct _i2cDeviceStats {
+	uint8_t address;
+	unsigned long transfers;
+	unsigned long errors;
+	unsigned long timeouts;
+	unsigned long lastMicros;			// queued to finished
+	unsigned long maxMicros;
+} I2CDeviceStats;
+
+class I2CBus{
+	public:
+		I2CBus();
+		void begin();
+		bool queue(uint8_t address, const uint8_t* tx, uint8_t txLength, uint8_t rxLength, I2CCallback callback, void* context);
+		uint8_t transfer(uint8_t address, const uint8_t* tx, uint8_t txLength, uint8_t* rx, uint8_t rxLength);
+		void poll();
+		int queued();
+		void printStats();
+		static void isr();
+	private:
+		I2CRequest _queue[I2C_QUEUE_SIZE];
+		volatile uint8_t _head;			// oldest request, the one on the bus if _phase isn't idle
+		volatile uint8_t _tail;
+		volatile I2CPhase _phase;
+		volatile uint8_t _txIndex;
+		volatile uint8_t _rxIndex;
+		I2CDeviceStats _devices[I2C_MAX_DEVICES];
+		int _numDevices;
+		unsigned long _busResets;
+		void start();
+		void finish(I2CStatus status);
+		void stop();
+		void recover();
+		void record(I2CRequest* request);
+		void interrupt();
+		static I2CBus* _instance;
+};
+
+#endif
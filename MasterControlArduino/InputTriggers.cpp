@@ -0,0 +1,402 @@
+/*
+
+	InputTriggers.cpp
+	
+	Starts sequences when an input changes - a visitor's button, a PIR, a pin on an expander
+
+	Teensy pins each get a pin change interrupt, which timestamps the edge.  An edge away from
+	where the input last settled, in the direction the trigger wants, is taken straight away;
+	every edge, taken or not, then locks the input out until it's been quiet for INPUT_LOCKOUT,
+	so a bouncing contact is debounced without waiting for it to settle.  Once it's quiet, poll()
+	looks at where it ended up - that's how a release is noticed, and a change that happened
+	during the lockout.  poll() (from the main loop) also starts the sequences, sending their
+	first cues there and then - so an edge waits for whatever the loop is in the middle of,
+	and the latency is up to one time round the loop (worst is in GETSTATUS).
+
+	Expander pins are read over the I2C queue when their INT line falls (or every
+	INPUT_EXPANDER_POLL if it isn't wired up), and edges found by comparing with the last read.
+	An edge's time is when INT fell, or without it when the read that saw it went out on the
+	bus - the edge itself could have been up to INPUT_EXPANDER_POLL before that, which the
+	latency doesn't include, as there's no way to know.
+	
+*/
+#include "InputTriggers.h"
+#include "SystemConfig.h"
+#include "ConsoleOut.h"
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+#include <SdFat.h>
+#include "DmxPort.h"
+
+extern I2CBus i2c;
+extern SdFat sd;
+
+InputTriggers* InputTriggers::_instance = NULL;
+
+// Teensy pins something else is already using, which a trigger would break
+typedef struct _reservedPin {
+	uint8_t pin;
+	const char* use;
+} ReservedPin;
+
+static const ReservedPin RESERVED_PINS[] = {
+	{0, "the user serial port"},		// Serial1 RX/TX
+	{1, "the user serial port"},
+	{OK_LED, "the OK LED"},
+	{SDCARD_CHIPSELECT, "the SD card"},
+	{7, "DMX"},							// Serial3 RX
+	{DMX_TX_PIN, "DMX"},
+	{9, "the motor controllers"},		// Serial2 RX/TX
+	{10, "the motor controllers"},
+	{11, "the SD card"},				// SPI
+	{12, "the SD card"},
+	{13, "the SD card"},
+	{ONEWIRE_PIN, "the 1Wire sensors"},
+	{ESTOP_PIN, "ESTOP"},
+	{I2C_SDA_PIN, "I2C"},
+	{I2C_SCL_PIN, "I2C"},
+	{DMX_TXEN, "DMX"},
+	{DMX_RXEN, "DMX"},
+#ifdef EXPANDER_INT_PIN
+	{EXPANDER_INT_PIN, "the expanders' INT line"},
+#endif
+};
+
+// attachInterrupt() doesn't say which pin it was, so each trigger slot gets its own handler
+template<int N> void InputTriggers::pinIsr()
+{
+	_instance->pinEdge(N);
+}
+
+typedef void (*InputIsr)(void);
+static const InputIsr PIN_ISRS[INPUT_MAX_TRIGGERS] = {
+	InputTriggers::pinIsr<0>, InputTriggers::pinIsr<1>, InputTriggers::pinIsr<2>, InputTriggers::pinIsr<3>,
+	InputTriggers::pinIsr<4>, InputTriggers::pinIsr<5>, InputTriggers::pinIsr<6>, InputTriggers::pinIsr<7>,
+	InputTriggers::pinIsr<8>, InputTriggers::pinIsr<9>, InputTriggers::pinIsr<10>, InputTriggers::pinIsr<11>,
+	InputTriggers::pinIsr<12>, InputTriggers::pinIsr<13>, InputTriggers::pinIsr<14>, InputTriggers::pinIsr<15>
+};
+
+InputTriggers::InputTriggers()
+{
+	_numTriggers = 0;
+	_sched = NULL;
+	_relays = NULL;
+	memset(_expanderInputs, 0xFF, sizeof(_expanderInputs));
+	_expanderReads = 0;
+	_expanderChanged = false;
+	_expanderEdgeMicros = 0;
+	_lastExpanderPoll = 0;
+}
+
+void InputTriggers::begin(Scheduler* sched, RelayBanks* relays)
+{
+	int i;
+	_instance = this;
+	_sched = sched;
+	_relays = relays;
+	for (i=0;i<_relays->numBanks();i++)
+		_expanderInputs[i] = _relays->getBank(i)->value();
+#ifdef EXPANDER_INT_PIN
+	pinMode(EXPANDER_INT_PIN, INPUT_PULLUP);
+	attachInterrupt(EXPANDER_INT_PIN, expanderIsr, FALLING);
+#endif
+	load();
+}
+
+bool InputTriggers::add(uint8_t source, uint8_t pin, uint8_t edge, unsigned long sequenceId)
+{
+	InputTrigger *trigger;
+	if (_numTriggers >= INPUT_MAX_TRIGGERS)
+	{
+		CONSOLE.printf(F("There are already %d triggers\r\n"), INPUT_MAX_TRIGGERS);
+		return false;
+	}
+	if (source == INPUT_SOURCE_EXPANDER && (pin < 1 || pin > _relays->numRelays()))
+	{
+		CONSOLE.printf(F("There's no expander pin X%d\r\n"), pin);
+		return false;
+	}
+	if (source == INPUT_SOURCE_PIN && !pinAvailable(pin))
+		return false;
+	trigger = &_triggers[_numTriggers];
+	memset(trigger, 0, sizeof(InputTrigger));
+	trigger->source = source;
+	trigger->pin = pin;
+	trigger->edge = edge;
+	trigger->sequenceId = sequenceId;
+	_numTriggers++;
+	attach(_numTriggers - 1);
+	return true;
+}
+
+bool InputTriggers::pinAvailable(uint8_t pin)
+{
+	unsigned int i;
+	if (pin >= CORE_NUM_DIGITAL)
+	{
+		CONSOLE.printf(F("There's no pin %d\r\n"), pin);
+		return false;
+	}
+	for (i=0;i<sizeof(RESERVED_PINS) / sizeof(ReservedPin);i++)
+	{
+		if (RESERVED_PINS[i].pin == pin)
+		{
+			CONSOLE.printf(F("Pin %d is used for %s\r\n"), pin, RESERVED_PINS[i].use);
+			return false;
+		}
+	}
+	return true;
+}
+
+void InputTriggers::attach(int index)
+{
+	InputTrigger *trigger = &_triggers[index];
+	if (trigger->source == INPUT_SOURCE_PIN)
+	{
+		pinMode(trigger->pin, INPUT_PULLUP);
+		trigger->level = digitalReadFast(trigger->pin);
+		attachInterrupt(trigger->pin, PIN_ISRS[index], CHANGE);
+	} else {
+		expanderInputs();
+		trigger->level = currentLevel(trigger);
+	}
+}
+
+void InputTriggers::expanderInputs()
+{
+	// a PCF8574 pin only works as an input while it's written high, so keep the relays code off them
+	uint8_t masks[RELAYS_MAX_BANKS];
+	int i;
+	memset(masks, 0, sizeof(masks));
+	for (i=0;i<_numTriggers;i++)
+	{
+		if (_triggers[i].source == INPUT_SOURCE_EXPANDER)
+			masks[(_triggers[i].pin - 1) / RELAYS_PER_BANK] |= 1 << ((_triggers[i].pin - 1) % RELAYS_PER_BANK);
+	}
+	for (i=0;i<_relays->numBanks();i++)
+		_relays->getBank(i)->setInputs(masks[i]);
+	_relays->flush();
+}
+
+void InputTriggers::clear()
+{
+	int i;
+	for (i=0;i<_numTriggers;i++)
+	{
+		if (_triggers[i].source == INPUT_SOURCE_PIN)
+			detachInterrupt(_triggers[i].pin);
+	}
+	_numTriggers = 0;
+	expanderInputs();
+}
+
+bool InputTriggers::edgeMatches(uint8_t edge, bool level)
+{
+	return edge == INPUT_EDGE_BOTH || (edge == INPUT_EDGE_RISING) == level;
+}
+
+void InputTriggers::pinEdge(int index)
+{
+	// interrupt
+	if (index >= _numTriggers)
+		return;
+	edge(&_triggers[index], digitalReadFast(_triggers[index].pin), micros());
+}
+
+void InputTriggers::edge(InputTrigger* trigger, bool level, unsigned long edgeMicros)
+{
+	// Every edge starts the lockout again, matching or not.  Only a change from where the
+	// input settled, that the trigger wants, is taken now - anything else (a release, or a
+	// bounce long after the press) waits until it's quiet and poll() can see where it went.
+	bool locked = (long)(millis() - trigger->lockedUntil) < 0;
+	trigger->lastEdgeMicros = edgeMicros;
+	trigger->lockedUntil = millis() + INPUT_LOCKOUT;
+	if (locked)
+	{
+		trigger->bounces++;
+		return;
+	}
+	if (level == trigger->level || !edgeMatches(trigger->edge, level))
+		return;
+	trigger->level = level;
+	if (trigger->pending)
+		return;
+	trigger->edgeMicros = edgeMicros;
+	trigger->pending = true;
+}
+
+bool InputTriggers::currentLevel(InputTrigger* trigger)
+{
+	if (trigger->source == INPUT_SOURCE_PIN)
+		return digitalReadFast(trigger->pin);
+	return (_expanderInputs[(trigger->pin - 1) / RELAYS_PER_BANK] >> ((trigger->pin - 1) % RELAYS_PER_BANK)) & 1;
+}
+
+void InputTriggers::expanderIsr()
+{
+	_instance->_expanderEdgeMicros = micros();
+	_instance->_expanderChanged = true;
+}
+
+void InputTriggers::readExpanders()
+{
+	// one read per bank with an input on it
+	int bank;
+	for (bank=0;bank<_relays->numBanks();bank++)
+	{
+		if (_relays->getBank(bank)->getInputs() == 0 || !_relays->getBank(bank)->isOnline())
+			continue;
+		if (i2c.queue(_relays->getBank(bank)->getAddress(), NULL, 0, 1, expanderDone, (void*) (intptr_t) bank))
+			_expanderReads++;
+	}
+}
+
+void InputTriggers::expanderDone(I2CRequest* request)
+{
+	InputTriggers *inputs = _instance;
+	int bank = (int) (intptr_t) request->context;
+	inputs->_expanderReads--;
+	if (request->status == I2C_OK)
+		inputs->expanderEdges(bank, request->rx[0], request->started);
+}
+
+void InputTriggers::expanderEdges(int bank, uint8_t inputs, unsigned long readMicros)
+{
+	uint8_t changed = (inputs ^ _expanderInputs[bank]) & _relays->getBank(bank)->getInputs();
+	InputTrigger *trigger;
+	unsigned long edgeMicros;
+	int i, bit;
+	_expanderInputs[bank] = inputs;
+	if (changed == 0)
+		return;
+#ifdef EXPANDER_INT_PIN
+	edgeMicros = _expanderEdgeMicros;
+#else
+	edgeMicros = readMicros;
+#endif
+	for (i=0;i<_numTriggers;i++)
+	{
+		trigger = &_triggers[i];
+		if (trigger->source != INPUT_SOURCE_EXPANDER || (trigger->pin - 1) / RELAYS_PER_BANK != bank)
+			continue;
+		bit = (trigger->pin - 1) % RELAYS_PER_BANK;
+		if (changed & (1 << bit))
+			edge(trigger, (inputs >> bit) & 1, edgeMicros);
+	}
+}
+
+void InputTriggers::poll()
+{
+	// call every time round the loop
+	InputTrigger *trigger;
+	unsigned long latency;
+	int i;
+#ifdef EXPANDER_INT_PIN
+	if (_expanderChanged && _expanderReads == 0)
+	{
+		_expanderChanged = false;
+		readExpanders();
+	}
+#else
+	if (_expanderReads == 0 && millis() - _lastExpanderPoll >= INPUT_EXPANDER_POLL)
+	{
+		_lastExpanderPoll = millis();
+		readExpanders();
+	}
+#endif
+	for (i=0;i<_numTriggers;i++)
+	{
+		trigger = &_triggers[i];
+		// quiet since the last edge, so wherever it is now is where it's settled
+		__disable_irq();
+		if ((long)(millis() - trigger->lockedUntil) >= 0 && currentLevel(trigger) != trigger->level)
+		{
+			trigger->level = !trigger->level;
+			if (edgeMatches(trigger->edge, trigger->level) && !trigger->pending)
+			{
+				trigger->edgeMicros = trigger->lastEdgeMicros;
+				trigger->pending = true;
+			}
+		}
+		__enable_irq();
+		if (!trigger->pending)
+			continue;
+		if (_sched != NULL && _sched->startSequenceNow(trigger->sequenceId))
+		{
+			latency = micros() - trigger->edgeMicros;
+			trigger->lastLatency = latency;
+			if (latency > trigger->maxLatency)
+				trigger->maxLatency = latency;
+			trigger->fired++;
+		} else {
+			trigger->missed++;
+		}
+		trigger->pending = false;
+	}
+}
+
+void InputTriggers::print()
+{
+	int i;
+	InputTrigger *trigger;
+	static const char* EDGES[] = {"falling", "rising", "both"};
+	for (i=0;i<_numTriggers;i++)
+	{
+		trigger = &_triggers[i];
+		CONSOLE.printf(F("%s%d %s -> sequence %lu: fired %lu, missed %lu, bounces %lu, latency %lu us (worst %lu us)\r\n"),
+			trigger->source == INPUT_SOURCE_PIN ? "P" : "X", trigger->pin, EDGES[trigger->edge], trigger->sequenceId,
+			trigger->fired, trigger->missed, trigger->bounces, trigger->lastLatency, trigger->maxLatency);
+	}
+	if (_numTriggers == 0)
+		CONSOLE.println(F("No input triggers"));
+}
+
+bool InputTriggers::load()
+{
+	// one per line: P17 5 F (pin 17 falling starts sequence 5), X9 3 R (relay/expander pin 9 rising)
+	SdFile triggerFile;
+	char line[24];
+	char *next;
+	uint8_t source, pin, edge;
+	unsigned long sequenceId;
+	if (!triggerFile.open(INPUT_TRIGGERS_FILE, O_READ))
+		return false;
+	clear();
+	while (triggerFile.fgets(line, sizeof(line)) > 0)
+	{
+		if (line[0] != 'P' && line[0] != 'X')
+			continue;
+		source = (line[0] == 'P') ? INPUT_SOURCE_PIN : INPUT_SOURCE_EXPANDER;
+		pin = strtol(&line[1], &next, 10);
+		sequenceId = strtoul(next, &next, 10);
+		while (*next == ' ')
+			next++;
+		edge = (*next == 'R') ? INPUT_EDGE_RISING : (*next == 'B') ? INPUT_EDGE_BOTH : INPUT_EDGE_FALLING;
+		add(source, pin, edge, sequenceId);
+	}
+	triggerFile.close();
+	return true;
+}
+
+bool InputTriggers::save()
+{
+	SdFile triggerFile;
+	int i;
+	static const char EDGES[] = {'F', 'R', 'B'};
+	sd.remove(INPUT_TRIGGERS_FILE);
+	if (!triggerFile.open(INPUT_TRIGGERS_FILE, O_RDWR | O_CREAT))
+	{
+		sd.errorPrint("couldn't open triggers for writing");
+		return false;
+	}
+	for (i=0;i<_numTriggers;i++)
+	{
+		triggerFile.printf("%c%d %lu %c\r\n", _triggers[i].source == INPUT_SOURCE_PIN ? 'P' : 'X',
+			_triggers[i].pin, _triggers[i].sequenceId, EDGES[_triggers[i].edge]);
+	}
+	triggerFile.close();
+	return true;
+}
@@ -0,0 +1,89 @@
+/*
+
+	InputTriggers.h
+	
+	Starts sequences when an input changes - a visitor's button, a PIR, a pin on an expander
+	
+*/
+
+#ifndef INPUTTRIGGERS_H
+#define INPUTTRIGGERS_H
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+#include "SystemConfig.h"
+#include "Scheduler.h"
+#include "I2CBus.h"
+#include "RelayBanks.h"
+
+#define INPUT_MAX_TRIGGERS 16
+#define INPUT_LOCKOUT 50				// ms the input has to be quiet, after any edge, before it's listened to again
+#define INPUT_EXPANDER_POLL 2			// ms between reading expander inputs, without EXPANDER_INT_PIN
+#define INPUT_TRIGGERS_FILE "TRIGGERS.DAT"
+
+enum InputSource {
+	INPUT_SOURCE_PIN,					// a Teensy pin, by its digital pin number
+	INPUT_SOURCE_EXPANDER				// a pin on the relay expanders, by relay number
+};
+
+enum InputEdge {
+	INPUT_EDGE_FALLING,					// buttons pull down
+	INPUT_EDGE_RISING,
+	INPUT_EDGE_BOTH
+};
+
+typedef struct _inputTrigger {
+	uint8_t source;
+	uint8_t pin;
+	uint8_t edge;
+	unsigned long sequenceId;
+	volatile bool pending;				// an edge has been taken and not acted on yet
+	volatile unsigned long edgeMicros;
+	volatile unsigned long lastEdgeMicros;	// the latest edge, taken or not
+	volatile unsigned long lockedUntil;	// millis()
+	volatile bool level;				// where the input last settled
+	volatile unsigned long bounces;		// edges ignored during the lockout
+	unsigned long fired;
+	unsigned long missed;				// the sequence was already running, or couldn't start
+	unsigned long lastLatency;			// us from the edge to the sequence's first cues going out
+	unsigned long maxLatency;
+} InputTrigger;
+
+class InputTriggers{
+	public:
+		InputTriggers();
+		void begin(Scheduler* sched, RelayBanks* relays);
+		bool add(uint8_t source, uint8_t pin, uint8_t edge, unsigned long sequenceId);
+		void clear();
+		void poll();
+		void print();
+		bool load();
+		bool save();
+		template<int N> static void pinIsr();
+	private:
+		InputTrigger _triggers[INPUT_MAX_TRIGGERS];
+		int _numTriggers;
+		Scheduler* _sched;
+		RelayBanks* _relays;
+		uint8_t _expanderInputs[RELAYS_MAX_BANKS];	// last read of each bank
+		uint8_t _expanderReads;				// queued on the bus and not back yet
+		volatile bool _expanderChanged;
+		volatile unsigned long _expanderEdgeMicros;
+		unsigned long _lastExpanderPoll;
+		bool pinAvailable(uint8_t pin);
+		void attach(int index);
+		void expanderInputs();
+		void pinEdge(int index);
+		void edge(InputTrigger* trigger, bool level, unsigned long edgeMicros);
+		bool currentLevel(InputTrigger* trigger);
+		void readExpanders();
+		void expanderEdges(int bank, uint8_t inputs, unsigned long readMicros);
+		bool edgeMatches(uint8_t edge, bool level);
+		static void expanderIsr();
+		static void expanderDone(I2CRequest* request);
+		static InputTriggers* _instance;
+};
+
+#endif
@@ -0,0 +1,92 @@
+/*
+
+	InternalTemperature.cpp
+	
+	The Teensy's own temperature sensor, sampled in the background so reading it costs nothing
+
+	The PDB triggers ADC0 TEMP_SAMPLE_RATE times a second, the ADC averages 32 conversions in
+	hardware, and the conversion complete interrupt swaps the result into a ring while keeping a
+	running sum of it.  Reading the temperature is then just a bit of integer maths on the sum.
+
+	This takes ADC0 over completely, so nothing else can analogRead() once it's started.
+	
+*/
+#include "InternalTemperature.h"
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+InternalTemperature* InternalTemperature::_instance = NULL;
+
+InternalTemperature::InternalTemperature()
+{
+	memset(_ring, 0, sizeof(_ring));
+	_next = 0;
+	_sum = 0;
+	_samples = 0;
+}
+
+void InternalTemperature::begin()
+{
+	// expects analogReference(INTERNAL) and analogReadResolution(12), as set up at boot
+	int i;
+	uint16_t first;
+	_instance = this;
+	// one ordinary read waits for the ADC to finish calibrating, and fills the ring so it starts out right
+	first = analogRead(TEMP_SENSOR_PIN);
+	for (i=0;i<TEMP_RING_SIZE;i++)
+		_ring[i] = first;
+	_sum = (uint32_t) first * TEMP_RING_SIZE;
+	// 32 conversions averaged per result, started by the PDB rather than by writing SC1A
+	ADC0_SC3 = ADC_SC3_AVGE | ADC_SC3_AVGS(3);
+	ADC0_SC2 |= ADC_SC2_ADTRG;
+	attachInterruptVector(IRQ_ADC0, adcIsr);
+	NVIC_SET_PRIORITY(IRQ_ADC0, 192);	// nothing waits on it
+	NVIC_ENABLE_IRQ(IRQ_ADC0);
+	ADC0_SC1A = ADC_SC1_AIEN | ADC_SC1_ADCH(TEMP_SENSOR_CHANNEL);
+	// PDB counts F_BUS / 128 / 10, and triggers the ADC every time it wraps
+	SIM_SCGC6 |= SIM_SCGC6_PDB;
+	PDB0_IDLY = 0;
+	PDB0_MOD = (F_BUS / 128 / 10) / TEMP_SAMPLE_RATE - 1;
+	PDB0_CH0C1 = PDB_CH0C1_TOS | PDB_CH0C1_EN;
+	PDB0_CH0DLY0 = 0;
+	PDB0_SC = PDB_SC_TRGSEL(15) | PDB_SC_PDBEN | PDB_SC_CONT | PDB_SC_PRESCALER(7) | PDB_SC_MULT(1) | PDB_SC_LDOK;
+	PDB0_SC |= PDB_SC_SWTRIG;
+}
+
+void InternalTemperature::adcIsr()
+{
+	// reading RA clears the interrupt
+	InternalTemperature *temp = _instance;
+	uint16_t sample = ADC0_RA;
+	uint8_t next = temp->_next;
+	temp->_sum = temp->_sum - temp->_ring[next] + sample;
+	temp->_ring[next] = sample;
+	temp->_next = (next + 1) & (TEMP_RING_SIZE - 1);
+	temp->_samples++;
+}
+
+int32_t InternalTemperature::milliC()
+{
+	// 25C + 0.17083C per count below 2454.19 (1.2V reference, 12 bit), done on the sum of the ring:
+	// 170.83 / 64 = 2.6692 ~= 2733 / 1024, and 2454.19 * 64 = 157068
+	int32_t sum = _sum;	// one 32 bit read, so no need to stop the interrupt
+	return 25000 + ((157068 - sum) * 2733) / 1024;
+}
+
+float InternalTemperature::celsius()
+{
+	return milliC() / 1000.0;
+}
+
+uint16_t InternalTemperature::average()
+{
+	return _sum / TEMP_RING_SIZE;
+}
+
+unsigned long InternalTemperature::samples()
+{
+	return _samples;
+}
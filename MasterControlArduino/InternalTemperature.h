@@ -0,0 +1,40 @@
+/*
+
+	InternalTemperature.h
+	
+	The Teensy's own temperature sensor, sampled in the background so reading it costs nothing
+	
+*/
+
+#ifndef INTERNALTEMPERATURE_H
+#define INTERNALTEMPERATURE_H
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+#include "SystemConfig.h"
+
+#define TEMP_SENSOR_PIN 38				// analogRead() number for the sensor
+#define TEMP_SENSOR_CHANNEL 26			// ADC0 channel for the same
+#define TEMP_SAMPLE_RATE 100			// Hz, each one the hardware average of 32 conversions
+#define TEMP_RING_SIZE 64				// samples in the running average; milliC() is worked out for 64
+
+class InternalTemperature{
+	public:
+		InternalTemperature();
+		void begin();
+		int32_t milliC();
+		float celsius();
+		uint16_t average();
+		unsigned long samples();
+		static void adcIsr();
+	private:
+		uint16_t _ring[TEMP_RING_SIZE];
+		volatile uint8_t _next;
+		volatile uint32_t _sum;			// of everything in the ring
+		volatile unsigned long _samples;
+		static InternalTemperature* _instance;
+};
+
+#endif
@@ -3,7 +3,7 @@
 #include <SdFat.h>
 #include <SPI.h>
 #include <Metro.h>
-#include <DmxSimple.h>
+#include <DMAChannel.h>
 #include <Bounce.h>
 
 #include <avr/io.h>
@@ -15,6 +15,24 @@
 #include "Scheduler.h"
 #include "MotorControl.h"
 #include "ClockManager.h"
+#include "I2CBus.h"
+#include "InputTriggers.h"
+#include "OneWireSensors.h"
+#include "ConsoleOut.h"
+#include "EventLog.h"
+#include "SerialRing.h"
+
+/* Console output for the CLI on each port, buffered so printing never holds up the loop */
+ConsoleOut usbConsole(&CTRL_SERIAL);
+ConsoleOut userConsole(&USER_SERIAL);
+ConsoleOut* console = &usbConsole;
+
+/* What comes in on the user serial port, taken from the UART as it arrives (USB waits for us anyway) */
+SerialRing userSerialRx(&USER_SERIAL);
+
+/* Log entries from every subsystem, printed from the loop */
+EventLog eventLog;
+
 /* User Interface */
 ControlInterface ctrl;
 
@@ -28,7 +46,18 @@ Metro sysControlMetro(250);
 
 /* Motor controll interface */
 MotorControl motorControl;
-Metro motorRefreshMetro(1000);
+Metro motorTelemetryMetro(MOTORS_TELEMETRY_TICK);
+Metro motorHistoryMetro(1000);
+
+/* I2C bus, shared by the relays and the temperature sensor */
+I2CBus i2c;
+
+/* Inputs that start sequences */
+InputTriggers inputs;
+extern RelayBanks relays;
+
+/* Temperature sensors on the 1Wire bus */
+OneWireSensors sensors;
 
 /* Clock Manager */
 ClockManager clockManager;
@@ -59,6 +88,8 @@ void setup()
 	digitalWrite(OK_LED,HIGH);
 	delay(1000);				// wait for a bit for all the subsystems to power up and enable
 	
+	ctrl.addSession(&CTRL_SERIAL, &usbConsole);
+	ctrl.addSession(&userSerialRx, &userConsole);
 	ctrl.start(CTRL_BAUD);
 	/* set up for internal temperature measurement */ 
 	analogReference(INTERNAL);
@@ -68,9 +99,9 @@ void setup()
 	
 	ctrl.printLog("Loading schedule from SD card");
 	digitalWrite(13,LOW); // need to turn the LED off before we use the SPI bus
-	//sched._debugging = true;
+	//eventLog.setLevel(LOG_SCHED, LOG_LEVEL_DEBUG);
 	sched.loadFromSD();
-	//sched._debugging = false;
+	//eventLog.setLevel(LOG_SCHED, LOG_LEVEL_NOTICE);
 	ctrl.printLog("Schedule loaded.");
 	ctrl.printLog("Connecting scheduler to system controller");
 	
@@ -85,22 +116,20 @@ void setup()
 	ctrl.printLog("Enabling system control");
 	systemControl.setup();
 	ctrl.printLog("Controller connected");
+	inputs.begin(&sched, &relays);
+	ctrl.setInputTriggers(&inputs);
+	ctrl.printLog("Searching 1Wire bus");
+	sensors.begin(&sched);
+	ctrl.printLog("Found " + String(sensors.numSensors()) + " 1Wire sensors");
+	ctrl.setOneWireSensors(&sensors);
+	systemControl.setOneWireSensors(&sensors);
 	ctrl.setSched(&sched);
 	ctrl.printLog("Starting scheduler");
 	
 	// Configure the system now
-	ctrl.printLog("Adding motors");
-	motorControl.addMotor(10);
-	motorControl.addMotor(11);
-	motorControl.addMotor(12);
-	motorControl.addMotor(13);
-	motorControl.addMotor(14);
-	motorControl.addMotor(15);
-	motorControl.addMotor(16);
-	motorControl.addMotor(17);
-	motorControl.addMotor(18);
-	//motorControl.addMotor(14);
-	//motorControl.printMotor(13);
+	ctrl.printLog("Discovering motors");
+	motorControl.discoverMotors();
+	ctrl.printLog("Found " + String(motorControl.numMotors()) + " motors");
 
 	// Hand control over to systemControl
 	systemControl.enable();
@@ -115,26 +144,36 @@ void setup()
 	sched.start();
 	// allow the control interface to interact with users
 	ctrl.interactive();
-	
+	// from here on the consoles only print what their ports can take without waiting
+	usbConsole.setBlocking(false);
+	userConsole.setBlocking(false);
 }
 
 
 void loop()
 {
+	systemControl.loopTick();
 	clockManager.loop();
 	ctrl.readSerial();
+	eventLog.poll();
+	i2c.poll();
+	inputs.poll();
+	sensors.poll();
+	systemControl.dmxFrameTick();
+	systemControl.timerTick();
+	motorControl.telemetryPoll();
 	eStop.update();
 	if (eStop.fallingEdge())
 	{
 		// emergency stop!!!!
 		systemControl.eStop();
-		CTRL_SERIAL.println("ESTOP engaged");
+		ctrl.printLog("ESTOP engaged");
 
 		}
 	if (eStop.risingEdge())
 	{
 		systemControl.restart();
-		CTRL_SERIAL.println("Reset motors");
+		ctrl.printLog("Reset motors");
 		
 	}
 	
@@ -142,31 +181,24 @@ void loop()
 	{
 		processTimer=0;
 		sched.execute();
-#ifdef TIMING_DEBUG
-		CTRL_SERIAL.printf("Sched executed in ");
-		CTRL_SERIAL.print(processTimer);
-		CTRL_SERIAL.println(" us");
-#endif
+		LOG_DEBUG(LOG_TIMING, "Sched executed in %lu us", (unsigned long) processTimer);
 	}
+	sched.prefetchScenes();
 	if (sysControlMetro.check() == 1)
 	{
 		processTimer=0;
 		systemControl.doStuff();
-#ifdef TIMING_DEBUG
-		CTRL_SERIAL.printf("SystemControl executed in ");
-		CTRL_SERIAL.print(processTimer);
-		CTRL_SERIAL.println(" us");
-#endif
+		LOG_DEBUG(LOG_TIMING, "SystemControl executed in %lu us", (unsigned long) processTimer);
 	}
-	if (motorRefreshMetro.check() == 1)
+	if (motorTelemetryMetro.check() == 1)
 	{
 		processTimer=0;
-		motorControl.refreshAllMotors();
-#ifdef TIMING_DEBUG
-		CTRL_SERIAL.printf("MotorControl executed in ");
-		CTRL_SERIAL.print(processTimer);
-		CTRL_SERIAL.println(" us");
-#endif
+		motorControl.telemetryTick();
+		LOG_DEBUG(LOG_TIMING, "MotorControl executed in %lu us", (unsigned long) processTimer);
+	}
+	if (motorHistoryMetro.check() == 1)
+	{
+		motorControl.historyTick();
 	}
 	
 	if (blinkenMetro.check() == 1)
@@ -7,30 +7,59 @@
 */
 #include "MotorControl.h"
 #include "SystemConfig.h"
+#include "ConsoleOut.h"
 #if defined(ARDUINO) && ARDUINO >= 100
 #include "Arduino.h"
 #else
 #include "WProgram.h"
 #endif
+#include <SdFat.h>
+
+extern SdFat sd;
 
 const unsigned char CRC7_POLY = 0x91;
-//Pololu CRC generating code
+// Pololu CRC7, one table lookup per byte rather than the 8 step bit loop.
+// Entry n is the bit loop run over the single byte n with CRC7_POLY.
+const unsigned char CRC7_TABLE[256] = {
+	0x00, 0x41, 0x13, 0x52, 0x26, 0x67, 0x35, 0x74, 0x4c, 0x0d, 0x5f, 0x1e, 0x6a, 0x2b, 0x79, 0x38,
+	0x09, 0x48, 0x1a, 0x5b, 0x2f, 0x6e, 0x3c, 0x7d, 0x45, 0x04, 0x56, 0x17, 0x63, 0x22, 0x70, 0x31,
+	0x12, 0x53, 0x01, 0x40, 0x34, 0x75, 0x27, 0x66, 0x5e, 0x1f, 0x4d, 0x0c, 0x78, 0x39, 0x6b, 0x2a,
+	0x1b, 0x5a, 0x08, 0x49, 0x3d, 0x7c, 0x2e, 0x6f, 0x57, 0x16, 0x44, 0x05, 0x71, 0x30, 0x62, 0x23,
+	0x24, 0x65, 0x37, 0x76, 0x02, 0x43, 0x11, 0x50, 0x68, 0x29, 0x7b, 0x3a, 0x4e, 0x0f, 0x5d, 0x1c,
+	0x2d, 0x6c, 0x3e, 0x7f, 0x0b, 0x4a, 0x18, 0x59, 0x61, 0x20, 0x72, 0x33, 0x47, 0x06, 0x54, 0x15,
+	0x36, 0x77, 0x25, 0x64, 0x10, 0x51, 0x03, 0x42, 0x7a, 0x3b, 0x69, 0x28, 0x5c, 0x1d, 0x4f, 0x0e,
+	0x3f, 0x7e, 0x2c, 0x6d, 0x19, 0x58, 0x0a, 0x4b, 0x73, 0x32, 0x60, 0x21, 0x55, 0x14, 0x46, 0x07,
+	0x48, 0x09, 0x5b, 0x1a, 0x6e, 0x2f, 0x7d, 0x3c, 0x04, 0x45, 0x17, 0x56, 0x22, 0x63, 0x31, 0x70,
+	0x41, 0x00, 0x52, 0x13, 0x67, 0x26, 0x74, 0x35, 0x0d, 0x4c, 0x1e, 0x5f, 0x2b, 0x6a, 0x38, 0x79,
+	0x5a, 0x1b, 0x49, 0x08, 0x7c, 0x3d, 0x6f, 0x2e, 0x16, 0x57, 0x05, 0x44, 0x30, 0x71, 0x23, 0x62,
+	0x53, 0x12, 0x40, 0x01, 0x75, 0x34, 0x66, 0x27, 0x1f, 0x5e, 0x0c, 0x4d, 0x39, 0x78, 0x2a, 0x6b,
+	0x6c, 0x2d, 0x7f, 0x3e, 0x4a, 0x0b, 0x59, 0x18, 0x20, 0x61, 0x33, 0x72, 0x06, 0x47, 0x15, 0x54,
+	0x65, 0x24, 0x76, 0x37, 0x43, 0x02, 0x50, 0x11, 0x29, 0x68, 0x3a, 0x7b, 0x0f, 0x4e, 0x1c, 0x5d,
+	0x7e, 0x3f, 0x6d, 0x2c, 0x58, 0x19, 0x4b, 0x0a, 0x32, 0x73, 0x21, 0x60, 0x14, 0x55, 0x07, 0x46,
+	0x77, 0x36, 0x64, 0x25, 0x51, 0x10, 0x42, 0x03, 0x3b, 0x7a, 0x28, 0x69, 0x1d, 0x5c, 0x0e, 0x4f,
+};
+
 unsigned char getCRC(unsigned char message[], unsigned char length)
 {
-	unsigned char i, j, crc = 0;
+	unsigned char i, crc = 0;
 	for (i = 0; i < length; i++)
 	{
-		crc ^= message[i];
-		for (j = 0; j < 8; j++)
-		{
-			if (crc & 1)
-				crc ^= CRC7_POLY;
-			crc >>= 1;
-		}
+		crc = CRC7_TABLE[crc ^ message[i]];
 	}
 	return crc;
 }
 
+unsigned char bitCount(unsigned long value)
+{
+	unsigned char count = 0;
+	while (value)
+	{
+		value &= value - 1;
+		count++;
+	}
+	return count;
+}
+
 void printTimeFromMs(unsigned long int ms)
 {
 	unsigned long int x, seconds, minutes, hours, days;
@@ -42,27 +71,149 @@ void printTimeFromMs(unsigned long int ms)
 	hours = x % 24;
 	x /= 24;
 	days = x;
-	CTRL_SERIAL.printf(" %2d days, %2d hours, %02d minutes, %02d seconds", days, hours, minutes, seconds);
+	CONSOLE.printf(" %2d days, %2d hours, %02d minutes, %02d seconds", days, hours, minutes, seconds);
 }
 
-void MotorControl::sendSMCMessage(unsigned char* message, int length)
+int MotorControl::writeSMCMessage(unsigned char* message, int length)
 {
+	// into the UART's buffer and no further, returns how many bytes that is with the CRC
 	int i;
 	for(i=0;i<length;i++)
 	{
 		MC_CTRL_SERIAL.write(message[i]);
 	}
-	if (_crcEnabled)
+	if (_crcMode != MOTORS_CRC_OFF)
 	{
 		MC_CTRL_SERIAL.write(getCRC(message,length));
+		length++;
 	}
+	return length;
+}
+
+void MotorControl::sendSMCMessage(unsigned char* message, int length)
+{
+	unsigned long started = micros();
+	if (_request.motor != NULL && (long)(_request.sent - started) > 0)
+		started = _request.sent; // a telemetry read's still going out ahead of it
+	length = writeSMCMessage(message,length);
 	MC_CTRL_SERIAL.flush();
+	// keep a smoothed measurement of how long each byte takes to get onto the wire
+	_lastSendMicros = micros();
+	_byteMicros = (_byteMicros * 7 + (_lastSendMicros - started) / length) / 8;
+}
+
+bool MotorControl::readSMCResponse(char devId, unsigned char* response, int length)
+{
+	// reads a reply, and its trailing CRC byte if the controllers are sending them
+	MotorController *ptr = getMotor(devId);
+	unsigned char crc;
+	unsigned long roundTrip;
+	if (MC_CTRL_SERIAL.readBytes(response,length) != (size_t)length)
+	{
+		if (ptr != NULL)
+			ptr->linkStats.timeouts++;
+		return false; // timed out
+	}
+	if (_crcMode == MOTORS_CRC_FULL)
+	{
+		if (MC_CTRL_SERIAL.readBytes(&crc,1) != 1 || crc != getCRC(response,length))
+		{
+			if (ptr != NULL)
+				ptr->linkStats.responseCrcErrors++;
+			return false;
+		}
+		length++;
+	}
+	if (ptr != NULL)
+	{
+		// whatever's left after the reply's own time on the wire is the controller thinking about it
+		roundTrip = micros() - _lastSendMicros;
+		if (roundTrip > length * _byteMicros)
+		{
+			ptr->latency = (ptr->latency * 3 + (roundTrip - length * _byteMicros)) / 4;
+		}
+	}
+	return true;
+}
+
+unsigned long MotorControl::getMessageMicros(int length)
+{
+	if (_crcMode != MOTORS_CRC_OFF)
+		length++;
+	return length * _byteMicros;
+}
+
+void MotorControl::setCrcMode(MotorCrcMode mode)
+{
+	// the controllers themselves must be set to the same CRC mode with the Pololu configuration utility
+	finishTelemetry();
+	_crcMode = mode;
+	MC_CTRL_SERIAL.clear();
+}
+
+MotorCrcMode MotorControl::getCrcMode()
+{
+	return _crcMode;
+}
+
+void MotorControl::recordSerialErrors(MotorController* controller, unsigned int serialErrors)
+{
+	// the controller clears these bits when they're read, so each poll is a fresh sample
+	MotorLinkStats *stats = &controller->linkStats;
+	if (serialErrors & MOTORCONTROLLER_SERIALERRORS_FRAME) stats->frameErrors++;
+	if (serialErrors & MOTORCONTROLLER_SERIALERRORS_NOISE) stats->noiseErrors++;
+	if (serialErrors & MOTORCONTROLLER_SERIALERRORS_RXOVERRUN) stats->rxOverruns++;
+	if (serialErrors & MOTORCONTROLLER_SERIALERRORS_FORMAT) stats->formatErrors++;
+	if (serialErrors & MOTORCONTROLLER_SERIALERRORS_CRC) stats->crcErrors++;
+	stats->history = (stats->history << 1) | (serialErrors != 0 ? 1 : 0);
+	if (stats->samples < 32)
+		stats->samples++;
+}
+
+void MotorControl::clearLinkStats()
+{
+	int i;
+	for (i=0;i<_numControllers;i++)
+	{
+		memset(&_motors[i].linkStats, 0, sizeof(MotorLinkStats));
+	}
+}
+
+bool MotorControl::clearLinkStats(char devId)
+{
+	MotorController *ptr = getMotor(devId);
+	if (ptr == NULL)
+		return false;
+	memset(&ptr->linkStats, 0, sizeof(MotorLinkStats));
+	return true;
+}
+
+void MotorControl::printLinkStats()
+{
+	int i;
+	MotorLinkStats *stats;
+	const char* modes[] = { "off", "commands", "commands and responses" };
+	CONSOLE.printf("CRC mode: %s\r\n", modes[_crcMode]);
+	CONSOLE.println("Motor\tFrame\tNoise\tOverrun\tFormat\tCRC\tRespCRC\tTimeout\tRecent");
+	for (i=0;i<_numControllers;i++)
+	{
+		stats = &_motors[i].linkStats;
+		CONSOLE.printf("%d\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%d/%d\r\n", _motors[i].deviceId,
+			stats->frameErrors, stats->noiseErrors, stats->rxOverruns, stats->formatErrors,
+			stats->crcErrors, stats->responseCrcErrors, stats->timeouts,
+			bitCount(stats->history), stats->samples);
+	}
 }
 
 MotorControl::MotorControl()
 {
 	_numControllers = 0;
-	_crcEnabled = false;
+	_crcMode = MOTORS_CRC_OFF;
+	_byteMicros = 10000000UL / MC_BAUD; // 10 bits per byte until we've measured it
+	_lastSendMicros = 0;
+	memset(&_groupStats, 0, sizeof(MotorGroupStats));
+	memset(&_request, 0, sizeof(MotorRequest));
+	_historySeconds = 0;
 }
 
 void MotorControl::motorsInitialise(int baudrate)
@@ -99,6 +250,11 @@ void MotorControl::eStopAllMotors()
 	{
 		estopMotor(index);
 	}
+	for (index=0;index<_numControllers;index++)
+	{
+		_motors[index].targetPercent = 0;
+		_motors[index].requestedPercent = 0;
+	}
 	// also pull the ERR line low eventually.  
 }
 
@@ -116,30 +272,38 @@ void MotorControl::safeStartAllMotors()
 
 unsigned int MotorControl::getVariable(char devId, char variableId)
 {
-	char returnedByte1,returnedByte2;
+	unsigned int returnedVariable = 0;
+	readVariable(devId,variableId,&returnedVariable);
+	return returnedVariable;
+}
+
+bool MotorControl::readVariable(char devId, char variableId, unsigned int* value)
+{
 	unsigned char message[4];
-	unsigned int returnedVariable;
-	char returned[2];
+	unsigned char returned[2];
+	finishTelemetry(); // or its reply would be taken for this one
 	message[0] = 0xAA;
 	message[1] = devId;
 	message[2] = 0x21;
 	message[3] = variableId;
 	sendSMCMessage(message,4);
-	if (MC_CTRL_SERIAL.readBytes(returned,2) == 0)
-		return 0; // timed out
-	returnedByte1 = returned[0];
-	returnedByte2 = returned[1];
-	returnedVariable = returnedByte1 | (returnedByte2 << 8);
-	return returnedVariable;
+	if (!readSMCResponse(devId,returned,2))
+	{
+		*value = 0;
+		return false; // timed out or corrupted
+	}
+	*value = returned[0] | (returned[1] << 8);
+	return true;
 }
 
-void MotorControl::setMotor(char devId, bool direction, unsigned long percent)
+void MotorControl::buildMotorMessage(unsigned char* message, char devId, bool direction, unsigned long percent)
 {
-	unsigned char message[5];
 	char bytepercent = (char)(percent & 0xFF);
 	// software limiting of motor speed ! (really should be done on the controllers, but just in case)
 	if (bytepercent > MOTOR_MAX_SPEED)
 		bytepercent = MOTOR_MAX_SPEED;
+	// and slow it down if it's getting hot
+	bytepercent = _thermal.scale(getMotorIndex(devId), bytepercent);
 	message[0] = 0xAA;
 	message[1] = devId;
 
@@ -151,7 +315,104 @@ void MotorControl::setMotor(char devId, bool direction, unsigned long percent)
 	}
 	message[3] = 0x00;
 	message[4] = bytepercent;
+}
+
+void MotorControl::setMotor(char devId, bool direction, unsigned long percent)
+{
+	unsigned char message[5];
+	buildMotorMessage(message,devId,direction,percent);
 	sendSMCMessage(message,5);
+	noteTarget(devId,direction,message[4],percent);
+}
+
+void MotorControl::noteTarget(char devId, bool direction, unsigned int percent, unsigned int requested)
+{
+	// remember what we asked for, and watch a motor closely as soon as it starts moving
+	MotorController *ptr = getMotor(devId);
+	unsigned long soon;
+	if (ptr == NULL)
+		return;
+	if (percent != 0 && ptr->targetPercent == 0)
+	{
+		soon = millis() + MOTORS_POLL_FAST;
+		if ((long)(ptr->telemetryDue[TELEMETRY_ERROR_STATUS] - soon) > 0)
+			ptr->telemetryDue[TELEMETRY_ERROR_STATUS] = soon;
+		if ((long)(ptr->telemetryDue[TELEMETRY_SPEED] - soon) > 0)
+			ptr->telemetryDue[TELEMETRY_SPEED] = soon;
+	}
+	ptr->targetPercent = percent;
+	ptr->requestedPercent = requested;
+	ptr->targetDirection = direction;
+}
+
+void MotorControl::sendMotorGroup(MotorCommand* commands, int count)
+{
+	// Sends a batch of motor commands that are all meant to happen at the same time.
+	// Slowest controllers go first so their latency overlaps the following messages.
+	// The spread is measured: the time between the first and the last message
+	// finishing on the wire.  Speed commands don't get a reply, so when each motor
+	// actually lands can't be; the skew is only an estimate, from when its message
+	// finished plus the latency measured on its telemetry replies.
+	unsigned char message[5];
+	unsigned long landed, firstLanded = 0, lastLanded = 0, firstSent = 0;
+	unsigned long latencies[MOTORS_GROUP_MAX];
+	MotorController *ptr;
+	MotorCommand swap;
+	unsigned long swapLatency;
+	int i, j;
+	if (count <= 0)
+		return;
+	if (count > MOTORS_GROUP_MAX)
+		count = MOTORS_GROUP_MAX;
+	for (i=0;i<count;i++)
+	{
+		ptr = getMotor(commands[i].deviceId);
+		latencies[i] = (ptr == NULL) ? 0 : ptr->latency;
+	}
+	// insertion sort, groups are only ever a handful of motors
+	for (i=1;i<count;i++)
+	{
+		for (j=i;j>0 && latencies[j-1] < latencies[j];j--)
+		{
+			swap = commands[j]; commands[j] = commands[j-1]; commands[j-1] = swap;
+			swapLatency = latencies[j]; latencies[j] = latencies[j-1]; latencies[j-1] = swapLatency;
+		}
+	}
+	for (i=0;i<count;i++)
+	{
+		buildMotorMessage(message,commands[i].deviceId,commands[i].direction,commands[i].percent);
+		sendSMCMessage(message,5);
+		noteTarget(commands[i].deviceId,commands[i].direction,message[4],commands[i].percent);
+		if (i == 0)
+			firstSent = _lastSendMicros;
+		landed = _lastSendMicros + latencies[i];
+		if (i == 0 || (long)(landed - firstLanded) < 0)
+			firstLanded = landed;
+		if (i == 0 || (long)(landed - lastLanded) > 0)
+			lastLanded = landed;
+	}
+	_groupStats.groups++;
+	_groupStats.lastSize = count;
+	_groupStats.lastSpread = _lastSendMicros - firstSent;
+	if (_groupStats.lastSpread > _groupStats.maxSpread)
+		_groupStats.maxSpread = _groupStats.lastSpread;
+	_groupStats.lastSkew = lastLanded - firstLanded;
+	if (_groupStats.lastSkew > _groupStats.maxSkew)
+		_groupStats.maxSkew = _groupStats.lastSkew;
+}
+
+void MotorControl::printGroupStats()
+{
+	int i;
+	CONSOLE.printf("Motor groups sent: %lu\r\n", _groupStats.groups);
+	CONSOLE.printf("Last group: %d motors, %lu us spread (measured), ~%lu us skew (estimated)\r\n",
+		_groupStats.lastSize, _groupStats.lastSpread, _groupStats.lastSkew);
+	CONSOLE.printf("Worst: %lu us spread, ~%lu us skew\r\n", _groupStats.maxSpread, _groupStats.maxSkew);
+	CONSOLE.printf("Transmit time: %lu us per byte\r\n", _byteMicros);
+	for (i=0;i<_numControllers;i++)
+	{
+		CONSOLE.printf("Motor %d latency: %lu us\r\n", _motors[i].deviceId, _motors[i].latency);
+	}
 }
 
 void MotorControl::brakeMotor(char devId,char brakeAmount)
@@ -166,34 +427,131 @@ void MotorControl::brakeMotor(char devId,char brakeAmount)
 	sendSMCMessage(message,4);
 }
 
-void MotorControl::updateFirmwareVersion(MotorController* controller)
+bool MotorControl::updateFirmwareVersion(MotorController* controller)
 {
-	char prodId1,prodId2;
 	unsigned char message[3];
-	char returned[4];
+	unsigned char returned[4];
+	finishTelemetry();
 	message[0] = 0xAA;
 	message[1] = controller->deviceId;
 	message[2] = 0x42;
 	sendSMCMessage(message,3);
-	if (MC_CTRL_SERIAL.readBytes(returned,4) == 0)
-		return; // timed out
+	if (!readSMCResponse(controller->deviceId,returned,4))
+		return false; // timed out or corrupted
+	parseFirmware(controller, returned);
+	return true;
+}
+
+void MotorControl::parseFirmware(MotorController* controller, unsigned char* returned)
+{
+	unsigned char prodId1,prodId2;
 	prodId1 = returned[0];
 	prodId2 = returned[1];
 	controller->firmwareRevision.productId = (prodId1) | (prodId2 << 8);
-	controller->firmwareRevision.minorFwVersion = returned[3];
-	controller->firmwareRevision.majorFwVersion = returned[4];
+	controller->firmwareRevision.minorFwVersion = returned[2];
+	controller->firmwareRevision.majorFwVersion = returned[3];
 }
 
 bool MotorControl::addMotor(char devId)
 {
-	MotorController *ptr = &_motors[_numControllers++];
+	if (!registerMotor(devId))
+		return false;
+	refreshMotor(devId);
+	//brakeMotor(devId,37);	
+	return true;
+}
+
+bool MotorControl::registerMotor(char devId)
+{
+	// add a motor to the list without talking to it beyond clearing safe start,
+	// the full telemetry read is left to refreshAllMotors()
+	MotorController *ptr;
+	if (getMotor(devId) != NULL)
+		return true; // already know about this one
+	if (_numControllers >= MOTORS_MAX_DEVICES)
+		return false;
+	_history[_numControllers].clear();
+	ptr = &_motors[_numControllers++];
+	memset(ptr, 0, sizeof(MotorController));
 	ptr->deviceId = devId;
-	refreshMotor(ptr);
+	ptr->refreshPending = true;
+	ptr->online = true; // it has just answered a probe, telemetry starts straight away
 	disableSafeStart(devId);
-	//brakeMotor(devId,37);	
 	return true;
 }
 
+int MotorControl::numMotors()
+{
+	return _numControllers;
+}
+
+MotorController* MotorControl::getMotorAt(int index)
+{
+	// 0 to numMotors()-1, in the order they were found
+	if (index < 0 || index >= _numControllers)
+		return NULL;
+	return &_motors[index];
+}
+
+int MotorControl::getTargets(MotorCommand* commands, int max)
+{
+	// what every motor was last told to do, before any derating
+	int i;
+	for (i=0;i<_numControllers && i<max;i++)
+	{
+		commands[i].deviceId = _motors[i].deviceId;
+		commands[i].direction = _motors[i].targetDirection;
+		commands[i].percent = _motors[i].requestedPercent;
+	}
+	return i;
+}
+
+void MotorControl::thermalTick(int enclosureTemperature, bool command)
+{
+	// update the derating from the latest temperatures (0.1 deg C), and if command is set
+	// re-send any moving motor whose allowed speed has changed since it was last told
+	MotorController *ptr;
+	int i;
+	_thermal.update(THERMAL_ENCLOSURE, enclosureTemperature, 0);
+	for (i=0;i<_numControllers;i++)
+	{
+		ptr = &_motors[i];
+		if (ptr->online)
+			_thermal.update(i, ptr->temperature, ptr->deviceId);
+	}
+	if (!command)
+		return;
+	for (i=0;i<_numControllers;i++)
+	{
+		ptr = &_motors[i];
+		if (ptr->requestedPercent == 0)
+			continue;
+		if (_thermal.scale(i, ptr->requestedPercent > MOTOR_MAX_SPEED ? MOTOR_MAX_SPEED : ptr->requestedPercent) != ptr->targetPercent)
+			setMotor(ptr->deviceId, ptr->targetDirection, ptr->requestedPercent);
+	}
+}
+
+void MotorControl::setThermalLimits(bool enclosure, int start, int limit)
+{
+	_thermal.setLimits(enclosure, start, limit);
+}
+
+void MotorControl::printThermal()
+{
+	_thermal.print();
+}
+
+int MotorControl::getMotorIndex(char devId)
+{
+	int index;
+	for (index=0;index<_numControllers;index++)
+	{
+		if (_motors[index].deviceId == devId)
+			return index;
+	}
+	return -1;
+}
+
 MotorController* MotorControl::getMotor(char devId)
 {
 	MotorController *ptr = NULL;
@@ -209,39 +567,148 @@ MotorController* MotorControl::getMotor(char devId)
 }
 
 bool MotorControl::pollMotor(char motorId)
+{
+	return pollMotor(motorId, 100);
+}
+
+bool MotorControl::pollMotor(char motorId, unsigned long timeout)
 {
 	//a very basic check to see if a motor is present with a given ID
 	unsigned char message[3];
 	unsigned char returned[4];
+	bool answered;
 	message[0] = 0xAA;
 	message[1] = motorId;
 	message[2] = 0x42;
-	MC_CTRL_SERIAL.setTimeout(100);
+	finishTelemetry();
+	MC_CTRL_SERIAL.setTimeout(timeout);
 	sendSMCMessage(message,3);
-	if (MC_CTRL_SERIAL.readBytes(returned,4) == 0)
-		return false; // timed out
-	return true; // something came back!
+	answered = readSMCResponse(motorId,returned,4);
+	MC_CTRL_SERIAL.setTimeout(100);
+	return answered; // something came back!
 	
 }
 
-void MotorControl::refreshMotor(MotorController* controller)
+int MotorControl::sweepMotors(char firstId, char lastId)
 {
-	MotorController *ptr = controller;
-	unsigned int uptime1,uptime2,errorStatus,limitStatus,serialErrors;
-	// first see if the motor responds at all, otherwise bail.
-	if (!pollMotor(ptr->deviceId))
-		return;
-	updateFirmwareVersion(ptr);
-	ptr->speed = getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_SPEED); 
-	ptr->brakeAmount = getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_BRAKEAMT);
-	ptr->inputVoltage = getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_VIN);
-	ptr->temperature = getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_TEMP);
-	ptr->baudRate = getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_BAUDRATE);
-	uptime1 = getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_UPTIME1);
-	uptime2 = getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_UPTIME2);
-	ptr->systemTime = uptime1 | (uptime2 << 16);
+	// Pipelined sweep of the device number space.  Each probe is a 4 byte
+	// "get variable" which gets a 2 byte reply, so the reply from one device
+	// has usually finished on the line before the next device has even received its
+	// request - we can send probes back to back and sort the replies out by
+	// when they arrived.  A controller that's slow to answer gets its reply
+	// counted against the next probe instead, so anything that looks like it
+	// answered is confirmed with a normal (short timeout) poll, and so is the
+	// number probed just before it.
+	unsigned char message[4];
+	bool answered[256];
+	int id, lastSent, found = 0;
 	
-	errorStatus = getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_ERROR_STATUS);
+	memset(answered, 0, sizeof(answered));
+	finishTelemetry();
+	MC_CTRL_SERIAL.clear();
+	lastSent = -1;
+	for (id = firstId; id <= lastId + 1; id++)
+	{
+		if (id <= lastId)
+		{
+			message[0] = 0xAA;
+			message[1] = id;
+			message[2] = 0x21;
+			message[3] = MOTORCONTROLLER_VAR_ERROR_STATUS;
+			sendSMCMessage(message, 4); // returns once the probe has left the UART
+		} else {
+			delay(MOTORS_PROBE_TIMEOUT); // let the last reply come in
+		}
+		// whatever arrived while this probe was going out belongs to the previous one
+		if (lastSent >= 0 && MC_CTRL_SERIAL.available() > 0)
+		{
+			answered[lastSent] = true;
+			MC_CTRL_SERIAL.clear();
+		}
+		lastSent = id;
+	}
+	for (id = firstId; id <= lastId; id++)
+	{
+		if (!answered[id] && !(id < lastId && answered[id + 1]))
+			continue;
+		if (pollMotor(id, MOTORS_PROBE_TIMEOUT) && registerMotor(id))
+			found++;
+	}
+	return found;
+}
+
+int MotorControl::discoverMotors()
+{
+	// fast path: if we've seen motors before, just check they're all still there
+	char cached[MOTORS_MAX_DEVICES];
+	int numCached = 0;
+	int i;
+	bool allPresent = true;
+	if (loadMotorCache(cached, &numCached) && numCached > 0)
+	{
+		for (i = 0; i < numCached; i++)
+		{
+			if (!pollMotor(cached[i], MOTORS_PROBE_TIMEOUT))
+			{
+				allPresent = false;
+				break;
+			}
+		}
+		if (allPresent)
+		{
+			for (i = 0; i < numCached; i++)
+			{
+				registerMotor(cached[i]);
+			}
+			return _numControllers;
+		}
+	}
+	// something has changed (or there's no cache) - do a full sweep
+	sweepMotors(MOTORS_DISCOVERY_FIRST_ID, MOTORS_DISCOVERY_LAST_ID);
+	saveMotorCache();
+	return _numControllers;
+}
+
+bool MotorControl::loadMotorCache(char* ids, int* count)
+{
+	SdFile cacheFile;
+	char line[12];
+	char header[12];
+	*count = 0;
+	if (!cacheFile.open(MOTORS_CACHE_FILE, O_READ))
+		return false;
+	cacheFile.fgets(header, sizeof(header));
+	while (cacheFile.fgets(line, sizeof(line)) > 0 && *count < MOTORS_MAX_DEVICES)
+	{
+		ids[(*count)++] = (char) strtol(line, NULL, 10);
+	}
+	cacheFile.close();
+	return true;
+}
+
+bool MotorControl::saveMotorCache()
+{
+	SdFile cacheFile;
+	int i;
+	sd.remove(MOTORS_CACHE_FILE);
+	if (!cacheFile.open(MOTORS_CACHE_FILE, O_RDWR | O_CREAT))
+	{
+		sd.errorPrint("couldn't open motor cache for writing");
+		return false;
+	}
+	cacheFile.print("MOTORS\r\n");
+	for (i = 0; i < _numControllers; i++)
+	{
+		cacheFile.printf("%d\r\n", _motors[i].deviceId);
+	}
+	cacheFile.close();
+	return true;
+}
+
+void MotorControl::parseErrorStatus(MotorController* controller, unsigned int errorStatus)
+{
+	MotorController *ptr = controller;
+	ptr->errorStatus = errorStatus;
 	ptr->statusFlags.safeStartViolation = ((errorStatus & MOTORCONTROLLER_ERRORSTATUS_SAFESTART) > 0);
 	ptr->statusFlags.requiredChannelInvalid = ((errorStatus & MOTORCONTROLLER_ERRORSTATUS_REQCHANINVALID) > 0);
 	ptr->statusFlags.serialError = ((errorStatus & MOTORCONTROLLER_ERRORSTATUS_SERIALERR) > 0);
@@ -252,16 +719,22 @@ void MotorControl::refreshMotor(MotorController* controller)
 	ptr->statusFlags.overTemperature = ((errorStatus & MOTORCONTROLLER_ERRORSTATUS_OVERTEMP) > 0);
 	ptr->statusFlags.motorDriverError = ((errorStatus & MOTORCONTROLLER_ERRORSTATUS_DRIVERERROR) > 0);
 	ptr->statusFlags.errLineHigh = ((errorStatus & MOTORCONTROLLER_ERRORSTATUS_ERRLINE) > 0);
-	
-	serialErrors = getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_ERROR_SERIAL);
+}
+
+void MotorControl::parseSerialErrors(MotorController* controller, unsigned int serialErrors)
+{
+	MotorController *ptr = controller;
 	ptr->statusFlags.serialFrameError = ((serialErrors & MOTORCONTROLLER_SERIALERRORS_FRAME) > 0);
 	ptr->statusFlags.serialNoise = ((serialErrors & MOTORCONTROLLER_SERIALERRORS_NOISE) > 0);
 	ptr->statusFlags.serialRxOverrun = ((serialErrors & MOTORCONTROLLER_SERIALERRORS_RXOVERRUN) > 0);
 	ptr->statusFlags.serialFormatError = ((serialErrors & MOTORCONTROLLER_SERIALERRORS_FORMAT) > 0);
 	ptr->statusFlags.serialCRCError = ((serialErrors & MOTORCONTROLLER_SERIALERRORS_CRC) > 0);
-	
-	ptr->statusFlags.errorsOccurred = getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_ERROR_COUNTS);
-	limitStatus = getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_LIMIT_STATUS);
+	recordSerialErrors(ptr, serialErrors);
+}
+
+void MotorControl::parseLimitStatus(MotorController* controller, unsigned int limitStatus)
+{
+	MotorController *ptr = controller;
 	ptr->statusFlags.safeStartEnabled = ((limitStatus & MOTORCONTROLLER_LIMITSTATUS_SAFESTART) > 0);
 	
 	ptr->statusFlags.overTemperatureLimiting = ((limitStatus & MOTORCONTROLLER_LIMITSTATUS_TEMPERATURE) > 0); 
@@ -273,6 +746,30 @@ void MotorControl::refreshMotor(MotorController* controller)
 	ptr->statusFlags.an1Kill = ((limitStatus & MOTORCONTROLLER_LIMITSTATUS_AN1KILLENGAGED) > 0);
 	ptr->statusFlags.an2Kill = ((limitStatus & MOTORCONTROLLER_LIMITSTATUS_AN2KILLENGAGED) > 0);
 	ptr->statusFlags.usbKill = ((limitStatus & MOTORCONTROLLER_LIMITSTATUS_USBKILLENGAGED) > 0);
+}
+
+void MotorControl::refreshMotor(MotorController* controller)
+{
+	MotorController *ptr = controller;
+	unsigned int uptime1,uptime2;
+	// first see if the motor responds at all, otherwise bail.
+	if (!pollMotor(ptr->deviceId))
+		return;
+	ptr->refreshPending = false;
+	updateFirmwareVersion(ptr);
+	ptr->speed = getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_SPEED); 
+	ptr->brakeAmount = getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_BRAKEAMT);
+	ptr->inputVoltage = getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_VIN);
+	ptr->temperature = getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_TEMP);
+	ptr->baudRate = getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_BAUDRATE);
+	uptime1 = getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_UPTIME1);
+	uptime2 = getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_UPTIME2);
+	ptr->systemTime = uptime1 | (uptime2 << 16);
+	
+	parseErrorStatus(ptr, getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_ERROR_STATUS));
+	parseSerialErrors(ptr, getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_ERROR_SERIAL));
+	ptr->statusFlags.errorsOccurred = getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_ERROR_COUNTS);
+	parseLimitStatus(ptr, getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_LIMIT_STATUS));
 	
 	ptr->statusFlags.resetFlags = getVariable(ptr->deviceId,MOTORCONTROLLER_VAR_RESETFLAGS);
 }
@@ -289,6 +786,256 @@ void MotorControl::refreshAllMotors()
 	}
 }
 
+unsigned long MotorControl::telemetryInterval(MotorController* controller, int item)
+{
+	// how often each variable is worth reading, given what the motor is doing right now
+	bool moving = (controller->targetPercent != 0 || controller->speed != 0);
+	bool hot = (controller->temperature >= MOTORS_THERMAL_WARN || controller->statusFlags.overTemperatureLimiting);
+	switch (item)
+	{
+		case TELEMETRY_ERROR_STATUS:
+		case TELEMETRY_SPEED:
+			return moving ? MOTORS_POLL_FAST : MOTORS_POLL_IDLE;
+		case TELEMETRY_LIMIT_STATUS:
+			return moving ? MOTORS_POLL_MEDIUM : MOTORS_POLL_IDLE;
+		case TELEMETRY_SERIAL_ERRORS:
+			return moving ? MOTORS_POLL_MEDIUM : MOTORS_POLL_SLOW;
+		case TELEMETRY_TEMPERATURE:
+			return hot ? MOTORS_POLL_MEDIUM : MOTORS_POLL_SLOW;
+		case TELEMETRY_VIN:
+		case TELEMETRY_BRAKE:
+			return MOTORS_POLL_SLOW;
+		case TELEMETRY_UPTIME:
+			return MOTORS_POLL_UPTIME;
+		default:
+			return MOTORS_RECONNECT_INTERVAL;
+	}
+}
+
+// what each telemetry item reads off the controller, in order, for MotorTelemetryItem
+const unsigned char TELEMETRY_READS[MOTORS_TELEMETRY_ITEMS][MOTORS_READS_PER_ITEM] = {
+	{ MOTORCONTROLLER_VAR_ERROR_STATUS, MOTORS_READ_NONE, MOTORS_READ_NONE },
+	{ MOTORCONTROLLER_VAR_SPEED, MOTORS_READ_NONE, MOTORS_READ_NONE },
+	{ MOTORCONTROLLER_VAR_LIMIT_STATUS, MOTORS_READ_NONE, MOTORS_READ_NONE },
+	{ MOTORCONTROLLER_VAR_ERROR_SERIAL, MOTORCONTROLLER_VAR_ERROR_COUNTS, MOTORS_READ_NONE },
+	{ MOTORCONTROLLER_VAR_TEMP, MOTORS_READ_NONE, MOTORS_READ_NONE },
+	{ MOTORCONTROLLER_VAR_VIN, MOTORS_READ_NONE, MOTORS_READ_NONE },
+	{ MOTORCONTROLLER_VAR_BRAKEAMT, MOTORS_READ_NONE, MOTORS_READ_NONE },
+	{ MOTORCONTROLLER_VAR_UPTIME1, MOTORCONTROLLER_VAR_UPTIME2, MOTORS_READ_NONE },
+	// things that only change if the controller has been reset or reconfigured; the firmware
+	// read on its own is the reconnection probe for a motor that's gone offline
+	{ MOTORS_READ_FIRMWARE, MOTORCONTROLLER_VAR_BAUDRATE, MOTORCONTROLLER_VAR_RESETFLAGS }
+};
+
+void MotorControl::applyRead(MotorController* controller, unsigned char variableId, unsigned char* reply)
+{
+	MotorController *ptr = controller;
+	unsigned int value = reply[0] | (reply[1] << 8);
+	switch (variableId)
+	{
+		case MOTORS_READ_FIRMWARE:
+			parseFirmware(ptr, reply);
+			break;
+		case MOTORCONTROLLER_VAR_ERROR_STATUS:
+			parseErrorStatus(ptr, value);
+			break;
+		case MOTORCONTROLLER_VAR_SPEED:
+			ptr->speed = value;
+			break;
+		case MOTORCONTROLLER_VAR_LIMIT_STATUS:
+			parseLimitStatus(ptr, value);
+			break;
+		case MOTORCONTROLLER_VAR_ERROR_SERIAL:
+			parseSerialErrors(ptr, value);
+			break;
+		case MOTORCONTROLLER_VAR_ERROR_COUNTS:
+			ptr->statusFlags.errorsOccurred = value;
+			break;
+		case MOTORCONTROLLER_VAR_TEMP:
+			ptr->temperature = value;
+			break;
+		case MOTORCONTROLLER_VAR_VIN:
+			ptr->inputVoltage = value;
+			break;
+		case MOTORCONTROLLER_VAR_BRAKEAMT:
+			ptr->brakeAmount = value;
+			break;
+		case MOTORCONTROLLER_VAR_UPTIME1:
+			ptr->systemTime = (ptr->systemTime & 0xFFFF0000UL) | value;
+			break;
+		case MOTORCONTROLLER_VAR_UPTIME2:
+			ptr->systemTime = (ptr->systemTime & 0xFFFFUL) | ((unsigned long) value << 16);
+			break;
+		case MOTORCONTROLLER_VAR_BAUDRATE:
+			ptr->baudRate = value;
+			break;
+		case MOTORCONTROLLER_VAR_RESETFLAGS:
+			ptr->statusFlags.resetFlags = value;
+			break;
+	}
+}
+
+void MotorControl::startRead(MotorController* controller, int item, int step)
+{
+	// puts the request in the UART's buffer and goes; telemetryPoll() picks the reply up
+	MotorRequest *req = &_request;
+	unsigned char variableId = TELEMETRY_READS[item][step];
+	unsigned char message[4];
+	int length;
+	message[0] = 0xAA;
+	message[1] = controller->deviceId;
+	if (variableId == MOTORS_READ_FIRMWARE)
+	{
+		message[2] = 0x42;
+		length = 3;
+		req->length = 4;
+	} else {
+		message[2] = 0x21;
+		message[3] = variableId;
+		length = 4;
+		req->length = 2;
+	}
+	if (_crcMode == MOTORS_CRC_FULL)
+		req->length++;
+	MC_CTRL_SERIAL.clear(); // anything still coming in is a late reply to something else
+	// everything else that's sent waits for it to go, so the UART's empty and this goes straight out
+	length = writeSMCMessage(message,length);
+	req->motor = controller;
+	req->item = item;
+	req->step = step;
+	req->received = 0;
+	req->sent = micros() + length * _byteMicros;
+	req->deadline = req->sent + req->length * _byteMicros + MOTORS_REPLY_TIMEOUT * 1000UL;
+}
+
+void MotorControl::telemetryPoll()
+{
+	// Call every time round the loop.  Takes whatever's come in of the reply to the read
+	// telemetryTick() sent, and once it's all there sends the item's next read, if it has one.
+	MotorRequest *req = &_request;
+	MotorController *ptr = req->motor;
+	unsigned long now = micros();
+	unsigned char variableId;
+	int waiting;
+	if (ptr == NULL)
+		return;
+	waiting = MC_CTRL_SERIAL.available();
+	if (req->received == 0 && waiting > 0)
+		req->started = now - waiting * _byteMicros; // near enough, as long as we're round often
+	while (req->received < req->length && MC_CTRL_SERIAL.available() > 0)
+	{
+		req->reply[req->received++] = MC_CTRL_SERIAL.read();
+	}
+	if (req->received < req->length)
+	{
+		if ((long)(now - req->deadline) < 0)
+			return; // still waiting
+		ptr->linkStats.timeouts++;
+		finishRead(false);
+		return;
+	}
+	if (_crcMode == MOTORS_CRC_FULL && req->reply[req->length - 1] != getCRC(req->reply, req->length - 1))
+	{
+		ptr->linkStats.responseCrcErrors++;
+		finishRead(false);
+		return;
+	}
+	// whatever's between the request going and the reply starting is the controller thinking about it
+	if ((long)(req->started - req->sent) > 0)
+		ptr->latency = (ptr->latency * 3 + (req->started - req->sent)) / 4;
+	variableId = TELEMETRY_READS[req->item][req->step];
+	if (ptr->online)
+		applyRead(ptr, variableId, req->reply);
+	if (ptr->online && req->step + 1 < MOTORS_READS_PER_ITEM && TELEMETRY_READS[req->item][req->step + 1] != MOTORS_READ_NONE)
+	{
+		startRead(ptr, req->item, req->step + 1);
+		return;
+	}
+	finishRead(true);
+}
+
+void MotorControl::finishRead(bool answered)
+{
+	MotorController *ptr = _request.motor;
+	unsigned long now = millis();
+	int item;
+	_request.motor = NULL;
+	if (!ptr->online)
+	{
+		if (answered)
+		{
+			// it's back - re-read who it is, and bring everything else up to date straight away
+			ptr->online = true;
+			ptr->missedPolls = 0;
+			ptr->refreshPending = true;
+			for (item=0;item<MOTORS_TELEMETRY_ITEMS;item++)
+			{
+				ptr->telemetryDue[item] = now;
+			}
+		} else {
+			ptr->telemetryDue[TELEMETRY_IDENTITY] = now + MOTORS_RECONNECT_INTERVAL;
+		}
+		return;
+	}
+	if (answered)
+	{
+		ptr->missedPolls = 0;
+		if (_request.item == TELEMETRY_IDENTITY)
+			ptr->refreshPending = false;
+	} else if (++ptr->missedPolls >= MOTORS_OFFLINE_MISSES)
+	{
+		ptr->online = false;
+		ptr->telemetryDue[TELEMETRY_IDENTITY] = now + MOTORS_RECONNECT_INTERVAL;
+	}
+}
+
+void MotorControl::finishTelemetry()
+{
+	// anything that talks to the controllers and waits for a reply has to let a telemetry
+	// read finish first (at worst MOTORS_REPLY_TIMEOUT), or it would take its reply
+	while (_request.motor != NULL)
+	{
+		telemetryPoll();
+	}
+}
+
+void MotorControl::telemetryTick()
+{
+	// Starts at most one telemetry item per call - whichever is most overdue across all of
+	// the motors - and never waits for the reply, telemetryPoll() does that.  Nothing new
+	// starts while a read is still on the wire.
+	unsigned long now = millis();
+	MotorController *ptr, *best = NULL;
+	int i, item, bestItem = 0;
+	long late, bestLate = -1;
+	if (_request.motor != NULL)
+		return;
+	for (i=0;i<_numControllers;i++)
+	{
+		ptr = &_motors[i];
+		for (item=0;item<MOTORS_TELEMETRY_ITEMS;item++)
+		{
+			// an offline motor only gets reconnection attempts, which are scheduled in the identity slot
+			if (!ptr->online && item != TELEMETRY_IDENTITY)
+				continue;
+			if (ptr->online && item == TELEMETRY_IDENTITY && !ptr->refreshPending)
+				continue;
+			late = (long)(now - ptr->telemetryDue[item]);
+			if (late > bestLate)
+			{
+				best = ptr;
+				bestItem = item;
+				bestLate = late;
+			}
+		}
+	}
+	if (best == NULL)
+		return; // nothing due yet
+	if (best->online)
+		best->telemetryDue[bestItem] = now + telemetryInterval(best, bestItem);
+	startRead(best, bestItem, 0);
+}
+
 void MotorControl::refreshMotor(char devId)
 {
 	MotorController *ptr = getMotor(devId);
@@ -297,72 +1044,137 @@ void MotorControl::refreshMotor(char devId)
 	refreshMotor(ptr);
 }
 
+void MotorControl::historyTick()
+{
+	// call this once a second; samples whatever telemetry we have every HISTORY_FINE_INTERVAL
+	HistorySample sample;
+	MotorController *ptr;
+	int i;
+	if (++_historySeconds < HISTORY_FINE_INTERVAL)
+		return;
+	_historySeconds = 0;
+	for (i=0;i<_numControllers;i++)
+	{
+		ptr = &_motors[i];
+		sample.temperature = (int16_t) ptr->temperature;
+		sample.inputVoltage = (uint16_t) ptr->inputVoltage;
+		sample.speed = (int16_t) ptr->speed;
+		sample.errors = ptr->errorStatus & 0x3FF;
+		if (ptr->linkStats.history & 1)
+			sample.errors |= HISTORY_ERROR_SERIAL;
+		if (ptr->statusFlags.overTemperatureLimiting)
+			sample.errors |= HISTORY_ERROR_TEMPLIMIT;
+		if (!ptr->online)
+			sample.errors |= HISTORY_ERROR_OFFLINE;
+		_history[i].add(&sample);
+	}
+}
+
+void MotorControl::printHistory(char devId, bool coarse, HistoryListing* listing)
+{
+	// Compact dump, oldest first: a header line, then one line per sample of four 16 bit
+	// hex words - temperature (0.1 deg C), Vin (mV), speed, error bits.
+	int index = getMotorIndex(devId);
+	if (index < 0)
+	{
+		CONSOLE.println("Motor not been initialised!");
+		return;
+	}
+	listing->motors = this;
+	listing->index = index;
+	listing->coarse = coarse;
+	listing->samples = _history[index].count(coarse);
+	listing->next = _history[index].total(coarse) - listing->samples;
+	CONSOLE.printf("HIST %d %c %d %d\r\n", devId, coarse ? 'C' : 'F',
+		coarse ? HISTORY_COARSE_INTERVAL : HISTORY_FINE_INTERVAL, listing->samples);
+	CONSOLE.generate(historyLine, listing);
+}
+
+bool MotorControl::historyLine(void* context, unsigned int* cursor)
+{
+	HistoryListing *listing = (HistoryListing*) context;
+	MotorHistory *history = &listing->motors->_history[listing->index];
+	HistorySample sample;
+	// samples keep going in while it's listed, so work out how old the next one is now
+	long age = (long) (history->total(listing->coarse) - 1 - listing->next);
+	if (age >= history->count(listing->coarse))
+		age = history->count(listing->coarse) - 1; // it's been pushed out, carry on from the oldest
+	if ((int) *cursor >= listing->samples || !history->get(listing->coarse, age, &sample))
+		return false;
+	CONSOLE.printf("%04x%04x%04x%04x\r\n", (uint16_t) sample.temperature, sample.inputVoltage,
+		(uint16_t) sample.speed, sample.errors);
+	listing->next = history->total(listing->coarse) - age;
+	(*cursor)++;
+	return true;
+}
+
 void MotorControl::printMotor(char devId)
 {
 	MotorController* ptr = getMotor(devId);
-	CTRL_SERIAL.printf("Motor %d\n",devId);
+	CONSOLE.printf("Motor %d\n",devId);
 	if (ptr == NULL)
 	{
-		CTRL_SERIAL.println("Motor not been initialised!");
+		CONSOLE.println("Motor not been initialised!");
 		return;
 	}
-	CTRL_SERIAL.printf("ProductID: \t\t%d\r\n", ptr->firmwareRevision.productId);
-	CTRL_SERIAL.printf("FW Version: \t%d.%02d\r\n", ptr->firmwareRevision.majorFwVersion, ptr->firmwareRevision.minorFwVersion);
-	CTRL_SERIAL.printf("Speed: \t\t%d\r\n", ptr->speed);
-	CTRL_SERIAL.printf("Voltage: \t\t%.2f V\r\n", ((float) ptr->inputVoltage)/1000.0);
-	CTRL_SERIAL.printf("Temperature: \t\t%.2f deg C\r\n", ((float) ptr->temperature)/10.0);
-	CTRL_SERIAL.printf("Baud rate:\t\t %d\r\n",ptr->baudRate);
-	CTRL_SERIAL.print("System Uptime: \t\tJ99");
+	CONSOLE.printf("Online: \t\t%s\r\n", ptr->online ? "yes" : "no");
+	CONSOLE.printf("ProductID: \t\t%d\r\n", ptr->firmwareRevision.productId);
+	CONSOLE.printf("FW Version: \t%d.%02d\r\n", ptr->firmwareRevision.majorFwVersion, ptr->firmwareRevision.minorFwVersion);
+	CONSOLE.printf("Speed: \t\t%d\r\n", ptr->speed);
+	CONSOLE.printf("Voltage: \t\t%.2f V\r\n", ((float) ptr->inputVoltage)/1000.0);
+	CONSOLE.printf("Temperature: \t\t%.2f deg C\r\n", ((float) ptr->temperature)/10.0);
+	CONSOLE.printf("Baud rate:\t\t %d\r\n",ptr->baudRate);
+	CONSOLE.print("System Uptime: \t\tJ99");
 	printTimeFromMs(ptr->systemTime);
-	CTRL_SERIAL.println();
+	CONSOLE.println();
 	
-	CTRL_SERIAL.println("Status flags active:");
+	CONSOLE.println("Status flags active:");
 	if( ptr->statusFlags.safeStartViolation) 
-		CTRL_SERIAL.println("Safe safe start violation");
-
-	if (ptr->statusFlags.requiredChannelInvalid) CTRL_SERIAL.println("Required Channel Invalid");		//• Bit 1: Required Channel Invalid
-	if (ptr->statusFlags.serialError) CTRL_SERIAL.println("Required Channel Invalid"); 					// Bit 2: Serial Error
-	if (ptr->statusFlags.commandTimeout) CTRL_SERIAL.println("Command Timeout"); 				//• Bit 3: Command Timeout
-	if (ptr->statusFlags.killSwitch) CTRL_SERIAL.println("Kill Switch Enabled");					//• Bit 4: Limit/Kill Switch
-	if (ptr->statusFlags.lowVin) CTRL_SERIAL.println("Vin Low"); 						//• Bit 5: Low VIN
-	if (ptr->statusFlags.highVin) CTRL_SERIAL.println("Vin High"); 						//• Bit 6: High VIN
-	if (ptr->statusFlags.overTemperature) CTRL_SERIAL.println("Over temperature");				//• Bit 7: Over Temperature
-	if (ptr->statusFlags.motorDriverError) CTRL_SERIAL.println("Motor Driver Error"); 				//• Bit 8: Motor Driver Error
-	if (ptr->statusFlags.errLineHigh) CTRL_SERIAL.println("Error Line high");					//• Bit 9: ERR Line High	
-
-	if (ptr->statusFlags.serialFrameError) CTRL_SERIAL.println("Serial Frame Error"); 				//• Bit 1: Frame
-	if (ptr->statusFlags.serialNoise) CTRL_SERIAL.println("Serial noise errors"); 					// • Bit 2: Noise
-	if (ptr->statusFlags.serialRxOverrun) CTRL_SERIAL.println("Serial RX Overrun"); 				//• Bit 3: RX Overrun
-	if (ptr->statusFlags.serialFormatError) CTRL_SERIAL.println("Serial Format Error"); 			//• Bit 4: Format
-	if (ptr->statusFlags.serialCRCError) CTRL_SERIAL.println("Serial CRC error"); 				//• Bit 5: CRC
-	if (ptr->statusFlags.safeStartEnabled) CTRL_SERIAL.println("Motor cannot run - safe start enabled"); 				// • Bit 0: Motor is not allowed to run due to an error or safe-start violation.
-	if (ptr->statusFlags.overTemperatureLimiting) CTRL_SERIAL.println("Over temperature limiting speed"); 		//• Bit 1: Temperature is active reducing target speed.
-	if (ptr->statusFlags.speedLimitLimiting) CTRL_SERIAL.println("Speed Limiting engaged"); 			//• Bit 2: Max speed limit is actively reducing target speed (target speed > max speed).
-	if (ptr->statusFlags.startingSpeedLimitLimiting) CTRL_SERIAL.println("Starting speed limit engaged"); 	//• Bit 3: Starting speed limit is actively reducing target speed to zero (target speed < starting speed).
-	if (ptr->statusFlags.accelerationLimiting) CTRL_SERIAL.println("Acceleration limiting engaged"); 			//• Bit 4: Motor speed is not equal to target speed because of acceleration, deceleration, or
+		CONSOLE.println("Safe safe start violation");
+
+	if (ptr->statusFlags.requiredChannelInvalid) CONSOLE.println("Required Channel Invalid");		//• Bit 1: Required Channel Invalid
+	if (ptr->statusFlags.serialError) CONSOLE.println("Required Channel Invalid"); 					// Bit 2: Serial Error
+	if (ptr->statusFlags.commandTimeout) CONSOLE.println("Command Timeout"); 				//• Bit 3: Command Timeout
+	if (ptr->statusFlags.killSwitch) CONSOLE.println("Kill Switch Enabled");					//• Bit 4: Limit/Kill Switch
+	if (ptr->statusFlags.lowVin) CONSOLE.println("Vin Low"); 						//• Bit 5: Low VIN
+	if (ptr->statusFlags.highVin) CONSOLE.println("Vin High"); 						//• Bit 6: High VIN
+	if (ptr->statusFlags.overTemperature) CONSOLE.println("Over temperature");				//• Bit 7: Over Temperature
+	if (ptr->statusFlags.motorDriverError) CONSOLE.println("Motor Driver Error"); 				//• Bit 8: Motor Driver Error
+	if (ptr->statusFlags.errLineHigh) CONSOLE.println("Error Line high");					//• Bit 9: ERR Line High	
+
+	if (ptr->statusFlags.serialFrameError) CONSOLE.println("Serial Frame Error"); 				//• Bit 1: Frame
+	if (ptr->statusFlags.serialNoise) CONSOLE.println("Serial noise errors"); 					// • Bit 2: Noise
+	if (ptr->statusFlags.serialRxOverrun) CONSOLE.println("Serial RX Overrun"); 				//• Bit 3: RX Overrun
+	if (ptr->statusFlags.serialFormatError) CONSOLE.println("Serial Format Error"); 			//• Bit 4: Format
+	if (ptr->statusFlags.serialCRCError) CONSOLE.println("Serial CRC error"); 				//• Bit 5: CRC
+	if (ptr->statusFlags.safeStartEnabled) CONSOLE.println("Motor cannot run - safe start enabled"); 				// • Bit 0: Motor is not allowed to run due to an error or safe-start violation.
+	if (ptr->statusFlags.overTemperatureLimiting) CONSOLE.println("Over temperature limiting speed"); 		//• Bit 1: Temperature is active reducing target speed.
+	if (ptr->statusFlags.speedLimitLimiting) CONSOLE.println("Speed Limiting engaged"); 			//• Bit 2: Max speed limit is actively reducing target speed (target speed > max speed).
+	if (ptr->statusFlags.startingSpeedLimitLimiting) CONSOLE.println("Starting speed limit engaged"); 	//• Bit 3: Starting speed limit is actively reducing target speed to zero (target speed < starting speed).
+	if (ptr->statusFlags.accelerationLimiting) CONSOLE.println("Acceleration limiting engaged"); 			//• Bit 4: Motor speed is not equal to target speed because of acceleration, deceleration, or
 	//brake duration limits.
-	if (ptr->statusFlags.rc1Kill) CTRL_SERIAL.println("RC1 Killswitch Enabled"); //• Bit 5: RC1 is configured as a limit/kill switch and the switch is active (scaled value ≥1600).
-	if (ptr->statusFlags.rc2Kill) CTRL_SERIAL.println("RC2 Killswitch Enabled"); //• Bit 6: RC2 limit/kill switch is active (scaled value ≥ 1600).
-	if (ptr->statusFlags.an1Kill) CTRL_SERIAL.println("AN1 Killswitch Enabled"); //• Bit 7: AN1 limit/kill switch is active (scaled value ≥ 1600).
-	if (ptr->statusFlags.an2Kill) CTRL_SERIAL.println("AN2 Killswitch Enabled"); //• Bit 8: AN2 limit/kill switch is active (scaled value ≥ 1600).
-	if (ptr->statusFlags.usbKill) CTRL_SERIAL.println("USB Killswitch Enabled"); //• Bit 9: USB kill switch is active.*/
-	CTRL_SERIAL.print("Last reset reason: ");
+	if (ptr->statusFlags.rc1Kill) CONSOLE.println("RC1 Killswitch Enabled"); //• Bit 5: RC1 is configured as a limit/kill switch and the switch is active (scaled value ≥1600).
+	if (ptr->statusFlags.rc2Kill) CONSOLE.println("RC2 Killswitch Enabled"); //• Bit 6: RC2 limit/kill switch is active (scaled value ≥ 1600).
+	if (ptr->statusFlags.an1Kill) CONSOLE.println("AN1 Killswitch Enabled"); //• Bit 7: AN1 limit/kill switch is active (scaled value ≥ 1600).
+	if (ptr->statusFlags.an2Kill) CONSOLE.println("AN2 Killswitch Enabled"); //• Bit 8: AN2 limit/kill switch is active (scaled value ≥ 1600).
+	if (ptr->statusFlags.usbKill) CONSOLE.println("USB Killswitch Enabled"); //• Bit 9: USB kill switch is active.*/
+	CONSOLE.print("Last reset reason: ");
 	switch(ptr->statusFlags.resetFlags)
 	{
 		case MOTORCONTROLLER_RESETFLAGS_RST:
-			CTRL_SERIAL.println("RST line pulled low");
+			CONSOLE.println("RST line pulled low");
 			break;
 		case MOTORCONTROLLER_RESETFLAGS_POWER:
-			CTRL_SERIAL.println("Power on reset");
+			CONSOLE.println("Power on reset");
 			break;
 		case MOTORCONTROLLER_RESETFLAGS_SOFTWARE:
-			CTRL_SERIAL.println("Software controlled reset");
+			CONSOLE.println("Software controlled reset");
 			break;
 		case MOTORCONTROLLER_RESETFLAGS_WATCHDOG:
-			CTRL_SERIAL.println("Watchdog timer reset");
+			CONSOLE.println("Watchdog timer reset");
 			break;
 		default:
-			CTRL_SERIAL.printf(" unknown: %0x\n",ptr->statusFlags.resetFlags);
+			CONSOLE.printf(" unknown: %0x\n",ptr->statusFlags.resetFlags);
 	}
 }
 
@@ -13,9 +13,35 @@
 #else
 #include "WProgram.h"
 #endif
+#include "MotorHistory.h"
+#include "ThermalGovernor.h"
 
 #define MOTORS_MAX_DEVICES 12
 
+// auto-discovery: range of device numbers swept, and how long to wait for a probe reply.
+// That's every number the Pololu protocol allows; a probe is 4 bytes on the wire (~4ms at
+// 9600 baud), so a sweep takes ~550ms, plus ~10ms for each probe that needs confirming.  It
+// only happens at boot when a cached motor's gone missing, or on DISCOVER.
+#define MOTORS_DISCOVERY_FIRST_ID 0
+#define MOTORS_DISCOVERY_LAST_ID 127
+#define MOTORS_PROBE_TIMEOUT 10
+#define MOTORS_CACHE_FILE "MOTORS.DAT"
+
+// telemetry polling intervals (ms) - see MotorControl::telemetryInterval()
+#define MOTORS_TELEMETRY_TICK 10		// how often telemetryTick() should be called (telemetryPoll() every loop)
+#define MOTORS_REPLY_TIMEOUT 10			// ms to wait for a telemetry reply to start, after the request's gone
+#define MOTORS_POLL_FAST 500			// error status and speed of a moving motor
+#define MOTORS_POLL_MEDIUM 1000			// limit status/serial errors while moving, temperature when hot
+#define MOTORS_POLL_IDLE 3000			// error status, speed and limit status of an idle motor
+#define MOTORS_POLL_SLOW 5000			// temperature, Vin, brake amount
+#define MOTORS_POLL_UPTIME 60000
+#define MOTORS_RECONNECT_INTERVAL 2000	// how often to look for a motor which has stopped answering
+#define MOTORS_OFFLINE_MISSES 3			// unanswered reads before a motor is treated as offline
+#define MOTORS_THERMAL_WARN (THERMAL_MOTOR_START - 50)	// 0.1 deg C - poll temperature faster above this, ahead of derating
+
+// most motor commands that can be sent as one synchronised group
+#define MOTORS_GROUP_MAX 16
+
 
 #define MOTORCONTROLLER_VAR_SPEED 21
 #define MOTORCONTROLLER_VAR_BRAKEAMT 22
@@ -65,6 +91,24 @@
 
 #define MOTORCONTROLLER_VAR_RESETFLAGS				127
 
+// what a telemetry item reads, see TELEMETRY_READS in MotorControl.cpp
+#define MOTORS_READS_PER_ITEM 3
+#define MOTORS_READ_NONE 0xFE
+#define MOTORS_READ_FIRMWARE 0xFF		// the firmware version request, rather than a variable
+
+enum MotorTelemetryItem {
+	TELEMETRY_ERROR_STATUS,
+	TELEMETRY_SPEED,
+	TELEMETRY_LIMIT_STATUS,
+	TELEMETRY_SERIAL_ERRORS,
+	TELEMETRY_TEMPERATURE,
+	TELEMETRY_VIN,
+	TELEMETRY_BRAKE,
+	TELEMETRY_UPTIME,
+	TELEMETRY_IDENTITY,					// firmware, baud rate and reset flags - only read on (re)connect
+	MOTORS_TELEMETRY_ITEMS
+};
+
 typedef struct _motorFirmware {
 	int productId;
 	char minorFwVersion;
@@ -102,18 +146,84 @@ typedef struct _motorStatusFlags {
 	unsigned int resetFlags;
 } MotorControllerStatusFlags;
 
+typedef enum _crcMode {
+	MOTORS_CRC_OFF,						// no CRC bytes at all
+	MOTORS_CRC_COMMANDS,				// CRC appended to commands we send
+	MOTORS_CRC_FULL						// CRC on commands, and checked on responses
+} MotorCrcMode;
+
+typedef struct _motorLinkStats {
+	unsigned int frameErrors;			// counts of each error reported in MOTORCONTROLLER_VAR_ERROR_SERIAL
+	unsigned int noiseErrors;
+	unsigned int rxOverruns;
+	unsigned int formatErrors;
+	unsigned int crcErrors;
+	unsigned int responseCrcErrors;		// responses which failed our own CRC check
+	unsigned int timeouts;				// requests that got no (or a short) response
+	unsigned long history;				// one bit per serial error poll, newest in bit 0, set if any error was reported
+	unsigned char samples;				// number of valid bits in history
+} MotorLinkStats;
+
 typedef struct _motor {
 	MotorControllerFirmware firmwareRevision;
 	char deviceId;
 	MotorControllerStatusFlags statusFlags;
+	unsigned int errorStatus;			// raw MOTORCONTROLLER_VAR_ERROR_STATUS, as unpacked into statusFlags
 	unsigned int speed;
 	unsigned int brakeAmount;
 	unsigned int inputVoltage;
 	unsigned int temperature;
 	unsigned int baudRate;
 	unsigned long systemTime;
+	bool refreshPending;				// identity (firmware, baud rate, reset flags) still to be read, by telemetryTick()
+	bool online;
+	unsigned char missedPolls;
+	unsigned long telemetryDue[MOTORS_TELEMETRY_ITEMS];	// millis() each item is next due to be read
+	unsigned int targetPercent;			// last speed we commanded, after derating
+	unsigned int requestedPercent;		// what the cues asked for
+	bool targetDirection;
+	MotorLinkStats linkStats;
+	unsigned long latency;				// smoothed time (us) between a request finishing and the reply starting
 } MotorController;
 
+typedef struct _motorRequest {
+	MotorController *motor;			// telemetry read on the wire, NULL for none
+	int item;
+	int step;							// which of the item's reads
+	unsigned char reply[5];				// biggest is the firmware version and its CRC
+	int length;							// bytes expected, CRC and all
+	int received;
+	unsigned long sent;					// micros() the request should have finished going out
+	unsigned long started;				// micros() the reply looked to have started, once it has
+	unsigned long deadline;				// micros()
+} MotorRequest;
+
+typedef struct _motorCommand {
+	char deviceId;
+	bool direction;
+	unsigned long percent;
+} MotorCommand;
+
+typedef struct _motorGroupStats {
+	unsigned long groups;
+	int lastSize;
+	unsigned long lastSpread;			// us between the first and last command finishing sending, measured
+	unsigned long maxSpread;
+	unsigned long lastSkew;				// us between the first and last motor landing - estimated, see sendMotorGroup()
+	unsigned long maxSkew;
+} MotorGroupStats;
+
+
+class MotorControl;
+
+// a HISTORY listing part way through, one for each console session so they can't trip each other up
+typedef struct _historyListing {
+	MotorControl* motors;
+	int index;							// of the motor
+	bool coarse;
+	int samples;						// lines promised in the header
+	unsigned long next;					// MotorHistory::total() as it was when the next sample to list went in
+} HistoryListing;
 
 class MotorControl{
 	public:
@@ -125,23 +235,73 @@ class MotorControl{
 		void estopMotor(char devId);
 		void brakeMotor(char devId,char brakeAmount);
 		unsigned int getVariable(char devId, char variableId);
-		void updateFirmwareVersion(MotorController* controller);
+		bool updateFirmwareVersion(MotorController* controller);
+		bool readVariable(char devId, char variableId, unsigned int* value);
 		bool addMotor(char devId);
 		void refreshMotor(char devId);
 		void refreshMotor(MotorController* controller);
 		void printMotor(char devId);
 		void refreshAllMotors();
+		void telemetryTick();
+		void telemetryPoll();
 		void eStopAllMotors();
 		void safeStartAllMotors();
 		bool pollMotor(char motorId);
+		bool pollMotor(char motorId, unsigned long timeout);
+		bool registerMotor(char devId);
+		int discoverMotors();
+		int sweepMotors(char firstId, char lastId);
+		bool loadMotorCache(char* ids, int* count);
+		bool saveMotorCache();
+		int numMotors();
+		MotorController* getMotorAt(int index);
+		int getTargets(MotorCommand* commands, int max);
+		void setCrcMode(MotorCrcMode mode);
+		MotorCrcMode getCrcMode();
+		void printLinkStats();
+		void clearLinkStats();
+		bool clearLinkStats(char devId);
+		void sendMotorGroup(MotorCommand* commands, int count);
+		unsigned long getMessageMicros(int length);
+		void printGroupStats();
+		void historyTick();
+		void printHistory(char devId, bool coarse, HistoryListing* listing);
+		void thermalTick(int enclosureTemperature, bool command);
+		void setThermalLimits(bool enclosure, int start, int limit);
+		void printThermal();
 	private:
 		MotorController _motors[MOTORS_MAX_DEVICES];
 		int _numControllers;
-		bool _crcEnabled;
+		MotorCrcMode _crcMode;
+		unsigned long _byteMicros;
+		unsigned long _lastSendMicros;
+		MotorGroupStats _groupStats;
+		MotorRequest _request;
+		MotorHistory _history[MOTORS_MAX_DEVICES];
+		int _historySeconds;
+		static bool historyLine(void* context, unsigned int* cursor);
+		ThermalGovernor _thermal;
+		int getMotorIndex(char devId);
+		void buildMotorMessage(unsigned char* message, char devId, bool direction, unsigned long percent);
+		void noteTarget(char devId, bool direction, unsigned int percent, unsigned int requested);
+		void parseErrorStatus(MotorController* controller, unsigned int errorStatus);
+		void parseSerialErrors(MotorController* controller, unsigned int serialErrors);
+		void parseLimitStatus(MotorController* controller, unsigned int limitStatus);
+		unsigned long telemetryInterval(MotorController* controller, int item);
+		void startRead(MotorController* controller, int item, int step);
+		void finishRead(bool answered);
+		void applyRead(MotorController* controller, unsigned char variableId, unsigned char* reply);
+		void finishTelemetry();
+		void parseFirmware(MotorController* controller, unsigned char* returned);
+		int writeSMCMessage(unsigned char* message, int length);
 		void sendSMCMessage(unsigned char* message, int length);
+		bool readSMCResponse(char devId, unsigned char* response, int length);
+		void recordSerialErrors(MotorController* controller, unsigned int serialErrors);
 };
 
 
+static_assert(THERMAL_MOTOR_ZONES == MOTORS_MAX_DEVICES, "need a thermal zone for every motor");
+static_assert(sizeof(MotorHistory) * MOTORS_MAX_DEVICES <= HISTORY_RAM_BUDGET, "motor history doesn't fit in HISTORY_RAM_BUDGET");
 
 #endif
 
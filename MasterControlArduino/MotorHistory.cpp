@@ -0,0 +1,118 @@
+/*
+
+	MotorHistory.cpp
+	
+	Keeps a rolling history of a motor's telemetry, so there's something to look at after a fault
+	
+*/
+#include "MotorHistory.h"
+#include "SystemConfig.h"
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+MotorHistory::MotorHistory()
+{
+	clear();
+}
+
+void MotorHistory::clear()
+{
+	_fineHead = 0;
+	_fineCount = 0;
+	_coarseHead = 0;
+	_coarseCount = 0;
+	_fineTotal = 0;
+	_coarseTotal = 0;
+	_pendingCount = 0;
+	_speedSum = 0;
+}
+
+bool MotorHistory::add(HistorySample* sample)
+{
+	// true if this one finished off a coarse sample
+	// every fine sample goes straight into the fine ring...
+	pack(sample, &_fine[_fineHead]);
+	_fineHead = (_fineHead + 1) % HISTORY_FINE_SAMPLES;
+	if (_fineCount < HISTORY_FINE_SAMPLES)
+		_fineCount++;
+	_fineTotal++;
+	
+	// ...and is folded into the coarse sample being built
+	if (_pendingCount == 0)
+	{
+		_pending = *sample;
+		_speedSum = 0;
+	} else {
+		if (sample->temperature > _pending.temperature)
+			_pending.temperature = sample->temperature;
+		if (sample->inputVoltage < _pending.inputVoltage)
+			_pending.inputVoltage = sample->inputVoltage;
+		_pending.errors |= sample->errors;
+	}
+	_speedSum += sample->speed;
+	_pendingCount++;
+	if (_pendingCount >= HISTORY_COARSE_INTERVAL / HISTORY_FINE_INTERVAL)
+	{
+		_pending.speed = _speedSum / _pendingCount;
+		pack(&_pending, &_coarse[_coarseHead]);
+		_coarseHead = (_coarseHead + 1) % HISTORY_COARSE_SAMPLES;
+		if (_coarseCount < HISTORY_COARSE_SAMPLES)
+			_coarseCount++;
+		_coarseTotal++;
+		_pendingCount = 0;
+		return true;
+	}
+	return false;
+}
+
+int MotorHistory::count(bool coarse)
+{
+	return coarse ? _coarseCount : _fineCount;
+}
+
+unsigned long MotorHistory::total(bool coarse)
+{
+	return coarse ? _coarseTotal : _fineTotal;
+}
+
+bool MotorHistory::get(bool coarse, int age, HistorySample* sample)
+{
+	// age 0 is the newest sample
+	int index;
+	if (age < 0 || age >= count(coarse))
+		return false;
+	if (coarse)
+	{
+		index = (_coarseHead + HISTORY_COARSE_SAMPLES - 1 - age) % HISTORY_COARSE_SAMPLES;
+		unpack(&_coarse[index], sample);
+	} else {
+		index = (_fineHead + HISTORY_FINE_SAMPLES - 1 - age) % HISTORY_FINE_SAMPLES;
+		unpack(&_fine[index], sample);
+	}
+	return true;
+}
+
+void MotorHistory::pack(HistorySample* sample, PackedSample* packed)
+{
+	// rounded the pessimistic way - the hottest temperature up, the lowest Vin down - and
+	// anything out of range sticks at the end of it
+	long temperature = ((long) sample->temperature - HISTORY_TEMP_OFFSET + HISTORY_TEMP_STEP - 1) / HISTORY_TEMP_STEP;
+	long voltage = (long) sample->inputVoltage / HISTORY_VIN_STEP;
+	long speed = (long) sample->speed / HISTORY_SPEED_STEP;
+	packed->temperature = constrain(temperature, 0L, 255L);
+	packed->inputVoltage = constrain(voltage, 0L, 255L);
+	packed->speed = constrain(speed, -128L, 127L);
+	packed->errors[0] = sample->errors & 0xFF;
+	packed->errors[1] = sample->errors >> 8;
+}
+
+void MotorHistory::unpack(PackedSample* packed, HistorySample* sample)
+{
+	sample->temperature = packed->temperature * HISTORY_TEMP_STEP + HISTORY_TEMP_OFFSET;
+	sample->inputVoltage = packed->inputVoltage * HISTORY_VIN_STEP;
+	sample->speed = packed->speed * HISTORY_SPEED_STEP;
+	sample->errors = packed->errors[0] | (packed->errors[1] << 8);
+}
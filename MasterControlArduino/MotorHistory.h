@@ -0,0 +1,73 @@
+/*
+
+	MotorHistory.h
+	
+	Keeps a rolling history of a motor's telemetry, so there's something to look at after a fault
+	
+*/
+
+#ifndef MOTORHISTORY_H
+#define MOTORHISTORY_H
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+// two resolutions: a fine one for the last few minutes, and a coarse one for the last day
+#define HISTORY_FINE_INTERVAL 3			// seconds per fine sample
+#define HISTORY_FINE_SAMPLES 60			// 3 minutes
+#define HISTORY_COARSE_INTERVAL 900		// seconds per coarse sample (15 minutes)
+#define HISTORY_COARSE_SAMPLES 96		// 24 hours
+#define HISTORY_RAM_BUDGET 10240		// bytes, for all MOTORS_MAX_DEVICES motors together
+
+#define HISTORY_ERROR_SERIAL		(0b1 << 13)	// any serial error seen
+#define HISTORY_ERROR_TEMPLIMIT		(0b1 << 14)	// controller was limiting speed for temperature
+#define HISTORY_ERROR_OFFLINE		(0b1 << 15)	// motor wasn't answering
+
+typedef struct _historySample {
+	int16_t temperature;				// 0.1 deg C (max over the sample period)
+	uint16_t inputVoltage;				// mV (min over the sample period)
+	int16_t speed;						// mean over the sample period
+	uint16_t errors;					// MOTORCONTROLLER_ERRORSTATUS_* bits, plus HISTORY_ERROR_* (OR over the sample period)
+} HistorySample;
+
+// how a sample is kept in the rings - 5 bytes rather than 8, which is ~5.5KB over 12 motors
+#define HISTORY_TEMP_OFFSET -200		// 0.1 deg C: kept in 0.5 deg steps from -20 deg C, to 107.5
+#define HISTORY_TEMP_STEP 5
+#define HISTORY_VIN_STEP 200			// mV: kept in 0.2V steps, to 51V
+#define HISTORY_SPEED_STEP 32			// the controllers' speed is -3200 to 3200, so 1% steps
+
+typedef struct _packedSample {
+	uint8_t temperature;
+	uint8_t inputVoltage;
+	int8_t speed;
+	uint8_t errors[2];					// low byte first, as bytes so the struct isn't padded
+} PackedSample;
+
+class MotorHistory{
+	public:
+		MotorHistory();
+		void clear();
+		bool add(HistorySample* sample);
+		int count(bool coarse);
+		unsigned long total(bool coarse);
+		bool get(bool coarse, int age, HistorySample* sample);
+		static void pack(HistorySample* sample, PackedSample* packed);
+		static void unpack(PackedSample* packed, HistorySample* sample);
+	private:
+		PackedSample _fine[HISTORY_FINE_SAMPLES];
+		PackedSample _coarse[HISTORY_COARSE_SAMPLES];
+		uint8_t _fineHead;
+		uint8_t _fineCount;
+		uint8_t _coarseHead;
+		uint8_t _coarseCount;
+		unsigned long _fineTotal;		// every sample ever added, so a listing can tell where it's got to
+		unsigned long _coarseTotal;
+		// the coarse sample currently being built up from fine ones, at full resolution until it's done
+		HistorySample _pending;
+		int32_t _speedSum;
+		uint16_t _pendingCount;
+};
+
+#endif
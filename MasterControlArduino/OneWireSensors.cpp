@@ -0,0 +1,208 @@
+/*
+
+	OneWireSensors.cpp
+	
+	Temperature sensors on the 1Wire bus, read in the background into a table
+
+	The bus is searched once at boot.  After that, every ONEWIRE_INTERVAL all the sensors are told
+	to convert at once with a Skip ROM, and once they've had time to finish each one's scratchpad
+	is read back by its ROM code.
+
+	1Wire is bit-banged with the interrupts off for each bit, and a whole read takes ~12ms, so
+	poll() only does one step of it - a reset, or one byte (under 1ms) - each time round the loop,
+	and none at all when the scheduler has a cue due within ONEWIRE_QUIET.
+	
+*/
+#include "OneWireSensors.h"
+#include "ConsoleOut.h"
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+OneWireSensors::OneWireSensors() : _wire(ONEWIRE_PIN)
+{
+	_sched = NULL;
+	_numSensors = 0;
+	_otherDevices = 0;
+	_state = ONEWIRE_IDLE;
+	_current = 0;
+	_convertStarted = 0;
+	_lastCycleMillis = 0;
+	_busErrors = 0;
+	_txLength = 0;
+	_rxLength = 0;
+	_step = 0;
+	_power = false;
+	_failed = false;
+}
+
+void OneWireSensors::begin(Scheduler* sched)
+{
+	// search the bus - this blocks, but it's only done at boot
+	uint8_t rom[8];
+	OneWireSensor *sensor;
+	_sched = sched;
+	_numSensors = 0;
+	_wire.reset_search();
+	while (_numSensors < ONEWIRE_MAX_SENSORS && _wire.search(rom))
+	{
+		if (OneWire::crc8(rom, 7) != rom[7])
+			continue;
+		if (rom[0] != ONEWIRE_DS18S20 && rom[0] != ONEWIRE_DS1822 && rom[0] != ONEWIRE_DS18B20)
+		{
+			_otherDevices++;
+			continue;
+		}
+		sensor = &_sensors[_numSensors++];
+		memset(sensor, 0, sizeof(OneWireSensor));
+		memcpy(sensor->rom, rom, 8);
+	}
+	_state = ONEWIRE_IDLE;
+	_convertStarted = millis() - ONEWIRE_INTERVAL; // first readings straight away
+}
+
+void OneWireSensors::startTransaction(uint8_t txLength, uint8_t rxLength, bool power)
+{
+	_txLength = txLength;
+	_rxLength = rxLength;
+	_power = power;
+	_step = 0;
+	_failed = false;
+}
+
+bool OneWireSensors::step()
+{
+	// one piece of the transaction; true when it's all done
+	if (_step == 0)
+	{
+		if (!_wire.reset())
+		{
+			_failed = true;
+			return true;
+		}
+	} else if (_step <= _txLength) {
+		_wire.write(_tx[_step - 1], _power && _step == _txLength);
+	} else {
+		_rx[_step - 1 - _txLength] = _wire.read();
+	}
+	_step++;
+	return _step > _txLength + _rxLength;
+}
+
+void OneWireSensors::startRead(int index)
+{
+	_current = index;
+	_tx[0] = ONEWIRE_MATCH_ROM;
+	memcpy(&_tx[1], _sensors[index].rom, 8);
+	_tx[9] = ONEWIRE_READ_SCRATCHPAD;
+	startTransaction(10, 9, false);
+	_state = ONEWIRE_READ;
+}
+
+void OneWireSensors::finishRead(int index)
+{
+	OneWireSensor *sensor = &_sensors[index];
+	int16_t raw;
+	if (_failed)
+		return; // already counted as a bus error
+	if (OneWire::crc8(_rx, 8) != _rx[8])
+	{
+		sensor->crcErrors++;
+		return;
+	}
+	raw = (int16_t) ((_rx[1] << 8) | _rx[0]);
+	if (sensor->rom[0] == ONEWIRE_DS18S20)
+		raw = raw * 8; // half degrees
+	sensor->raw = raw;
+	sensor->valid = true;
+	sensor->updated = millis();
+	sensor->reads++;
+}
+
+void OneWireSensors::poll()
+{
+	// call every time round the loop
+	unsigned long now = millis();
+	if (_numSensors == 0)
+		return;
+	if (_state == ONEWIRE_IDLE)
+	{
+		if (now - _convertStarted < ONEWIRE_INTERVAL)
+			return;
+		_tx[0] = ONEWIRE_SKIP_ROM;
+		_tx[1] = ONEWIRE_CONVERT_T;
+		startTransaction(2, 0, true);
+		_state = ONEWIRE_CONVERT;
+	}
+	if (_state == ONEWIRE_WAITING)
+	{
+		if (now - _convertStarted < ONEWIRE_CONVERT_TIME)
+			return;
+		startRead(0);
+	}
+	// something to do on the wire, if it's not going to hold up a cue
+	if (_sched != NULL && _sched->msUntilNextCue() < ONEWIRE_QUIET)
+		return;
+	if (!step())
+		return;
+	if (_failed)
+		_busErrors++;
+	if (_state == ONEWIRE_CONVERT)
+	{
+		_convertStarted = millis();
+		_state = _failed ? ONEWIRE_IDLE : ONEWIRE_WAITING;
+		return;
+	}
+	finishRead(_current);
+	if (_current + 1 < _numSensors)
+	{
+		startRead(_current + 1);
+	} else {
+		_lastCycleMillis = millis() - _convertStarted;
+		_state = ONEWIRE_IDLE;
+	}
+}
+
+int OneWireSensors::numSensors()
+{
+	return _numSensors;
+}
+
+const OneWireSensor* OneWireSensors::getSensor(int index)
+{
+	if (index < 0 || index >= _numSensors)
+		return NULL;
+	return &_sensors[index];
+}
+
+int32_t OneWireSensors::milliC(int index)
+{
+	if (index < 0 || index >= _numSensors)
+		return 0;
+	return ((int32_t) _sensors[index].raw * 1000) / 16;
+}
+
+void OneWireSensors::print()
+{
+	int i, j;
+	OneWireSensor *sensor;
+	for (i=0;i<_numSensors;i++)
+	{
+		sensor = &_sensors[i];
+		CONSOLE.printf(F("%d: "), i + 1);
+		for (j=0;j<8;j++)
+			CONSOLE.printf(F("%02X"), sensor->rom[j]);
+		if (sensor->valid)
+			CONSOLE.printf(F(" %.2fC, %lus ago"), milliC(i) / 1000.0, (millis() - sensor->updated) / 1000);
+		else
+			CONSOLE.print(F(" no reading yet"));
+		CONSOLE.printf(F(" (%lu reads, %lu CRC errors)\r\n"), sensor->reads, sensor->crcErrors);
+	}
+	if (_numSensors == 0)
+		CONSOLE.println(F("No 1Wire sensors"));
+	if (_otherDevices > 0)
+		CONSOLE.printf(F("%d other 1Wire devices\r\n"), _otherDevices);
+	CONSOLE.printf(F("Last set of readings took %lums, %lu bus errors\r\n"), _lastCycleMillis, _busErrors);
+}
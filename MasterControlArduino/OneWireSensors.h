@@ -0,0 +1,87 @@
+/*
+
+	OneWireSensors.h
+	
+	Temperature sensors on the 1Wire bus, read in the background into a table
+	
+*/
+
+#ifndef ONEWIRESENSORS_H
+#define ONEWIRESENSORS_H
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+#include <OneWire.h>
+#include "SystemConfig.h"
+#include "Scheduler.h"
+
+#define ONEWIRE_MAX_SENSORS 8
+#define ONEWIRE_INTERVAL 10000			// ms between one set of readings and the next
+#define ONEWIRE_CONVERT_TIME 750		// ms a DS18B20 takes at 12 bits
+#define ONEWIRE_QUIET 5					// ms clear of the next cue before touching the bus
+#define ONEWIRE_MAX_DATA 10				// bytes written in one transaction
+
+// ROM commands and the DS18x20 function commands we use
+#define ONEWIRE_MATCH_ROM 0x55
+#define ONEWIRE_SKIP_ROM 0xCC
+#define ONEWIRE_CONVERT_T 0x44
+#define ONEWIRE_READ_SCRATCHPAD 0xBE
+
+// family codes
+#define ONEWIRE_DS18S20 0x10
+#define ONEWIRE_DS1822 0x22
+#define ONEWIRE_DS18B20 0x28
+
+enum OneWireState {
+	ONEWIRE_IDLE,						// between sets of readings
+	ONEWIRE_CONVERT,					// telling every sensor to start converting at once
+	ONEWIRE_WAITING,					// for the conversions to finish
+	ONEWIRE_READ						// reading the sensors back one by one
+};
+
+typedef struct _oneWireSensor {
+	uint8_t rom[8];
+	int16_t raw;						// 1/16ths of a degree
+	bool valid;
+	unsigned long updated;				// millis() of the last good reading
+	unsigned long reads;
+	unsigned long crcErrors;
+} OneWireSensor;
+
+class OneWireSensors{
+	public:
+		OneWireSensors();
+		void begin(Scheduler* sched);
+		void poll();
+		int numSensors();
+		const OneWireSensor* getSensor(int index);
+		int32_t milliC(int index);
+		void print();
+	private:
+		OneWire _wire;
+		Scheduler* _sched;
+		OneWireSensor _sensors[ONEWIRE_MAX_SENSORS];
+		int _numSensors;
+		int _otherDevices;				// found on the bus, but not temperature sensors
+		OneWireState _state;
+		int _current;					// sensor being read
+		unsigned long _convertStarted;
+		unsigned long _lastCycleMillis;	// convert to last sensor read
+		unsigned long _busErrors;		// nobody answered the reset
+		// the transaction in progress: a reset, the bytes in _tx, then _rxLength bytes into _rx
+		uint8_t _tx[ONEWIRE_MAX_DATA];
+		uint8_t _txLength;
+		uint8_t _rx[9];
+		uint8_t _rxLength;
+		uint8_t _step;
+		bool _power;					// hold the bus high after the last byte, for parasite powered sensors
+		bool _failed;
+		void startTransaction(uint8_t txLength, uint8_t rxLength, bool power);
+		bool step();
+		void startRead(int index);
+		void finishRead(int index);
+};
+
+#endif
@@ -0,0 +1,211 @@
+/*
+
+	RelayBank.cpp
+	
+	Relays on a PCF8574, driven from a shadow of the output byte so a tick's worth of changes is one I2C write
+
+	Changes only touch the shadow and mark it dirty; flush() queues it on the I2C bus.  The expander
+	is only read back now and again by verify(), to catch it having been reset or glitched.
+	One that stops answering is tried again less and less often, from RELAYS_RETRY_MIN up to
+	RELAYS_RETRY_MAX, until it's back.
+	
+*/
+#include "RelayBank.h"
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+extern I2CBus i2c;
+
+RelayBank::RelayBank()
+{
+	_address = 0;
+	_online = false;
+	_backoff = 0;
+	_retryAt = 0;
+	_shadow = 0xFF; // power on state, everything off
+	_dirty = false;
+	_writes = 0;
+	_changes = 0;
+	_verifyFailures = 0;
+	_writeErrors = 0;
+	_lastWriteMicros = 0;
+	_maxWriteMicros = 0;
+	_writesQueued = 0;
+	_verifying = false;
+	_inputs = 0;
+}
+
+bool RelayBank::begin(int address)
+{
+	// false if there's nothing at that address; otherwise start from whatever it's doing now
+	uint8_t current;
+	_address = address;
+	_dirty = false;
+	_online = (i2c.transfer(_address, NULL, 0, &current, 1) == I2C_OK);
+	if (_online)
+		_shadow = current;
+	return _online;
+}
+
+void RelayBank::set(uint8_t pin, bool on)
+{
+	uint8_t old = _shadow;
+	if (pin > 7 || (_inputs & (1 << pin)))
+		return;
+	if (on)
+		_shadow &= ~(1 << pin);
+	else
+		_shadow |= (1 << pin);
+	if (_shadow != old)
+	{
+		_dirty = true;
+		_changes++;
+	}
+}
+
+void RelayBank::setAll(uint8_t value)
+{
+	value |= _inputs;
+	if (value != _shadow)
+	{
+		_shadow = value;
+		_dirty = true;
+		_changes++;
+	}
+}
+
+void RelayBank::setInputs(uint8_t mask)
+{
+	// pins being used as inputs are left high, so whatever's on them can pull them low
+	_inputs = mask;
+	if ((_shadow | _inputs) != _shadow)
+	{
+		_shadow |= _inputs;
+		_dirty = true;
+	}
+}
+
+uint8_t RelayBank::getInputs()
+{
+	return _inputs;
+}
+
+uint8_t RelayBank::value()
+{
+	return _shadow;
+}
+
+bool RelayBank::isDirty()
+{
+	return _dirty;
+}
+
+bool RelayBank::flush()
+{
+	// queues one write for however many relays changed since the last flush
+	if (!_dirty)
+		return false;
+	if (_backoff > 0 && (long)(millis() - _retryAt) < 0)
+		return false; // not answering, and not time to try it again yet
+	if (!i2c.queue(_address, &_shadow, 1, 0, writeDone, this))
+		return false; // bus queue's full, still dirty so it goes next time
+	_dirty = false;
+	_writesQueued++;
+	return true;
+}
+
+void RelayBank::writeDone(I2CRequest* request)
+{
+	RelayBank *bank = (RelayBank*) request->context;
+	bank->_writesQueued--;
+	bank->_writes++;
+	bank->_lastWriteMicros = request->finished - request->queued;
+	if (bank->_lastWriteMicros > bank->_maxWriteMicros)
+		bank->_maxWriteMicros = bank->_lastWriteMicros;
+	if (request->status != I2C_OK)
+	{
+		bank->_writeErrors++;
+		bank->_dirty = true; // try again once it's backed off
+		bank->failed();
+		return;
+	}
+	bank->_online = true;
+	bank->_backoff = 0;
+}
+
+void RelayBank::failed()
+{
+	// so an expander that's gone doesn't get hammered every time round the loop
+	_online = false;
+	_backoff = (_backoff == 0) ? RELAYS_RETRY_MIN : min(_backoff * 2, (unsigned int) RELAYS_RETRY_MAX);
+	_retryAt = millis() + _backoff;
+}
+
+bool RelayBank::verify()
+{
+	// queues a read back; the relays drive the pins hard, so they should read back as written.
+	// False if it wasn't queued; the answer comes to verifyDone()
+	if (_dirty || _writesQueued > 0 || _verifying)
+		return false; // about to be written anyway
+	if (!i2c.queue(_address, NULL, 0, 1, verifyDone, this))
+		return false;
+	_verifying = true;
+	return true;
+}
+
+void RelayBank::verifyDone(I2CRequest* request)
+{
+	RelayBank *bank = (RelayBank*) request->context;
+	bank->_verifying = false;
+	if (request->status == I2C_OK && (request->rx[0] | bank->_inputs) == bank->_shadow)
+		return;
+	if (bank->_dirty || bank->_writesQueued > 0)
+		return; // changed since, and it's going to be written anyway
+	bank->_verifyFailures++;
+	bank->_dirty = true; // put it right on the next flush
+	if (request->status != I2C_OK)
+		bank->failed();
+}
+
+int RelayBank::getAddress()
+{
+	return _address;
+}
+
+bool RelayBank::isOnline()
+{
+	return _online;
+}
+
+unsigned long RelayBank::getWrites()
+{
+	return _writes;
+}
+
+unsigned long RelayBank::getChanges()
+{
+	return _changes;
+}
+
+unsigned long RelayBank::getVerifyFailures()
+{
+	return _verifyFailures;
+}
+
+unsigned long RelayBank::getWriteErrors()
+{
+	return _writeErrors;
+}
+
+unsigned long RelayBank::getLastWriteMicros()
+{
+	return _lastWriteMicros;
+}
+
+unsigned long RelayBank::getMaxWriteMicros()
+{
+	return _maxWriteMicros;
+}
@@ -0,0 +1,63 @@
+/*
+
+	RelayBank.h
+	
+	Relays on a PCF8574, driven from a shadow of the output byte so a tick's worth of changes is one I2C write
+	
+*/
+
+#ifndef RELAYBANK_H
+#define RELAYBANK_H
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+#include "I2CBus.h"
+
+// a bank that isn't answering is tried again after this long, doubling each time it fails
+#define RELAYS_RETRY_MIN 100			// ms
+#define RELAYS_RETRY_MAX 5000
+
+class RelayBank{
+	public:
+		RelayBank();
+		bool begin(int address);
+		void set(uint8_t pin, bool on);
+		void setAll(uint8_t value);
+		void setInputs(uint8_t mask);
+		uint8_t getInputs();
+		uint8_t value();
+		bool isDirty();
+		bool flush();
+		bool verify();
+		int getAddress();
+		bool isOnline();
+		unsigned long getWrites();
+		unsigned long getChanges();
+		unsigned long getVerifyFailures();
+		unsigned long getWriteErrors();
+		unsigned long getLastWriteMicros();
+		unsigned long getMaxWriteMicros();
+	private:
+		int _address;
+		bool _online;					// answered the last time it was written or read
+		unsigned int _backoff;			// ms until the next go after a failure, 0 if it's fine
+		unsigned long _retryAt;
+		uint8_t _shadow;				// what the outputs should be; relays are on when their bit is low
+		bool _dirty;
+		unsigned long _writes;
+		unsigned long _changes;			// relay changes asked for, a write can carry several
+		unsigned long _verifyFailures;
+		unsigned long _writeErrors;
+		unsigned long _lastWriteMicros;
+		unsigned long _maxWriteMicros;
+		uint8_t _writesQueued;			// on the bus queue and not done yet
+		bool _verifying;
+		uint8_t _inputs;				// pins used as inputs, always written high
+		void failed();
+		static void writeDone(I2CRequest* request);
+		static void verifyDone(I2CRequest* request);
+};
+
+#endif
@@ -0,0 +1,132 @@
+/*
+
+	RelayBanks.cpp
+	
+	Every relay expander on the I2C bus, numbered as one run of relays
+
+	Relay n is pin (n-1) % 8 of bank (n-1) / 8, banks in the order of RELAYS_BANK_ADDRESSES.
+	A bank whose expander didn't answer is offline, but keeps its place.
+	
+*/
+#include "RelayBanks.h"
+#include "ConsoleOut.h"
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+extern I2CBus i2c;
+
+static const uint8_t BANK_ADDRESSES[RELAYS_MAX_BANKS] = RELAYS_BANK_ADDRESSES;
+
+RelayBanks::RelayBanks()
+{
+	_nextVerify = 0;
+}
+
+bool RelayBanks::isBankAddress(int address)
+{
+	int i;
+	for (i=0;i<RELAYS_MAX_BANKS;i++)
+	{
+		if (BANK_ADDRESSES[i] == address)
+			return true;
+	}
+	return false;
+}
+
+int RelayBanks::discover()
+{
+	// returns how many banks answered
+	uint8_t value;
+	int i, address;
+	for (i=0;i<RELAYS_MAX_BANKS;i++)
+	{
+		if (!_banks[i].begin(BANK_ADDRESSES[i]))
+			CONSOLE.printf(F("Relay bank %d (relays %02d-%02d) at 0x%02x isn't answering\r\n"),
+				i, i * RELAYS_PER_BANK + 1, (i + 1) * RELAYS_PER_BANK, BANK_ADDRESSES[i]);
+	}
+	// something that isn't one of ours could be anything, so it's only read, never written
+	for (address=RELAYS_PCF8574_FIRST;address<=RELAYS_PCF8574A_LAST;address++)
+	{
+		if (address == RELAYS_PCF8574_LAST + 1)
+			address = RELAYS_PCF8574A_FIRST;
+		if (!isBankAddress(address) && i2c.transfer(address, NULL, 0, &value, 1) == I2C_OK)
+			CONSOLE.printf(F("Unexpected device at 0x%02x, not used for relays\r\n"), address);
+	}
+	return numOnline();
+}
+
+int RelayBanks::numOnline()
+{
+	int i, online = 0;
+	for (i=0;i<RELAYS_MAX_BANKS;i++)
+	{
+		if (_banks[i].isOnline())
+			online++;
+	}
+	return online;
+}
+
+int RelayBanks::numBanks()
+{
+	return RELAYS_MAX_BANKS;
+}
+
+int RelayBanks::numRelays()
+{
+	return RELAYS_MAX_BANKS * RELAYS_PER_BANK;
+}
+
+RelayBank* RelayBanks::getBank(int bank)
+{
+	if (bank < 0 || bank >= RELAYS_MAX_BANKS)
+		return NULL;
+	return &_banks[bank];
+}
+
+bool RelayBanks::set(int relay, bool on)
+{
+	// relays are numbered from 1
+	if (relay < 1 || relay > numRelays())
+		return false;
+	_banks[(relay - 1) / RELAYS_PER_BANK].set((relay - 1) % RELAYS_PER_BANK, on);
+	return true;
+}
+
+bool RelayBanks::isOn(int relay)
+{
+	if (relay < 1 || relay > numRelays())
+		return false;
+	return (_banks[(relay - 1) / RELAYS_PER_BANK].value() & (1 << ((relay - 1) % RELAYS_PER_BANK))) == 0;
+}
+
+int RelayBanks::flush()
+{
+	// one pass over the bus, only the banks that changed
+	int i, written = 0;
+	for (i=0;i<RELAYS_MAX_BANKS;i++)
+	{
+		if (_banks[i].flush())
+			written++;
+	}
+	return written;
+}
+
+void RelayBanks::verify()
+{
+	// queues a read back of one bank per call, so a full set of banks doesn't hold the bus up all at once.
+	// Offline banks are skipped; if the bus queue's full the same bank gets another go next time
+	int i;
+	for (i=0;i<RELAYS_MAX_BANKS;i++)
+	{
+		if (_banks[_nextVerify].isOnline())
+			break;
+		_nextVerify = (_nextVerify + 1) % RELAYS_MAX_BANKS;
+	}
+	if (i == RELAYS_MAX_BANKS)
+		return; // nothing there
+	if (_banks[_nextVerify].verify())
+		_nextVerify = (_nextVerify + 1) % RELAYS_MAX_BANKS;
+}
@@ -0,0 +1,49 @@
+/*
+
+	RelayBanks.h
+	
+	Every relay expander on the I2C bus, numbered as one run of relays
+	
+*/
+
+#ifndef RELAYBANKS_H
+#define RELAYBANKS_H
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+#include "RelayBank.h"
+
+#define RELAYS_MAX_BANKS 8
+#define RELAYS_PER_BANK 8
+#define RELAYS_VERIFY_INTERVAL 5000		// ms between reading a bank back, one bank at a time
+// The address of each bank, in order: bank n is always relays n*8+1 to n*8+8, whether or not
+// its expander answers, so a missing one never moves the relays after it.  The controller
+// board's own expander (0x38) is relays 1-8.  Change this to suit the expanders fitted.
+#define RELAYS_BANK_ADDRESSES { 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0x3E, 0x3F }
+// anything else answering in the PCF8574(A) ranges is reported at boot, but left alone
+#define RELAYS_PCF8574A_FIRST 0x38
+#define RELAYS_PCF8574A_LAST 0x3F
+#define RELAYS_PCF8574_FIRST 0x20
+#define RELAYS_PCF8574_LAST 0x27
+
+class RelayBanks{
+	public:
+		RelayBanks();
+		int discover();
+		int numOnline();
+		int numBanks();
+		int numRelays();
+		RelayBank* getBank(int bank);
+		bool set(int relay, bool on);
+		bool isOn(int relay);
+		int flush();
+		void verify();
+	private:
+		RelayBank _banks[RELAYS_MAX_BANKS];
+		int _nextVerify;
+		bool isBankAddress(int address);
+};
+
+#endif
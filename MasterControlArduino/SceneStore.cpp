@@ -0,0 +1,293 @@
+/*
+
+	SceneStore.cpp
+	
+	Whole looks - DMX, relays and motors - saved to SD and recalled in one go
+
+	Each scene is its own file, SCENEnn.DAT:
+	  "HSC2", name (16 bytes), relay bank count, motor count, DMX length (2 bytes LE),
+	  then a byte per relay bank, 3 bytes per motor (id, direction, percent), then the DMX runs.
+	Only lit channels are stored, so a scene with a handful of channels up is a few dozen bytes.
+	
+*/
+#include "SceneStore.h"
+#include "SystemConfig.h"
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+#include <SdFat.h>
+
+extern SdFat sd;
+
+SceneStore::SceneStore()
+{
+	int i;
+	for (i=0;i<SCENES_CACHED;i++)
+	{
+		_cache[i].number = -1;
+		_cache[i].lastUsed = 0;
+	}
+	_useCount = 0;
+	_hits = 0;
+	_misses = 0;
+	_missing = -1;
+}
+
+void SceneStore::fileName(int number, char* name)
+{
+	sprintf(name, "SCENE%02d.DAT", number);
+}
+
+Scene* SceneStore::findCached(int number)
+{
+	int i;
+	for (i=0;i<SCENES_CACHED;i++)
+	{
+		if (_cache[i].number == number)
+			return &_cache[i];
+	}
+	return NULL;
+}
+
+Scene* SceneStore::freeSlot(const int* keep, int numKeep)
+{
+	// least recently used, leaving alone any scene in keep; NULL if they all are
+	Scene *slot = NULL;
+	int i, j;
+	for (i=0;i<SCENES_CACHED;i++)
+	{
+		for (j=0;j<numKeep && _cache[i].number != keep[j];j++);
+		if (j < numKeep)
+			continue;
+		if (slot == NULL || _cache[i].lastUsed < slot->lastUsed)
+			slot = &_cache[i];
+	}
+	if (slot != NULL)
+		slot->number = -1;
+	return slot;
+}
+
+Scene* SceneStore::get(int number)
+{
+	// from RAM if it's been prefetched, otherwise off the card (slow)
+	Scene *scene = findCached(number);
+	if (scene != NULL)
+	{
+		_hits++;
+	} else {
+		_misses++;
+		scene = freeSlot(NULL, 0);
+		if (!load(scene, number))
+			return NULL;
+	}
+	scene->lastUsed = ++_useCount;
+	return scene;
+}
+
+bool SceneStore::prefetch(const int* numbers, int count)
+{
+	// numbers are the scenes wanted next, soonest first.  Loads the first of them that isn't
+	// here already, into a slot that isn't holding one of the others - one card read at most
+	Scene *scene;
+	int i;
+	for (i=0;i<count;i++)
+	{
+		if (numbers[i] == _missing || findCached(numbers[i]) != NULL)
+			continue;
+		scene = freeSlot(numbers, count);
+		if (scene == NULL)
+			return false;
+		if (!load(scene, numbers[i]))
+		{
+			_missing = numbers[i];
+			return false;
+		}
+		scene->lastUsed = ++_useCount;
+		return true;
+	}
+	return false;
+}
+
+bool SceneStore::load(Scene* slot, int number)
+{
+	SdFile sceneFile;
+	char name[16];
+	uint8_t header[24];
+	uint8_t motor[3];
+	int i;
+	bool ok;
+	if (number < 0 || number >= SCENES_MAX)
+		return false;
+	fileName(number, name);
+	if (!sceneFile.open(name, O_READ))
+		return false;
+	if (sceneFile.read(header, sizeof(header)) != sizeof(header) || memcmp(header, SCENE_MAGIC, 4) != 0)
+	{
+		sceneFile.close();
+		return false;
+	}
+	memcpy(slot->name, &header[4], SCENE_NAME_LENGTH);
+	slot->name[SCENE_NAME_LENGTH] = 0;
+	slot->numRelayBanks = min((int) header[20], RELAYS_MAX_BANKS);
+	ok = (sceneFile.read(slot->relays, slot->numRelayBanks) == slot->numRelayBanks);
+	slot->numMotors = min((int) header[21], MOTORS_MAX_DEVICES);
+	slot->dmxLength = min(header[22] | (header[23] << 8), SCENE_MAX_DMX_BYTES);
+	for (i=0;i<slot->numMotors && ok;i++)
+	{
+		ok = (sceneFile.read(motor, 3) == 3);
+		slot->motors[i].deviceId = motor[0];
+		slot->motors[i].direction = (motor[1] != 0);
+		slot->motors[i].percent = motor[2];
+	}
+	if (ok)
+		ok = (sceneFile.read(slot->dmx, slot->dmxLength) == slot->dmxLength);
+	sceneFile.close();
+	if (ok)
+		slot->number = number;
+	return ok;
+}
+
+Scene* SceneStore::create(int number, const char* name)
+{
+	// a cache slot to capture a scene into, replacing any old copy
+	Scene *scene;
+	if (number < 0 || number >= SCENES_MAX)
+		return NULL;
+	scene = findCached(number);
+	if (scene == NULL)
+		scene = freeSlot(NULL, 0);
+	memset(scene->name, 0, sizeof(scene->name));
+	if (name != NULL)
+		strncpy(scene->name, name, SCENE_NAME_LENGTH);
+	scene->number = number;
+	scene->numRelayBanks = 0;
+	scene->numMotors = 0;
+	scene->dmxLength = 0;
+	scene->lastUsed = ++_useCount;
+	return scene;
+}
+
+bool SceneStore::save(Scene* scene)
+{
+	SdFile sceneFile;
+	char name[16];
+	uint8_t header[24];
+	uint8_t motor[3];
+	int i;
+	fileName(scene->number, name);
+	sd.remove(name);
+	if (!sceneFile.open(name, O_RDWR | O_CREAT))
+	{
+		sd.errorPrint("couldn't open scene for writing");
+		return false;
+	}
+	memcpy(header, SCENE_MAGIC, 4);
+	memcpy(&header[4], scene->name, SCENE_NAME_LENGTH);
+	header[20] = scene->numRelayBanks;
+	header[21] = scene->numMotors;
+	header[22] = scene->dmxLength & 0xFF;
+	header[23] = scene->dmxLength >> 8;
+	sceneFile.write(header, sizeof(header));
+	sceneFile.write(scene->relays, scene->numRelayBanks);
+	for (i=0;i<scene->numMotors;i++)
+	{
+		motor[0] = scene->motors[i].deviceId;
+		motor[1] = scene->motors[i].direction ? 1 : 0;
+		motor[2] = scene->motors[i].percent;
+		sceneFile.write(motor, 3);
+	}
+	sceneFile.write(scene->dmx, scene->dmxLength);
+	sceneFile.close();
+	if (scene->number == _missing)
+		_missing = -1;
+	return true;
+}
+
+bool SceneStore::remove(int number)
+{
+	char name[16];
+	Scene *scene = findCached(number);
+	if (scene != NULL)
+		scene->number = -1;
+	fileName(number, name);
+	return sd.remove(name);
+}
+
+bool SceneStore::info(int number, char* name, int* numMotors, uint16_t* dmxLength)
+{
+	// just the header, without disturbing the cache; name needs SCENE_NAME_LENGTH + 1
+	SdFile sceneFile;
+	char fname[16];
+	uint8_t header[24];
+	bool ok;
+	fileName(number, fname);
+	if (!sceneFile.open(fname, O_READ))
+		return false;
+	ok = (sceneFile.read(header, sizeof(header)) == sizeof(header) && memcmp(header, SCENE_MAGIC, 4) == 0);
+	sceneFile.close();
+	if (!ok)
+		return false;
+	memcpy(name, &header[4], SCENE_NAME_LENGTH);
+	name[SCENE_NAME_LENGTH] = 0;
+	*numMotors = header[21];
+	*dmxLength = header[22] | (header[23] << 8);
+	return true;
+}
+
+void SceneStore::encodeDmx(Scene* scene, const uint8_t* levels)
+{
+	// levels is indexed by channel, 1-512; zeros aren't stored
+	int channel = 1;
+	int start, count;
+	uint16_t length = 0;
+	while (channel <= DMX_MAX_CHANNELS)
+	{
+		if (levels[channel] == 0)
+		{
+			channel++;
+			continue;
+		}
+		start = channel;
+		while (channel <= DMX_MAX_CHANNELS && levels[channel] != 0 && channel - start < 255)
+			channel++;
+		count = channel - start;
+		if (length + 3 + count > SCENE_MAX_DMX_BYTES)
+			break;
+		scene->dmx[length++] = start & 0xFF;
+		scene->dmx[length++] = start >> 8;
+		scene->dmx[length++] = count;
+		memcpy(&scene->dmx[length], &levels[start], count);
+		length += count;
+	}
+	scene->dmxLength = length;
+}
+
+void SceneStore::decodeDmx(Scene* scene, uint8_t* levels)
+{
+	// everything the scene doesn't mention goes to zero
+	int i = 0;
+	int start, count;
+	memset(&levels[1], 0, DMX_MAX_CHANNELS);
+	while (i + 3 <= scene->dmxLength)
+	{
+		start = scene->dmx[i] | (scene->dmx[i + 1] << 8);
+		count = scene->dmx[i + 2];
+		i += 3;
+		if (start < 1 || start + count - 1 > DMX_MAX_CHANNELS || i + count > scene->dmxLength)
+			break;
+		memcpy(&levels[start], &scene->dmx[i], count);
+		i += count;
+	}
+}
+
+unsigned long SceneStore::getHits()
+{
+	return _hits;
+}
+
+unsigned long SceneStore::getMisses()
+{
+	return _misses;
+}
@@ -0,0 +1,63 @@
+/*
+
+	SceneStore.h
+	
+	Whole looks - DMX, relays and motors - saved to SD and recalled in one go
+	
+*/
+
+#ifndef SCENESTORE_H
+#define SCENESTORE_H
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+#include "SystemConfig.h"
+#include "MotorControl.h"
+#include "RelayBanks.h"
+
+#define SCENES_MAX 100					// scene numbers 0-99, the two digit device ID of an SCN cue
+#define SCENES_CACHED 2					// kept in RAM so a recall doesn't wait for the SD card
+#define SCENE_NAME_LENGTH 16
+#define SCENE_MAX_DMX_BYTES 1028		// worst case is about every other channel lit: 256 runs and a 3 byte header each
+#define SCENE_MAGIC "HSC2"
+
+typedef struct _scene {
+	int number;							// -1 for an empty cache slot
+	char name[SCENE_NAME_LENGTH + 1];
+	int numRelayBanks;
+	uint8_t relays[RELAYS_MAX_BANKS];	// each expander's output byte
+	int numMotors;
+	MotorCommand motors[MOTORS_MAX_DEVICES];
+	uint16_t dmxLength;
+	uint8_t dmx[SCENE_MAX_DMX_BYTES];	// runs of lit channels: channel (2 bytes LE), count, levels
+	unsigned long lastUsed;
+} Scene;
+
+class SceneStore{
+	public:
+		SceneStore();
+		Scene* get(int number);
+		bool prefetch(const int* numbers, int count);
+		Scene* create(int number, const char* name);
+		bool save(Scene* scene);
+		bool remove(int number);
+		bool info(int number, char* name, int* numMotors, uint16_t* dmxLength);
+		void encodeDmx(Scene* scene, const uint8_t* levels);
+		void decodeDmx(Scene* scene, uint8_t* levels);
+		unsigned long getHits();
+		unsigned long getMisses();
+	private:
+		Scene _cache[SCENES_CACHED];
+		unsigned long _useCount;
+		unsigned long _hits;
+		unsigned long _misses;
+		int _missing;					// couldn't be prefetched, so don't keep trying
+		Scene* findCached(int number);
+		Scene* freeSlot(const int* keep, int numKeep);
+		bool load(Scene* slot, int number);
+		void fileName(int number, char* name);
+};
+
+#endif
@@ -8,6 +8,8 @@
 #include "Scheduler.h"
 #include "SystemControl.h"
 #include "ClockManager.h"
+#include "EventLog.h"
+#include "SceneStore.h"
 
 #include "SystemControl.h"
 #include <Time.h>
@@ -22,49 +24,6 @@
 
 SdFat sd;
 
-void schedPrintDigits(int digits){
-  // utility function for digital clock display: prints preceding colon and leading 0
-  if(digits < 10)
-    Serial.print('0');
-  Serial.print(digits);
-}
-
-void schedPrintTimestamp()
-{
-	time_t time = now();
-		Serial.print("SCHED>");
-		schedPrintDigits(hour(time));
-		Serial.print(":");
-		schedPrintDigits(minute(time));
-		Serial.print(":");
-		schedPrintDigits(second(time));
-		Serial.print(" ");
-		Serial.print(day(time));
-		Serial.print("/");
-		Serial.print(month(time));
-		Serial.print("/");
-		Serial.print(year(time));
-		Serial.print(" - ");
-}
-
-
-void Scheduler::debug(String log)
-{
-	if (_debugging)
-	{
-		schedPrintTimestamp();
-		Serial.println(log);
-	}
-}
-
-
-void Scheduler::notify(String log)
-{
-	schedPrintTimestamp();
-	Serial.println("[NOTICE] " + log + "\n");
-}
-
-
 void rtrim(char* instr)
 {
 	char *ptr = instr;
@@ -96,7 +55,6 @@ Scheduler::Scheduler()
 		_availableRunningSlots[i] = &_runningSequences[i];
 	}
 	_running = false;
-	_debugging = false;
 	_controller = NULL;
 	scheduleClear();
 	sequenceClearAll();
@@ -112,6 +70,30 @@ void Scheduler::stop()
 	_running = false;
 }
 
+bool Scheduler::isRunning()
+{
+	return _running;
+}
+
+bool Scheduler::stopSequence(unsigned long sequenceId)
+{
+	// cues it hasn't got to yet won't be sent; false if it wasn't running
+	int i;
+	RunningSequence *ptr;
+	for (i=0;i<SCHEDULER_MAX_RUNNING_SEQUENCES;i++)
+	{
+		ptr = _currentlyRunningSlots[i];
+		if (ptr != NULL && ptr->running->sequenceId == sequenceId)
+		{
+			_currentlyRunningSlots[i] = NULL;
+			_availableRunningSlots[i] = ptr;
+			_numRunningSequences--;
+			return true;
+		}
+	}
+	return false;
+}
+
 bool Scheduler::loadFromSD()
 {
 	SdFile scheduleFile;
@@ -145,11 +127,7 @@ bool Scheduler::loadFromSD()
 		char* pEnd;
 		seqId = strtol(schedStr,&pEnd,10);
 		rtrim(++pEnd);
-		if (_debugging)
-		{
-			schedPrintTimestamp();
-			Serial.printf(F("SDLOAD SCHED: [ %i ] %s\n"),seqId,pEnd);
-		}
+		LOG_DEBUG(LOG_SCHED, "SDLOAD SCHED: [ %i ] %s",seqId,pEnd);
 		sequenceAdd(seqId);
 		scheduleAdd(seqId,pEnd);
 		numScheds++;
@@ -167,11 +145,7 @@ bool Scheduler::loadFromSD()
 	for (size_t i = 0; i < fileCount; i++) {
 		if (!sequenceFile.open(sd.vwd(), fileIndex[i], O_READ)) return false;
 		sequenceFile.getName(seqFilename,13);
-		if (_debugging)
-		{
-			schedPrintTimestamp();
-			Serial.printf("Opened: %s\n",seqFilename);
-		}
+		LOG_DEBUG(LOG_SCHED, "Opened: %s",seqFilename);
 		sequenceFile.fgets(header,sizeof(header));
 		seqId = strtol(seqFilename,NULL,10);
 		//Serial.printf("Sequence ID: %i\n",seqId);
@@ -182,18 +156,13 @@ bool Scheduler::loadFromSD()
 			long stepInd = strtol(cueStr,&pEnd,10);
 			pEnd++;
 			rtrim(pEnd);
-			if (_debugging)
-			{
-				schedPrintTimestamp();
-				Serial.printf("SDLOAD SEQ: [ %i/%i ] %s\n",i,stepInd,pEnd);
-			}
+			LOG_DEBUG(LOG_SCHED, "SDLOAD SEQ: [ %i/%i ] %s",i,stepInd,pEnd);
 			sequenceAppendCue(seqId,pEnd);
 		}
 		numSequences++;
 		sequenceFile.close();
 	}
-	schedPrintTimestamp();
-	Serial.printf("Loaded %d sequences and %d schedules", numSequences,numScheds);
+	LOG_INFO(LOG_SCHED, "Loaded %d sequences and %d schedules", numSequences,numScheds);
 	return true;	
 }
 
@@ -328,37 +297,37 @@ void Scheduler::triggerSchedule(time_t t)
 	int i;
 	int dowTemp = 0;
 	int pos;
-	debug("-----------------");
+	LOG_DEBUG(LOG_SCHED, "-----------------");
 	for (i=0;i<_numSchedules;i++)
 	{
 		
 		pos = 1;
 		thisSched = &_schedule[i];
 		candidateSched = String(thisSched->schedDef);
-		debug("##### Evaluating " + candidateSched);
+		LOG_DEBUG(LOG_SCHED, "##### Evaluating %s", thisSched->schedDef);
 		if (thisSched->schedDef[0] != '$') {
-			debug("Invalid schedule!!!" + candidateSched);
+			LOG_DEBUG(LOG_SCHED, "Invalid schedule!!!%s", thisSched->schedDef);
 			continue;
 		}
-		debug("Schedule OK");
+		LOG_DEBUG(LOG_SCHED, "Schedule OK");
 		tempString = candidateSched.substring(pos,pos+4);
 		pos+=4;
 
 		if (!(tempString.equals("****") || tempString.equals( String( year(t) ) )))
 			continue;
-		//debug("Matched year");
+		//LOG_DEBUG(LOG_SCHED, "Matched year");
 		
 		tempString = candidateSched.substring(pos,pos+2);
 		pos+=2;
 		if (!(tempString.equals("**") || (tempString.toInt() == month(t))))
 			continue;
-		//debug("Matched month");
+		//LOG_DEBUG(LOG_SCHED, "Matched month");
 		
 		tempString = candidateSched.substring(pos,pos+2);
 		pos+=2;
 		if (!(tempString.equals("**") || (tempString.toInt() == day(t))))
 			continue;
-		//debug("Matched Day (of month)");
+		//LOG_DEBUG(LOG_SCHED, "Matched Day (of month)");
 		
 		tempString = candidateSched.substring(pos,pos+3);
 		pos+=3;
@@ -398,7 +367,7 @@ void Scheduler::triggerSchedule(time_t t)
 				}
 			}
 		}
-		//debug("Matched day (of week)");
+		//LOG_DEBUG(LOG_SCHED, "Matched day (of week)");
 		
 		tempString = candidateSched.substring(pos,pos+2);
 		pos+=2;
@@ -406,34 +375,34 @@ void Scheduler::triggerSchedule(time_t t)
 		{
 			continue;
 		}
-		debug("Matched hour" + tempString);
+		LOG_DEBUG(LOG_SCHED, "Matched hour%s", tempString);
 		
 		tempString = candidateSched.substring(pos,pos+2);
 		pos+=2;
-		debug("Minute: " + tempString);
+		LOG_DEBUG(LOG_SCHED, "Minute: %s", tempString);
 		if (!(tempString.equals("**") || tempString.toInt() == minute(t)))
 		{
 			continue;
 		}
-		debug("Matched minute " + tempString);
+		LOG_DEBUG(LOG_SCHED, "Matched minute %s", tempString);
 		
 		tempString = candidateSched.substring(pos,pos+2);
 		pos+=2;
-		debug("Second: " + tempString);
+		LOG_DEBUG(LOG_SCHED, "Second: %s", tempString);
 		if (!(tempString.equals("**") || tempString.toInt() == second(t)))
 		{
 			continue;
 		}
-		debug("Matched second " + tempString);
+		LOG_DEBUG(LOG_SCHED, "Matched second %s", tempString);
 		
 		tempString = candidateSched.substring(pos,pos+1);
 		pos+=1;
 		if (!tempString.equals("%"))
 		{
-			debug("So close! not a valid schedule, you left out the %");
+			LOG_DEBUG(LOG_SCHED, "So close! not a valid schedule, you left out the %%");
 			continue;
 		}
-		debug("Time to run sequence " + String(thisSched->sequenceId));
+		LOG_DEBUG(LOG_SCHED, "Time to run sequence %lu", thisSched->sequenceId);
 		if (!isRunningSequence(thisSched->sequenceId)) // if it's not already running
 		{
 			// start it running!
@@ -446,40 +415,37 @@ bool Scheduler::isRunningSequence(unsigned long sequenceId)
 {
 	RunningSequence *ptr;
 	int i;	
-	for (i=0;(i < _numRunningSequences) && (i < SCHEDULER_MAX_RUNNING_SEQUENCES);i++)
+	// running sequences can be in any slot, not just the first few
+	for (i=0;i<SCHEDULER_MAX_RUNNING_SEQUENCES;i++)
 	{
 		ptr = _currentlyRunningSlots[i];
-		if (ptr->running->sequenceId == sequenceId)
+		if (ptr != NULL && ptr->running->sequenceId == sequenceId)
 			return true;
 	}
 	return false;
 }
 
-void Scheduler::startSequence(unsigned long sequenceId)
+bool Scheduler::startSequence(unsigned long sequenceId)
 {
 	RunningSequence *runSeqPtr;
 	Sequence *seq;
 	unsigned long milliNow = millis();
 	int slot;
-	if (_debugging)
-	{
-		schedPrintTimestamp();
-		Serial.printf(F("Starting sequence %i\n"),sequenceId);
-	}
+	LOG_DEBUG(LOG_SCHED, "Starting sequence %lu",sequenceId);
 	if (_numRunningSequences >= SCHEDULER_MAX_RUNNING_SEQUENCES)
 	{
-		debug("Too many sequences running!");
-		return; // nope, too many sequences running
+		LOG_DEBUG(LOG_SCHED, "Too many sequences running!");
+		return false; // nope, too many sequences running
 	}
 	// find the first free slot
 	runSeqPtr = NULL;
-	debug("Looking for a free slot");
+	LOG_DEBUG(LOG_SCHED, "Looking for a free slot");
 	//delay(100);
 	for (slot=0;slot<SCHEDULER_MAX_RUNNING_SEQUENCES;slot++)
 	{
 		if (_availableRunningSlots[slot] != NULL)
 		{
-			debug("Found a free running sequence slot, " + String(slot) );
+			LOG_DEBUG(LOG_SCHED, "Found a free running sequence slot, %d", slot);
 			runSeqPtr = _availableRunningSlots[slot];
 			_currentlyRunningSlots[slot] = runSeqPtr;  // move the pointer from available slots to running slots.
 			_availableRunningSlots[slot] = NULL; // remove it from the list.
@@ -490,14 +456,10 @@ void Scheduler::startSequence(unsigned long sequenceId)
 	if (runSeqPtr == NULL)
 	{
 		// no free slots
-		notify("No free slots for running sequences!\n");
-		return;
-	}
-	if (_debugging)
-	{
-		schedPrintTimestamp();
-		Serial.printf("Allocated slot %d\n",slot);
+		LOG_NOTICE(LOG_SCHED, "No free slots for running sequences!");
+		return false;
 	}
+	LOG_DEBUG(LOG_SCHED, "Allocated slot %d",slot);
 	
 	_numRunningSequences++;
 
@@ -505,7 +467,158 @@ void Scheduler::startSequence(unsigned long sequenceId)
 	runSeqPtr->running = seq;
 	runSeqPtr->milliStarted = milliNow;
 	runSeqPtr->milliLast = milliNow;
-	//notify("Added RunningSequence to list of sequences");
+	calculateCueLeads(runSeqPtr);
+	//LOG_DEBUG(LOG_SCHED, "Added RunningSequence to list of sequences");
+	return true;
+}
+
+bool Scheduler::startSequenceNow(unsigned long sequenceId)
+{
+	// Starts a sequence from outside the schedule (an input, say) and sends its first cues
+	// straight away rather than on the next tick.  False if it's already running or can't start.
+	RunningSequence *ptr;
+	int i;
+	if (!_running || sequenceGet(sequenceId) == NULL || isRunningSequence(sequenceId))
+		return false;
+	if (!startSequence(sequenceId))
+		return false;
+	for (i=0;i<SCHEDULER_MAX_RUNNING_SEQUENCES;i++)
+	{
+		ptr = _currentlyRunningSlots[i];
+		if (ptr != NULL && ptr->running->sequenceId == sequenceId)
+		{
+			// cues go out when their time is before now, so start it a millisecond ago
+			ptr->milliStarted--;
+			ptr->milliLast--;
+		}
+	}
+	triggerSequence();
+	return true;
+}
+
+unsigned long cueOffset(const char* cue)
+{
+	// offsets are the 5 digits after the $, in 10's of ms
+	unsigned long offset = 0;
+	int i;
+	for (i=1;i<6 && isdigit(cue[i]);i++)
+	{
+		offset = offset * 10 + (cue[i] - '0');
+	}
+	return offset * 10;
+}
+
+unsigned long Scheduler::msUntilNextCue()
+{
+	// for anything that holds the CPU up for a while, so it can keep out of the way of the cues.
+	// SCHEDULER_IDLE if nothing's running
+	unsigned long t = millis();
+	unsigned long soonest = SCHEDULER_IDLE;
+	unsigned long due;
+	int i, j;
+	RunningSequence *ptr;
+	for (i=0;i<SCHEDULER_MAX_RUNNING_SEQUENCES;i++)
+	{
+		ptr = _currentlyRunningSlots[i];
+		if (ptr == NULL)
+			continue;
+		for (j=0;j<ptr->running->numCues;j++)
+		{
+			due = ptr->milliStarted + cueOffset(ptr->running->cues[j]) - ptr->cueLead[j];
+			if ((long)(due - ptr->milliLast) < 0)
+				continue; // already sent
+			if ((long)(due - t) <= 0)
+				return 0;
+			if (due - t < soonest)
+				soonest = due - t;
+		}
+	}
+	return soonest;
+}
+
+void Scheduler::calculateCueLeads(RunningSequence *runSeq)
+{
+	// Motor cues at the same offset go out as one group, one message after another.
+	// Issue them early enough that the last one lands on time.
+	Sequence *seq = runSeq->running;
+	int i, j, motorsAtOnce;
+	unsigned long lead;
+	memset(runSeq->cueLead, 0, sizeof(runSeq->cueLead));
+	if (seq == NULL || _controller == NULL)
+		return;
+	for (i=0;i<seq->numCues;i++)
+	{
+		if (strncmp(&seq->cues[i][6], "MOT", 3) != 0)
+			continue;
+		motorsAtOnce = 0;
+		for (j=0;j<seq->numCues;j++)
+		{
+			if (strncmp(&seq->cues[j][6], "MOT", 3) == 0 && cueOffset(seq->cues[j]) == cueOffset(seq->cues[i]))
+				motorsAtOnce++;
+		}
+		lead = _controller->getMotorLeadMillis(motorsAtOnce);
+		// never issue a cue before the sequence started
+		if (lead > cueOffset(seq->cues[i]))
+			lead = cueOffset(seq->cues[i]);
+		runSeq->cueLead[i] = (lead > 255) ? 255 : lead;
+	}
+}
+
+void Scheduler::prefetchScenes()
+{
+	// Call from the loop.  Gets the next scenes due in the running sequences off the card
+	// while there's a gap before the next cue, one per call, so recalls come out of RAM.
+	// Never done as a sequence starts - inputs and the host start them, and that has to be quick.
+	int upcoming[SCENES_CACHED];
+	unsigned long upcomingDue[SCENES_CACHED];
+	int i, j, k, n, number, count = 0;
+	unsigned long due;
+	RunningSequence *ptr;
+	if (_controller == NULL || _numRunningSequences == 0 || msUntilNextCue() < SCHEDULER_PREFETCH_QUIET)
+		return;
+	for (i=0;i<SCHEDULER_MAX_RUNNING_SEQUENCES;i++)
+	{
+		ptr = _currentlyRunningSlots[i];
+		if (ptr == NULL)
+			continue;
+		for (j=0;j<ptr->running->numCues;j++)
+		{
+			const char *cue = ptr->running->cues[j];
+			if (strncmp(&cue[6], "SCN", 3) != 0 || !isdigit(cue[9]) || !isdigit(cue[10]))
+				continue;
+			due = ptr->milliStarted + cueOffset(cue) - ptr->cueLead[j];
+			if ((long)(due - ptr->milliLast) < 0)
+				continue; // already sent
+			number = (cue[9] - '0') * 10 + (cue[10] - '0');
+			// keep the soonest SCENES_CACHED different scenes, in the order they're due
+			for (k=0;k<count && upcoming[k] != number;k++);
+			if (k < count)
+			{
+				if ((long)(due - upcomingDue[k]) >= 0)
+					continue;
+				for (;k<count-1;k++)
+				{
+					upcoming[k] = upcoming[k+1];
+					upcomingDue[k] = upcomingDue[k+1];
+				}
+				count--;
+			}
+			for (n=0;n<count && (long)(due - upcomingDue[n]) >= 0;n++);
+			if (n >= SCENES_CACHED)
+				continue;
+			if (count < SCENES_CACHED)
+				count++;
+			for (k=count-1;k>n;k--)
+			{
+				upcoming[k] = upcoming[k-1];
+				upcomingDue[k] = upcomingDue[k-1];
+			}
+			upcoming[n] = number;
+			upcomingDue[n] = due;
+		}
+	}
+	if (count > 0)
+		_controller->prefetchScenes(upcoming, count);
 }
 
 void Scheduler::triggerSequence()
@@ -520,14 +633,18 @@ void Scheduler::triggerSequence()
 	String thisCue;
 	String strOffset;
 	RunningSequence *ptr;
-	debug("Scheduler::triggerSequence()");
+	LOG_DEBUG(LOG_SCHED, "Scheduler::triggerSequence()");
+	if (_controller != NULL)
+	{
+		_controller->beginCueGroup(); // everything due this tick goes out together
+	}
 
 	for (i=0;i<SCHEDULER_MAX_RUNNING_SEQUENCES;i++)
 	{
 		ptr = _currentlyRunningSlots[i];
 		if (ptr != NULL)
 		{
-			//notify("Scheduler::triggerSequence - slot contains sequence " + String(ptr->running->sequenceId));
+			//LOG_DEBUG(LOG_SCHED, "Scheduler::triggerSequence - slot contains sequence %lu", ptr->running->sequenceId);
 			// an actual running sequence is in this slot!
 			// now check whether there are any cues that should be sent that weren't last time
 			stillGoing = false;
@@ -536,26 +653,26 @@ void Scheduler::triggerSequence()
 				thisCue = String(ptr->running->cues[j]);
 				strOffset = thisCue.substring(1,6);
 				offset = strOffset.toInt()*10;
-				absoluteOffset = (offset + ptr->milliStarted);
+				absoluteOffset = (offset + ptr->milliStarted) - ptr->cueLead[j];
 
 				if (absoluteOffset >= ptr->milliLast && absoluteOffset < t)
 				{
-					debug("==== SENDING CUE");
+					LOG_DEBUG(LOG_SCHED, "==== SENDING CUE");
 					sendCue(thisCue);
 				} else {
-					debug("Not sending");
+					LOG_DEBUG(LOG_SCHED, "Not sending");
 				}
 				// if the cue is in the future, we're still going.
 				if (absoluteOffset > t)
 				{
-					debug("Cue in future");
+					LOG_DEBUG(LOG_SCHED, "Cue in future");
 					stillGoing = true;
 				}
 			}
 			ptr->milliLast = t;
 			if (!stillGoing)
 			{
-				debug("Sequence " + String(ptr->running->sequenceId) + " has ended");
+				LOG_DEBUG(LOG_SCHED, "Sequence %lu has ended", ptr->running->sequenceId);
 				// put the pointer back into the array of available slots. 
 				_currentlyRunningSlots[i] = NULL; // make this slot available again
 				_availableRunningSlots[i] = ptr; // put the pointer back into the list of available slots
@@ -563,10 +680,13 @@ void Scheduler::triggerSequence()
 				_numRunningSequences--;
 			}
 		} else {
-			debug("Scheduler::triggerSequence - slot empty");
+			LOG_DEBUG(LOG_SCHED, "Scheduler::triggerSequence - slot empty");
 		}
 	}
-	
+	if (_controller != NULL)
+	{
+		_controller->commitCueGroup();
+	}
 }
 
 void Scheduler::sendCue(String cue)
@@ -26,7 +26,8 @@
 #define SCHEDULER_MAX_SEQUENCES 20
 #define SCHEDULER_MAX_FILE_COUNT 999
 #define SCHEDULER_MAX_RUNNING_SEQUENCES 5
-// make this non-zero to enable serial debugging
+#define SCHEDULER_IDLE 0xFFFFFFFF			// msUntilNextCue() with nothing to wait for
+#define SCHEDULER_PREFETCH_QUIET 20			// ms clear of the next cue before a scene is read off the card
 
 
 typedef struct _seq {
@@ -45,6 +46,7 @@ typedef struct _runningSeq {
 	Sequence *running;
 	unsigned long milliStarted;
 	unsigned long milliLast;
+	unsigned char cueLead[SCHEDULER_MAX_CUES];	// ms each cue is issued ahead of its offset
 } RunningSequence;
 
 class Scheduler {
@@ -70,19 +72,22 @@ class Scheduler {
 		RunningSequence _runningSequences[SCHEDULER_MAX_RUNNING_SEQUENCES];
 		RunningSequence *_availableRunningSlots[SCHEDULER_MAX_RUNNING_SEQUENCES] = {NULL, NULL, NULL, NULL, NULL};
 		RunningSequence *_currentlyRunningSlots[SCHEDULER_MAX_RUNNING_SEQUENCES] = {NULL, NULL, NULL, NULL, NULL};
-		bool _debugging;
 		void setController(SystemControl *controller);
 		void start();
 		void stop();
+		bool isRunning();
+		bool stopSequence(unsigned long sequenceId);
+		bool startSequenceNow(unsigned long sequenceId);
+		unsigned long msUntilNextCue();
+		void prefetchScenes();
 	private:
 		bool _running;
 		bool isRunningSequence(unsigned long sequenceId);
-		void startSequence(unsigned long sequenceId);
+		bool startSequence(unsigned long sequenceId);
+		void calculateCueLeads(RunningSequence *runSeq);
 		void triggerSchedule(time_t t);
 		void triggerSequence();
 		void sendCue(String cue);
-		void debug(String log);
-		void notify(String log);
 		SystemControl *_controller;
 };
 
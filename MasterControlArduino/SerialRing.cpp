@@ -0,0 +1,120 @@
+/*
+
+	SerialRing.cpp
+
+	Receive ring for the user serial port (USER_SERIAL), filled straight from the UART interrupt
+
+	The core only keeps 64 bytes of what the UART's received, and it's only emptied when the
+	loop gets round to reading it, so anything that holds the loop up (talking to the motors,
+	the SD card) while a script is being pasted in loses the end of it.  So the UART's interrupt
+	is ours instead: it counts the errors, lets the core's handler do its usual job, and then
+	moves whatever that received straight into a much bigger ring, in the same interrupt so
+	nothing can come in between and get out of order.  Only USER_SERIAL being Serial1 (UART0)
+	is catered for.
+
+*/
+#include "SerialRing.h"
+#include "SystemConfig.h"
+#include "ConsoleOut.h"
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+SerialRing* SerialRing::_instance = NULL;
+
+SerialRing::SerialRing(HardwareSerial* port)
+{
+	_port = port;
+	_head = 0;
+	_tail = 0;
+	_received = 0;
+	_dropped = 0;
+	_overruns = 0;
+	_errors = 0;
+	_highWater = 0;
+}
+
+void SerialRing::begin(unsigned long baud)
+{
+	// the core sets the UART up, then the interrupt comes through here first
+	_instance = this;
+	_port->begin(baud);
+	attachInterruptVector(IRQ_UART0_STATUS, isr);
+}
+
+void SerialRing::isr()
+{
+	SerialRing* ring = _instance;
+	uint32_t head, waiting;
+	uint8_t status = UART0_S1;
+	// the flags go when the core reads the data register, so look at them first
+	if (status & UART_S1_OR)
+		ring->_overruns++;
+	if (status & (UART_S1_FE | UART_S1_NF))
+		ring->_errors++;
+	uart0_status_isr();
+	head = ring->_head;
+	while (ring->_port->available() > 0)
+	{
+		ring->_received++;
+		if (head - ring->_tail >= SERIAL_RING_SIZE)
+		{
+			ring->_port->read();
+			ring->_dropped++;
+			continue;
+		}
+		ring->_buffer[head & (SERIAL_RING_SIZE - 1)] = ring->_port->read();
+		head++;
+	}
+	ring->_head = head;			// only once the bytes are in
+	waiting = head - ring->_tail;
+	if (waiting > ring->_highWater)
+		ring->_highWater = waiting;
+}
+
+int SerialRing::available()
+{
+	return _head - _tail;
+}
+
+int SerialRing::read()
+{
+	int c;
+	uint32_t tail = _tail;
+	if (tail == _head)
+		return -1;
+	c = _buffer[tail & (SERIAL_RING_SIZE - 1)];
+	_tail = tail + 1;			// only once it's been taken out
+	return c;
+}
+
+int SerialRing::peek()
+{
+	uint32_t tail = _tail;
+	if (tail == _head)
+		return -1;
+	return _buffer[tail & (SERIAL_RING_SIZE - 1)];
+}
+
+void SerialRing::flush()
+{
+	_port->flush();
+}
+
+size_t SerialRing::write(uint8_t b)
+{
+	return _port->write(b);
+}
+
+int SerialRing::availableForWrite()
+{
+	return _port->availableForWrite();
+}
+
+void SerialRing::printStats()
+{
+	CONSOLE.printf(F("User serial: %lu bytes in, %lu dropped (ring full), %lu overruns, %lu framing/noise errors, %lu/%u most waiting\r\n"),
+		_received, _dropped, _overruns, _errors, _highWater, SERIAL_RING_SIZE);
+}
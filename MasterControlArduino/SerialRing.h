@@ -0,0 +1,53 @@
+/*
+
+	SerialRing.h
+
+	Receive ring for the user serial port (USER_SERIAL), filled straight from the UART interrupt
+
+*/
+
+#ifndef SERIALRING_H
+#define SERIALRING_H
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+#include "SystemConfig.h"
+
+#define SERIAL_RING_SIZE 1024			// bytes, a power of two; just under a second at 9600, 90ms at 115200
+
+/*
+	The interrupt is the only thing that moves _head and the loop is the only thing that moves
+	_tail, so neither side needs interrupts turned off to use it.  Reads look like any other
+	Stream, and writes go straight through to the port.
+*/
+class SerialRing : public Stream {
+	public:
+		SerialRing(HardwareSerial* port);
+		void begin(unsigned long baud);
+		virtual int available();
+		virtual int read();
+		virtual int peek();
+		virtual void flush();
+		virtual size_t write(uint8_t b);
+		virtual int availableForWrite();
+		using Print::write;
+		void printStats();
+	private:
+		HardwareSerial* _port;
+		uint8_t _buffer[SERIAL_RING_SIZE];
+		volatile uint32_t _head;		// written by the interrupt only
+		volatile uint32_t _tail;		// written by the loop only
+		volatile uint32_t _received;
+		volatile uint32_t _dropped;		// the ring was full
+		volatile uint32_t _overruns;	// the UART's own FIFO filled up before we got to it
+		volatile uint32_t _errors;		// framing or noise
+		volatile uint32_t _highWater;	// most that's been waiting at once
+		static SerialRing* _instance;
+		static void isr();
+};
+
+extern SerialRing userSerialRx;
+
+#endif
@@ -25,25 +25,36 @@
 
 #define CTRL_SERIAL Serial
 #define CTRL_BAUD 9600
+#define USER_SERIAL Serial1
+#define USER_BAUD 9600
 #define MC_CTRL_SERIAL Serial2
 #define MC_BAUD 9600
 #define DMX_SERIAL Serial3
 
-#define DMX_MAX_CHANNELS 128
-#define DMX_USEPIN 8
+#define DMX_MAX_CHANNELS 512
 #define DMX_TXEN 22
 #define DMX_RXEN 23
 
 #define ESTOP_PIN 16
+#define ONEWIRE_PIN 15
+// wire the relay expanders' INT line to this pin to use their pins as inputs without polling them
+//#define EXPANDER_INT_PIN 20
 
 // Motor limiting - set this up to be the maximum sensible speed BEFORE running schedules!
 #define MOTOR_MAX_SPEED 100
+// Thermal derating (0.1 deg C) - motors slow down gradually from START, to THERMAL_MIN_SPEED % of what was asked for at LIMIT
+#define THERMAL_MOTOR_START 550			// the motor controller's own temperature
+#define THERMAL_MOTOR_LIMIT 750
+#define THERMAL_ENCLOSURE_START 450		// hottest of the board sensor and the 1Wire sensors, slows every motor
+#define THERMAL_ENCLOSURE_LIMIT 600
 
 
 // debugging
 
-//#define TIMING_DEBUG false
-#undef TIMING_DEBUG
+// log statements below this level aren't compiled in at all (see EventLog.h), 0 debug - 3 error
+#define LOG_MIN_LEVEL 0
+// motor cues with a duration go back to their previous speed when it runs out (relays always do)
+//#define TIMED_MOTOR_REVERT
 
 
 #endif
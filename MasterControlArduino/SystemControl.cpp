@@ -13,42 +13,70 @@
 #endif
 
 #include "SystemConfig.h"
+#include "ConsoleOut.h"
+#include "EventLog.h"
 #include "SystemControl.h"
 #include <Time.h>
-#include "pcf8574.h"
+#include "RelayBanks.h"
 #include "MotorControl.h"
-#include <DmxSimple.h>
-#include <Wire.h>
-PCF8574 relays(0x38);
+#include "DmxPort.h"
+#include "DmxFader.h"
+#include "SceneStore.h"
+#include "I2CBus.h"
+#include "InternalTemperature.h"
+#include "OneWireSensors.h"
+RelayBanks relays;
+DmxPort dmx;
+DmxFader fader;
+SceneStore scenes;
+InternalTemperature cpuTemperature;
+extern I2CBus i2c;
 void init_AT30TS750A();
 
 SystemControl::SystemControl () 
 {
-	unsigned char i;
-	_logging = false;
+	unsigned int i;
 	// enable DMX
 	pinMode(DMX_TXEN,OUTPUT);
 	pinMode(DMX_RXEN,OUTPUT);
 	
-	for (i=0;i<DMX_MAX_CHANNELS;i++)
+	for (i=0;i<=DMX_MAX_CHANNELS;i++)
 	{
 		_dmxChannels[i] = 0x00;
-		//DmxSimple.write(i,0x00);
 	}
-	_logging = false;
 	_ticking = false;
 	_estopped = false;
+	_grouping = false;
+	_motorLead = false;
+	_motorGroupSize = 0;
+	_lastDmxFrame = 0;
+	_dmxDirty = false;
+	_sceneMicros = 0;
+	_lastRelayVerify = 0;
+	_timersStarted = millis();
+	memset(_relayTimers, -1, sizeof(_relayTimers));
+#ifdef TIMED_MOTOR_REVERT
+	memset(_motorTimers, -1, sizeof(_motorTimers));
+#endif
+	_scanning = false;
+	_scanFound = 0;
+	_scanConsole = NULL;
+	_lastLoop = 0;
+	_loopMean16 = 0;
+	_loopWorst = 0;
+	_loopWorstWindow = 0;
+	_loopWorstEver = 0;
+	_loopWindowStart = 0;
+	_temperatureRaw = 0;
+	_lastTemperatureRead = 0;
+	_sensors = NULL;
 }
 
-void SystemControl::loggingEnable(bool logging)
-{
-	_logging = logging;
-}
 void sysCtrlPrintDigits(int digits){
   // utility function for digital clock display: prints preceding colon and leading 0
   if(digits < 10)
-    CTRL_SERIAL.print('0');
-  CTRL_SERIAL.print(digits);
+    CONSOLE.print('0');
+  CONSOLE.print(digits);
 }
 
 void SystemControl::setMotorController(MotorControl* motors)
@@ -58,18 +86,104 @@ void SystemControl::setMotorController(MotorControl* motors)
 
 void SystemControl::sendMotorCommand(char devId,unsigned long percent, unsigned long duration)
 {
-	if (this->_estopped)
-		return; // don't sent a command if we're estopped
-	_motors->setMotor(devId,true,percent);
+	sendMotorCommand(devId,percent,duration,true);
 }
 
 void SystemControl::sendMotorCommand(char devId,unsigned long percent, unsigned long duration,bool direction)
 {
 	if (this->_estopped)
 		return; // don't sent a command if we're estopped
+#ifdef TIMED_MOTOR_REVERT
+	MotorController *motor = _motors->getMotor(devId);
+	int8_t *timer = (devId >= 0 && devId <= MOTORS_DISCOVERY_LAST_ID) ? &_motorTimers[(int) devId] : NULL;
+	TimedAction *pending;
+	uint8_t previousPercent = (motor != NULL) ? motor->requestedPercent : 0;
+	bool previousDirection = (motor != NULL) ? motor->targetDirection : true;
+	if (timer != NULL)
+	{
+		// a motor already running for a while goes back to what it was doing before that
+		pending = _timers.getAction(*timer);
+		if (pending != NULL)
+		{
+			previousPercent = pending->value;
+			previousDirection = pending->direction;
+		}
+		_timers.cancel(*timer);
+		*timer = (duration > 0) ? scheduleTimed(duration, TIMED_MOTOR, devId, previousPercent, previousDirection) : -1;
+		if (duration > 0 && *timer < 0)
+		{
+			// nothing would ever turn it back, so don't start it
+			LOG_ERROR(LOG_CTRL, "Motor %d - no room for a timed action, not run", (int) devId);
+			return;
+		}
+	}
+#endif
+	if (_grouping)
+	{
+		queueMotorCommand(devId,percent,direction);
+		return;
+	}
 	_motors->setMotor(devId,direction,percent);	
 }
 
+void SystemControl::queueMotorCommand(char devId, unsigned long percent, bool direction)
+{
+	int i;
+	MotorCommand *cmd = NULL;
+	// a later cue for the same motor in the same group wins
+	for (i=0;i<_motorGroupSize;i++)
+	{
+		if (_motorGroup[i].deviceId == devId)
+			cmd = &_motorGroup[i];
+	}
+	if (cmd == NULL)
+	{
+		if (_motorGroupSize >= MOTORS_GROUP_MAX)
+		{
+			// group is full, just send it now
+			_motors->setMotor(devId,direction,percent);
+			return;
+		}
+		cmd = &_motorGroup[_motorGroupSize++];
+	}
+	cmd->deviceId = devId;
+	cmd->direction = direction;
+	cmd->percent = percent;
+}
+
+void SystemControl::beginCueGroup()
+{
+	// motor cues issued from now until commitCueGroup() are held back and sent together
+	_grouping = true;
+	_motorGroupSize = 0;
+}
+
+void SystemControl::commitCueGroup()
+{
+	_grouping = false;
+	relays.flush(); // every relay change in the group in one write
+	if (_motorGroupSize > 0 && !_estopped)
+	{
+		_motors->sendMotorGroup(_motorGroup,_motorGroupSize);
+	}
+	_motorGroupSize = 0;
+}
+
+void SystemControl::setMotorLead(bool enabled)
+{
+	_motorLead = enabled;
+}
+
+unsigned long SystemControl::getMotorLeadMillis(int motorsAtOnce)
+{
+	// A fixed lead: the time to send all but one of the group's messages, at the measured
+	// byte time, so the last one goes out on the cue time instead of after it.  It moves
+	// the whole group earlier - it doesn't make the spread between the motors any smaller.
+	if (!_motorLead || motorsAtOnce <= 1)
+		return 0;
+	return ((motorsAtOnce - 1) * _motors->getMessageMicros(5) + 999) / 1000;
+}
+
 bool SystemControl::isStopped()
 {
 	return this->_estopped;
@@ -80,8 +194,15 @@ void SystemControl::eStop()
 	// STOP EVERYTHING RIGHT NOW
 	
 	this->_estopped = true;
+	_motorGroupSize = 0;
+	fader.cancelAll(); // whatever the lights were doing, they stay there
+	_timers.clear(); // and nothing comes back on by itself
+	memset(_relayTimers, -1, sizeof(_relayTimers));
+#ifdef TIMED_MOTOR_REVERT
+	memset(_motorTimers, -1, sizeof(_motorTimers));
+#endif
 	_motors->eStopAllMotors();
-	CTRL_SERIAL.println("STOPPED MOTORS");
+	CONSOLE.println("STOPPED MOTORS");
 }
 
 void SystemControl::restart()
@@ -94,100 +215,192 @@ void SystemControl::restart()
 void printTimestamp()
 {
 	time_t time = now();
-	CTRL_SERIAL.print("CONTROLLER>");
+	CONSOLE.print("CONTROLLER>");
 	sysCtrlPrintDigits(hour(time));
-	CTRL_SERIAL.print(":");
+	CONSOLE.print(":");
 	sysCtrlPrintDigits(minute(time));
-	CTRL_SERIAL.print(":");
+	CONSOLE.print(":");
 	sysCtrlPrintDigits(second(time));
-	CTRL_SERIAL.print(" ");
-	CTRL_SERIAL.print(day(time));
-	CTRL_SERIAL.print("/");
-	CTRL_SERIAL.print(month(time));
-	CTRL_SERIAL.print("/");
-	CTRL_SERIAL.print(year(time));
-	CTRL_SERIAL.print(" - ");
+	CONSOLE.print(" ");
+	CONSOLE.print(day(time));
+	CONSOLE.print("/");
+	CONSOLE.print(month(time));
+	CONSOLE.print("/");
+	CONSOLE.print(year(time));
+	CONSOLE.print(" - ");
 	
 }
 
 void SystemControl::printI2CDevices()
 {
-	byte error, address;
-	unsigned int nDevices = 0;
-	for(address = 1; address < 127; address++ )
-	{
-		// The i2c_scanner uses the return value of
-		// the Write.endTransmisstion to see if
-		// a device did acknowledge to the address.
-		Wire.beginTransmission(address);
-		error = Wire.endTransmission();
-
-		if (error == 0)
-		{
-		  CTRL_SERIAL.print(F("I2C device found at address 0x"));
-		  if (address<16)
-			CTRL_SERIAL.print(F("0"));
-		  CTRL_SERIAL.print(address,HEX);
-		  CTRL_SERIAL.println(F("  !"));
+	// probes every address in turn on the bus queue; the results print as they come in
+	if (_scanning)
+		return;
+	_scanFound = 0;
+	_scanConsole = &CONSOLE;
+	_scanning = i2c.queue(1, NULL, 0, 0, scanDone, this);
+}
 
-		  nDevices++;
-		}
-		else if (error==4)
-		{
-		  CTRL_SERIAL.print(F("Unknow error at address 0x"));
-		  if (address<16)
-			CTRL_SERIAL.print("0");
-		  CTRL_SERIAL.println(address,HEX);
-		}    
+void SystemControl::scanDone(I2CRequest* request)
+{
+	SystemControl *sys = (SystemControl*) request->context;
+	if (request->status == I2C_OK)
+	{
+		sys->_scanConsole->printf(F("I2C device found at address 0x%02x\r\n"), request->address);
+		sys->_scanFound++;
+	} else if (request->status == I2C_TIMEOUT_ERROR || request->status == I2C_ARBITRATION_LOST)
+	{
+		sys->_scanConsole->printf(F("Bus error at address 0x%02x\r\n"), request->address);
 	}
-
-	if (nDevices == 0)
-		CTRL_SERIAL.println(F("No I2C devices found\n"));
+	if (request->address < 126 && i2c.queue(request->address + 1, NULL, 0, 0, scanDone, sys))
+		return;
+	sys->_scanning = false;
+	if (sys->_scanFound == 0)
+		sys->_scanConsole->println(F("No I2C devices found\n"));
 	else
-		CTRL_SERIAL.println(F("done\n"));
+		sys->_scanConsole->println(F("done\n"));
+}
+
+void SystemControl::printI2CStats()
+{
+	i2c.printStats();
 }
 
 void SystemControl::setRelay(unsigned long devId,unsigned long percent, unsigned long duration)
 {
 	if (this->_estopped)
 		return; // don't sent a command if we're estopped
-	if (_logging)
+	// enable on non-zero
+	bool state = (percent > 0);
+	bool previous;
+	TimedAction *pending;
+	if (devId < 1 || devId > (unsigned long) relays.numRelays())
 	{
-		printTimestamp();
-		CTRL_SERIAL.print(F("Setting relay ") + String(devId));
+		LOG_NOTICE(LOG_CTRL, "Setting relay %lu - no such relay", devId);
+		return;
 	}
-	bool state = false;
-	if (devId <= 0 || devId >= 8)
+	// with a duration (in 10's of ms) the relay goes back to how it was when that's up
+	previous = relays.isOn(devId);
+	pending = _timers.getAction(_relayTimers[devId]);
+	if (pending != NULL)
+		previous = pending->value; // retriggered, so still going back to how it was before the first one
+	_timers.cancel(_relayTimers[devId]);
+	_relayTimers[devId] = (duration > 0) ? scheduleTimed(duration, TIMED_RELAY, devId, previous, false) : -1;
+	if (duration > 0 && _relayTimers[devId] < 0)
+	{
+		// nothing would ever put it back, so leave it how it is
+		LOG_ERROR(LOG_CTRL, "Setting relay %lu - no room for a timed action, not set", devId);
 		return;
-	devId--;
-	if (percent > 0)
+	}
+	if (!relays.set(devId,state))
 	{
-		
-		state = true;
+		LOG_NOTICE(LOG_CTRL, "Setting relay %lu - no such relay", devId);
+		return;
 	}
-	// enable on non-zero
-	if (state)
+	if (!relays.getBank((devId - 1) / RELAYS_PER_BANK)->isOnline())
+		LOG_NOTICE(LOG_CTRL, "Setting relay %lu - its expander is offline, trying anyway", devId);
+	LOG_DEBUG(LOG_CTRL, "Setting relay %lu to %s", devId, state ? "on" : "off");
+	if (!_grouping)
+		relays.flush(); // otherwise it goes with the rest of the group
+}
+
+int SystemControl::scheduleTimed(unsigned long duration, uint8_t type, uint8_t devId, uint8_t value, bool direction)
+{
+	// duration ticks from the tick it is now, even if timerTick() is behind (the loop's been held up)
+	unsigned long behind = (millis() - _timersStarted) / TIMER_TICK - _timers.now();
+	return _timers.schedule(duration + behind, type, devId, value, direction);
+}
+
+void SystemControl::timerTick()
+{
+	// call every time round the loop; runs the reverts that are due, all together
+	TimedAction expired[8];
+	unsigned long target = (millis() - _timersStarted) / TIMER_TICK;
+	bool grouped = false;
+	int count, i;
+	// up to and including the tick it is now, and anything that didn't fit last time round
+	while ((long)(target - _timers.now()) > 0 || _timers.due())
 	{
-		if (_logging)
-			CTRL_SERIAL.println(F(" to on"));
-		relays.write((uint8_t)devId,0);
-	} else {
-		if (_logging)
-			CTRL_SERIAL.println(F(" to off"));
-		relays.write((uint8_t)devId,1);
+		count = _timers.tick(expired, 8);
+		if (count > 0 && !grouped)
+		{
+			beginCueGroup();
+			grouped = true;
+		}
+		for (i=0;i<count;i++)
+			runTimedAction(&expired[i]);
 	}
-	
+	if (grouped)
+		commitCueGroup();
+}
+
+void SystemControl::runTimedAction(TimedAction* action)
+{
+	switch (action->type)
+	{
+		case TIMED_RELAY:
+			_relayTimers[action->devId] = -1;
+			setRelay(action->devId, action->value, 0);
+			break;
+#ifdef TIMED_MOTOR_REVERT
+		case TIMED_MOTOR:
+			_motorTimers[action->devId] = -1;
+			sendMotorCommand(action->devId, action->value, 0, action->direction);
+			break;
+#endif
+	}
+}
+
+void SystemControl::printTimedActions()
+{
+	int i;
+	TimedAction *action;
+	unsigned long left;
+	for (i=0;i<TIMER_MAX_ACTIONS;i++)
+	{
+		action = _timers.getAction(i);
+		if (action == NULL)
+			continue;
+		left = (action->expires - _timers.now()) * TIMER_TICK;
+		if (action->type == TIMED_RELAY)
+			CONSOLE.printf(F("Relay %02d back %s in %lu.%02lus\r\n"), action->devId, action->value ? "on" : "off", left / 1000, (left % 1000) / 10);
+		else
+			CONSOLE.printf(F("Motor %02d back to %d%% %s in %lu.%02lus\r\n"), action->devId, action->value, action->direction ? "forward" : "reverse", left / 1000, (left % 1000) / 10);
+	}
+	CONSOLE.printf(F("%d of %d timed actions pending\r\n"), _timers.pending(), TIMER_MAX_ACTIONS);
+}
+
+void SystemControl::printRelays()
+{
+	int i, j;
+	RelayBank *bank;
+	for (i=0;i<relays.numBanks();i++)
+	{
+		bank = relays.getBank(i);
+		CONSOLE.printf(F("Relays %02d-%02d at 0x%02x%s: "), i * RELAYS_PER_BANK + 1, (i + 1) * RELAYS_PER_BANK, bank->getAddress(),
+			bank->isOnline() ? "" : " (offline)");
+		for (j=0;j<RELAYS_PER_BANK;j++)
+			CONSOLE.print((bank->value() & (1 << j)) ? '-' : '*');
+		CONSOLE.printf(F("  %lu changes in %lu writes, last write %lu us (worst %lu us), %lu write errors, %lu failed read backs\r\n"),
+			bank->getChanges(), bank->getWrites(), bank->getLastWriteMicros(), bank->getMaxWriteMicros(),
+			bank->getWriteErrors(), bank->getVerifyFailures());
+	}
+	if (relays.numOnline() == 0)
+		CONSOLE.println(F("No relay expanders answering"));
 }
 
 void SystemControl::setup()
 {
 	_motors->motorsInitialise(MC_BAUD);
+	i2c.begin();
 	init_AT30TS750A();
+	cpuTemperature.begin();
+	relays.discover();
+	CONSOLE.printf(F("%d of %d relay banks answering, relays 1-%d\r\n"), relays.numOnline(), relays.numBanks(), relays.numRelays());
 	digitalWrite(DMX_TXEN,1);
 	digitalWrite(DMX_RXEN,1);
-	// set up DmxSimple
-	DmxSimple.usePin(DMX_USEPIN);
-	DmxSimple.maxChannel(DMX_MAX_CHANNELS);
+	// start sending DMX frames
+	dmx.begin(DMX_MAX_CHANNELS);
 
 }
 
@@ -197,41 +410,297 @@ void SystemControl::enable()
 	_motors->safeStartAllMotors();	
 }
 
-void SystemControl::setDMX(unsigned char channel, unsigned char brightness)
+uint8_t SystemControl::getDMX(unsigned int channel)
+{
+	// what's going out, desk and all
+	return dmx.getChannel(channel);
+}
+
+unsigned int SystemControl::getDmxFrameRate()
+{
+	return dmx.getFrameRate();
+}
+
+unsigned long SystemControl::getDmxFrameCount()
+{
+	return dmx.getFrameCount();
+}
+
+bool SystemControl::isRelayOn(int relay)
+{
+	return relays.isOn(relay);
+}
+
+int SystemControl::numRelays()
+{
+	return relays.numRelays();
+}
+
+void SystemControl::setDMX(unsigned int channel, unsigned char brightness)
 {
 	if (this->_estopped)
 		return; // don't change anything if if we're estopped
-	if (channel < DMX_MAX_CHANNELS)
+	if (channel >= 1 && channel <= DMX_MAX_CHANNELS)
 	{
-		DmxSimple.write(channel, brightness);
+		// goes out merged with the desk on the next frame
+		fader.cancel(channel);
 		_dmxChannels[channel] = brightness;
+		_dmxDirty = true;
+	}
+}
+
+void SystemControl::fadeDMX(unsigned int channel, unsigned char brightness, unsigned long duration)
+{
+	// duration is the cue's: first digit picks the curve, the other four are the fade time in 10's of ms
+	unsigned long fadeTime = (duration % 10000) * 10;
+	DmxFadeCurve curve = (DmxFadeCurve) (duration / 10000);
+	if (this->_estopped)
+		return;
+	if (fadeTime == 0 || channel < 1 || channel > DMX_MAX_CHANNELS)
+	{
+		setDMX(channel, brightness);
+		return;
+	}
+	if (!fader.start(channel, _dmxChannels[channel], brightness, fadeTime, curve))
+		setDMX(channel, brightness); // out of fades, just snap to it
+}
+
+void SystemControl::dmxFrameTick()
+{
+	// call every time round the loop - moves the fades on and merges with the desk once per DMX frame
+	unsigned long frame = dmx.getFrameCount();
+	if (frame == _lastDmxFrame)
+		return;
+	_lastDmxFrame = frame;
+	if (fader.activeFades() > 0)
+	{
+		fader.update(millis(), _dmxChannels);
+		_dmxDirty = true;
 	}
+	dmx.output(_dmxChannels, _dmxDirty);
+	_dmxDirty = false;
 }
 
 void SystemControl::printDmxChannels()
 {
+	// a full universe is a lot of lines at 9600 baud, so only show the channels that are up,
+	// a line at a time as the console has room
+	CONSOLE.generate(dmxChannelLine, this);
+}
+
+bool SystemControl::dmxChannelLine(void* context, unsigned int* cursor)
+{
+	SystemControl *sys = (SystemControl*) context;
 	unsigned int i;
-	for (i=0;i<DMX_MAX_CHANNELS;i++)
+	unsigned int zero = 0;
+	for (i=*cursor + 1;i<=DMX_MAX_CHANNELS;i++)
+	{
+		if (sys->_dmxChannels[i] != 0)
+		{
+			CONSOLE.printf(F("Ch: %03d : 0x%02x\r\n"),i,sys->_dmxChannels[i]);
+			*cursor = i;
+			return true;
+		}
+	}
+	for (i=1;i<=DMX_MAX_CHANNELS;i++)
+	{
+		if (sys->_dmxChannels[i] == 0)
+			zero++;
+	}
+	CONSOLE.printf(F("%d channels at zero not shown\r\n"),zero);
+	return false;
+}
+void SystemControl::printDmxChannel(unsigned int channel)
+{
+	if (channel >= 1 && channel <= DMX_MAX_CHANNELS) {
+		CONSOLE.printf(F("Ch: %03d : 0x%02x (desk 0x%02x, %s, out 0x%02x)\r\n"),channel,_dmxChannels[channel],
+			dmx.getInputChannel(channel), dmx.getMergeMode(channel) == DMX_MERGE_LTP ? "LTP" : "HTP", dmx.getChannel(channel));
+	}
+}
+
+void SystemControl::setDmxFrameLength(int frameLength)
+{
+	dmx.setFrameLength(frameLength);
+}
+
+void SystemControl::setDmxRefreshRate(unsigned int hz)
+{
+	dmx.setRefreshRate(hz);
+}
+
+void SystemControl::setDmxMergeMode(unsigned int first, unsigned int last, bool latest)
+{
+	dmx.setMergeMode(first, last, latest ? DMX_MERGE_LTP : DMX_MERGE_HTP);
+}
+
+bool SystemControl::saveScene(int number, const char* name)
+{
+	// whatever the cues have set up right now (not the desk)
+	int i;
+	Scene *scene = scenes.create(number, name);
+	if (scene == NULL)
+		return false;
+	scenes.encodeDmx(scene, _dmxChannels);
+	scene->numRelayBanks = relays.numBanks();
+	for (i=0;i<scene->numRelayBanks;i++)
+		scene->relays[i] = relays.getBank(i)->value();
+	scene->numMotors = _motors->getTargets(scene->motors, MOTORS_MAX_DEVICES);
+	return scenes.save(scene);
+}
+
+bool SystemControl::recallScene(int number, unsigned long duration)
+{
+	// One universe update, one relay write per bank and one group of motor commands.
+	// duration works like a DMX cue's, to crossfade rather than snap.
+	unsigned long started = micros();
+	unsigned long fadeTime = (duration % 10000) * 10;
+	uint8_t levels[DMX_MAX_CHANNELS + 1];
+	MotorCommand motors[MOTORS_MAX_DEVICES];
+	Scene *scene;
+	unsigned int channel;
+	int i;
+	if (this->_estopped)
+		return false;
+	scene = scenes.get(number);
+	if (scene == NULL)
+		return false;
+	scenes.decodeDmx(scene, levels);
+	for (channel=1;channel<=DMX_MAX_CHANNELS;channel++)
+	{
+		if (fadeTime > 0 && levels[channel] != _dmxChannels[channel] &&
+			fader.start(channel, _dmxChannels[channel], levels[channel], fadeTime, (DmxFadeCurve) (duration / 10000)))
+			continue;
+		fader.cancel(channel);
+		_dmxChannels[channel] = levels[channel];
+	}
+	_dmxDirty = true;
+	for (i=0;i<scene->numRelayBanks && i<relays.numBanks();i++)
+		relays.getBank(i)->setAll(scene->relays[i]);
+	// the scene says what the relays are, so nothing pending should change them after
+	for (i=1;i<=RELAYS_MAX_BANKS * RELAYS_PER_BANK;i++)
+	{
+		_timers.cancel(_relayTimers[i]);
+		_relayTimers[i] = -1;
+	}
+	if (!_grouping)
+		relays.flush();
+	if (_grouping)
+	{
+		for (i=0;i<scene->numMotors;i++)
+			queueMotorCommand(scene->motors[i].deviceId, scene->motors[i].percent, scene->motors[i].direction);
+	} else if (scene->numMotors > 0) {
+		memcpy(motors, scene->motors, sizeof(MotorCommand) * scene->numMotors); // it gets sorted
+		_motors->sendMotorGroup(motors, scene->numMotors);
+	}
+	_sceneMicros = micros() - started;
+	return true;
+}
+
+bool SystemControl::deleteScene(int number)
+{
+	return scenes.remove(number);
+}
+
+void SystemControl::prefetchScenes(const int* numbers, int count)
+{
+	scenes.prefetch(numbers, count);
+}
+
+void SystemControl::listScenes()
+{
+	int i, found = 0;
+	char name[SCENE_NAME_LENGTH + 1];
+	int numMotors;
+	uint16_t dmxLength;
+	for (i=0;i<SCENES_MAX;i++)
 	{
-		CTRL_SERIAL.printf(F("Ch: %02d : 0x%02x\r\n"),i,_dmxChannels[i]);
+		if (!scenes.info(i, name, &numMotors, &dmxLength))
+			continue;
+		CONSOLE.printf(F("Scene %02d: %-16s %d motors, %u bytes of DMX\r\n"), i, name, numMotors, dmxLength);
+		found++;
 	}
+	CONSOLE.printf(F("%d scenes; last recall took %lu us; cache %lu hits, %lu misses\r\n"),
+		found, _sceneMicros, scenes.getHits(), scenes.getMisses());
 }
-void SystemControl::printDmxChannel(unsigned char channel)
+
+void SystemControl::printDmxStats()
 {
-	if (channel < DMX_MAX_CHANNELS) {
-		CTRL_SERIAL.printf(F("Ch: %02d : 0x%02x\r\n"),channel,_dmxChannels[channel]);
+	CONSOLE.printf(F("DMX frames sent: %lu\r\n"), dmx.getFrameCount());
+	CONSOLE.printf(F("Frame length: %d slots\r\n"), dmx.getFrameLength());
+	if (dmx.getRefreshRate() == 0)
+		CONSOLE.printf(F("Frame rate: %u Hz (uncapped)\r\n"), dmx.getFrameRate());
+	else
+		CONSOLE.printf(F("Frame rate: %u Hz (capped at %u Hz)\r\n"), dmx.getFrameRate(), dmx.getRefreshRate());
+	CONSOLE.printf(F("Interrupt load: %u.%u%%\r\n"), dmx.getCpuLoad() / 10, dmx.getCpuLoad() % 10);
+	if (dmx.inputActive())
+		CONSOLE.printf(F("Desk: %lu frames in, %d slots\r\n"), dmx.getInputFrameCount(), dmx.getInputSlots());
+	else
+		CONSOLE.printf(F("Desk: no input (%lu frames in)\r\n"), dmx.getInputFrameCount());
+	CONSOLE.printf(F("Input errors: %lu, last merge took %lu us\r\n"), dmx.getInputErrors(), dmx.getMergeMicros());
+	CONSOLE.printf(F("Fades: %d running, last frame took %lu us, worst %lu us\r\n"), fader.activeFades(), fader.getLastMicros(), fader.getMaxMicros());
+}
+
+void SystemControl::loopTick()
+{
+	// call at the top of loop(); times each time round, averaged over the last 16 or so
+	unsigned long now = micros();
+	unsigned long elapsed = now - _lastLoop;
+	if (_lastLoop != 0)
+	{
+		_loopMean16 += elapsed - _loopMean16 / 16;
+		if (elapsed > _loopWorstWindow)
+			_loopWorstWindow = elapsed;
+		if (elapsed > _loopWorstEver)
+			_loopWorstEver = elapsed;
+	}
+	_lastLoop = now;
+	// a worst that never comes down says nothing after the first stall, so it's per window
+	if (millis() - _loopWindowStart >= LOOP_WORST_WINDOW)
+	{
+		_loopWorst = _loopWorstWindow;
+		_loopWorstWindow = 0;
+		_loopWindowStart = millis();
 	}
 }
 
+unsigned long SystemControl::getLoopMicros()
+{
+	return _loopMean16 / 16;
+}
+
+unsigned long SystemControl::getLoopWorstMicros()
+{
+	// over the last whole LOOP_WORST_WINDOW
+	return _loopWorst;
+}
+
+unsigned long SystemControl::getLoopWorstEverMicros()
+{
+	return _loopWorstEver;
+}
+
 void SystemControl::doStuff()
 {
 	//unsigned int i;
+	dmx.update();
+	relays.flush(); // anything that couldn't be queued last time
+	if (millis() - _lastRelayVerify >= RELAYS_VERIFY_INTERVAL)
+	{
+		_lastRelayVerify = millis();
+		relays.verify();
+	}
+	if (millis() - _lastTemperatureRead >= TEMPERATURE_INTERVAL)
+	{
+		_lastTemperatureRead = millis();
+		readTemperature();
+	}
+	_motors->thermalTick(getEnclosureTemperature(), !_estopped);
 	if (_ticking)
 	{
 		if(_lastTime != now())
 		{
 			printTimestamp();
-			CTRL_SERIAL.println();
+			CONSOLE.println();
 		}
 	}
 	_lastTime = now();
@@ -246,52 +715,71 @@ void SystemControl::doStuff()
 	
 }*/
 
+void SystemControl::readTemperature()
+{
+	// temperature register, two bytes back; picked up by temperatureDone()
+	uint8_t reg = 0x00;
+	i2c.queue(AT30TS750A_ADDRESS, &reg, 1, 2, temperatureDone, this);
+}
+
+void SystemControl::temperatureDone(I2CRequest* request)
+{
+	SystemControl *sys = (SystemControl*) request->context;
+	if (request->status != I2C_OK)
+		return; // keep the last good reading
+	// 12 bit, left justified, 1/16ths of a degree
+	sys->_temperatureRaw = (int16_t) ((request->rx[0] << 8) | request->rx[1]) >> 4;
+}
+
+void SystemControl::setOneWireSensors(OneWireSensors* sensors)
+{
+	_sensors = sensors;
+}
+
+int SystemControl::getEnclosureTemperature()
+{
+	// hottest of the board sensor and the 1Wire sensors, in 0.1 deg C
+	int hottest = (_temperatureRaw * 10) / 16;
+	int i, reading;
+	for (i=0;_sensors != NULL && i<_sensors->numSensors();i++)
+	{
+		if (!_sensors->getSensor(i)->valid)
+			continue;
+		reading = _sensors->milliC(i) / 100;
+		if (reading > hottest)
+			hottest = reading;
+	}
+	return hottest;
+}
+
 float SystemControl::getTemperatureC()
 {
-	byte   tempLSByte       = 0;
-	byte   tempMSByte       = 0; 
-	float floatTemperature        = 0.00;
-	Wire.beginTransmission (0x48);    //Select the AT30TS750 for writing
-	Wire.write             (0x00);    //Select the temperature register
-	Wire.endTransmission   ();
-	Wire.requestFrom       (0x48, 2); //Retrieve two bytes of data
-	tempMSByte             = Wire.read();
-	tempLSByte             = Wire.read() >> 4;
-	floatTemperature       = tempMSByte + (tempLSByte * .0625);
-	if (_logging)
-	{
-		CTRL_SERIAL.print    (F("Raw Output Byte 01: 0x"));
-		CTRL_SERIAL.println  (tempMSByte, HEX);
-		CTRL_SERIAL.print    (F("Raw Output Byte 02: 0x"));
-		CTRL_SERIAL.println  (tempLSByte, HEX);  
-		CTRL_SERIAL.print    (F("Raw Output Value 01: "));
-		CTRL_SERIAL.println  (tempMSByte, DEC);
-		CTRL_SERIAL.print    (F("Raw Output Value 02: "));
-		CTRL_SERIAL.println  (tempLSByte * .0625, DEC);  
-	}
-	Wire.endTransmission();
-	return floatTemperature;
+	// the last reading, the bus isn't touched here
+	LOG_DEBUG(LOG_CTRL, "Raw temperature: 0x%03x", _temperatureRaw & 0xFFF);
+	return _temperatureRaw * 0.0625;
 }
 
 float SystemControl::getInternalTemperatureC()
 {
-	float average = 0;
-	for (byte counter =0;counter<255;counter++){    
-		average = analogRead(38)+average;  
-	}
-	average= average/255;
-	float C = 25.0 + 0.17083 * (2454.19 - average);
-	return C;
+	return cpuTemperature.celsius();
+}
+
+int32_t SystemControl::getInternalTemperatureMilliC()
+{
+	return cpuTemperature.milliC();
 }
 
 
 void SystemControl::init_AT30TS750A()
 {
-	Wire.beginTransmission (0x48);  //Select the AT30TS750 for writing
-	Wire.write             (0x01);  //Select the configuration register
-	Wire.write             (0x60);  //0x00 = 9bit resolution, 0x60 = 12bit resolution
-	Wire.endTransmission   ();	
-	this->getTemperatureC(); // read the first time
+	uint8_t config[2] = {0x01, 0x60}; // configuration register: 0x00 = 9bit resolution, 0x60 = 12bit resolution
+	uint8_t reg = 0x00;
+	uint8_t reading[2];
+	i2c.transfer(AT30TS750A_ADDRESS, config, 2, NULL, 0);
+	// read the first time
+	if (i2c.transfer(AT30TS750A_ADDRESS, &reg, 1, reading, 2) == I2C_OK)
+		_temperatureRaw = (int16_t) ((reading[0] << 8) | reading[1]) >> 4;
+	_lastTemperatureRead = millis();
 }
 
 
@@ -304,29 +792,22 @@ void SystemControl::issueCue(String cue)
 	unsigned long percent;
 	unsigned long duration;
 	
-	if (_logging)
-	{
-		printTimestamp();
-		CTRL_SERIAL.println( cue);
-	}
+	LOG_DEBUG(LOG_CTRL, "%s", cue);
 	// check that the cue is the right size:
 	if (cue.length() != 20)
 	{
-		if (_logging)
-			CTRL_SERIAL.printf(F("Invalid cue! Length is %d\n"),cue.length());
+		LOG_NOTICE(LOG_CTRL, "Invalid cue! Length is %d",cue.length());
 		return;
 	}
 	// cool.  Does it start with a $ and end with %
 	if (!cue.substring(0,1).equals("$"))
 	{
-		if (_logging)
-			CTRL_SERIAL.println(F("Doesn't start with $\n"));
+		LOG_NOTICE(LOG_CTRL, "Doesn't start with $: %s", cue);
 		return;
 	}
 	if (!cue.substring(19).equals("%"))
 	{
-		if (_logging)
-			CTRL_SERIAL.println(F("Doesn't end with %\n"));
+		LOG_NOTICE(LOG_CTRL, "Doesn't end with %%: %s", cue);
 		return;
 	}
 	// unpack the values;
@@ -335,11 +816,7 @@ void SystemControl::issueCue(String cue)
 	devId = cue.substring(9,11).toInt();
 	percent = cue.substring(11,14).toInt();
 	duration = cue.substring(14,19).toInt();
-	if (_logging)
-	{
-		printTimestamp();
-		CTRL_SERIAL.printf(F("Offset: %d; Type: %s; DevID: %d; Percent: %d; Duration: %d\n"),offset,type.c_str(),devId,percent,duration);
-	}
+	LOG_DEBUG(LOG_CTRL, "Offset: %lu; Type: %s; DevID: %lu; Percent: %lu; Duration: %lu",offset,type,devId,percent,duration);
 	if(type.equals(F("MOT")))
 	{
 		sendMotorCommand(devId,percent,duration);
@@ -348,7 +825,14 @@ void SystemControl::issueCue(String cue)
 		setRelay(devId,percent,duration);
 	} else if (type.equals(F("DMX")))
 	{
-		setDMX(devId,percent);
+		fadeDMX(devId,percent,duration);
+	} else if (type.substring(0,2).equals(F("DX")) && isdigit(type.charAt(2)))
+	{
+		// DX0 to DX5 reach the whole universe - the last digit of the type is the hundreds of the channel
+		fadeDMX((type.charAt(2) - '0') * 100 + devId,percent,duration);
+	} else if (type.equals(F("SCN")))
+	{
+		recallScene(devId,duration);
 	}
 }
 
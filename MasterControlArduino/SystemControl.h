@@ -12,9 +12,18 @@
 #else
 #include "WProgram.h"
 #endif
-#include "pcf8574.h"
 #include "SystemConfig.h"
 #include "MotorControl.h"
+#include "RelayBanks.h"
+#include "TimerWheel.h"
+#include "I2CBus.h"
+
+#define AT30TS750A_ADDRESS 0x48
+#define TEMPERATURE_INTERVAL 1000		// ms between temperature readings
+#define LOOP_WORST_WINDOW 1000			// ms the worst loop time is taken over
+
+class OneWireSensors;
+class ConsoleOut;
 
 class SystemControl{
 	public:
@@ -23,28 +32,90 @@ class SystemControl{
 		void sendMotorCommand(char devId,unsigned long percent, unsigned long duration);
 		void sendMotorCommand(char devId,unsigned long percent, unsigned long duration,bool direction);
 		void setRelay(unsigned long devId,unsigned long percent, unsigned long duration);
+		bool isRelayOn(int relay);
+		int numRelays();
+		void printRelays();
+		void timerTick();
+		void printTimedActions();
 		void setup();
 		void enable();
-		void loggingEnable(bool logging);
 		void setMotorController(MotorControl* motors);
+		void setOneWireSensors(OneWireSensors* sensors);
+		int getEnclosureTemperature();
 		void eStop();
 		void restart();
-		void setDMX(unsigned char channel, unsigned char brightness);
+		void setDMX(unsigned int channel, unsigned char brightness);
+		void fadeDMX(unsigned int channel, unsigned char brightness, unsigned long duration);
+		void dmxFrameTick();
+		uint8_t getDMX(unsigned int channel);
+		unsigned int getDmxFrameRate();
+		unsigned long getDmxFrameCount();
 		void doStuff();
+		void loopTick();
+		unsigned long getLoopMicros();
+		unsigned long getLoopWorstMicros();
+		unsigned long getLoopWorstEverMicros();
 		void printDmxChannels();
-		void printDmxChannel(unsigned char channel);
+		void printDmxChannel(unsigned int channel);
+		void printDmxStats();
+		void setDmxFrameLength(int frameLength);
+		void setDmxRefreshRate(unsigned int hz);
+		void setDmxMergeMode(unsigned int first, unsigned int last, bool latest);
+		bool saveScene(int number, const char* name);
+		bool recallScene(int number, unsigned long duration);
+		bool deleteScene(int number);
+		void prefetchScenes(const int* numbers, int count);
+		void listScenes();
 		void printI2CDevices();
+		void printI2CStats();
 		float getTemperatureC();
 		float getInternalTemperatureC();
+		int32_t getInternalTemperatureMilliC();
 		bool isStopped();
+		void beginCueGroup();
+		void commitCueGroup();
+		void setMotorLead(bool enabled);
+		unsigned long getMotorLeadMillis(int motorsAtOnce);
 		
 	private:
 		time_t _lastTime;
-		bool _logging;
 		bool _estopped;
 		bool _ticking;
 		MotorControl* _motors;
-		char _dmxChannels[DMX_MAX_CHANNELS];
+		uint8_t _dmxChannels[DMX_MAX_CHANNELS + 1];	// indexed by channel, 1-512
+		unsigned long _lastDmxFrame;
+		bool _dmxDirty;			// cue levels changed since the last merge
+		unsigned long _sceneMicros;	// how long the last scene recall took
+		unsigned long _lastRelayVerify;
+		TimerWheel _timers;
+		unsigned long _timersStarted;
+		int scheduleTimed(unsigned long duration, uint8_t type, uint8_t devId, uint8_t value, bool direction);
+		int8_t _relayTimers[RELAYS_MAX_BANKS * RELAYS_PER_BANK + 1];	// pending revert for each relay, -1 for none
+#ifdef TIMED_MOTOR_REVERT
+		int8_t _motorTimers[MOTORS_DISCOVERY_LAST_ID + 1];
+#endif
+		void runTimedAction(TimedAction* action);
+		bool _scanning;
+		int _scanFound;
+		ConsoleOut* _scanConsole;		// whoever asked for the scan
+		int16_t _temperatureRaw;		// 1/16ths of a degree
+		unsigned long _lastTemperatureRead;
+		OneWireSensors* _sensors;
+		unsigned long _lastLoop;
+		unsigned long _loopMean16;		// 16 times the average time round the loop, in us
+		unsigned long _loopWorst;		// over the last whole LOOP_WORST_WINDOW
+		unsigned long _loopWorstWindow;	// so far in this one
+		unsigned long _loopWorstEver;
+		unsigned long _loopWindowStart;
+		void readTemperature();
+		static void scanDone(I2CRequest* request);
+		static void temperatureDone(I2CRequest* request);
+		static bool dmxChannelLine(void* context, unsigned int* cursor);
+		bool _grouping;
+		bool _motorLead;
+		MotorCommand _motorGroup[MOTORS_GROUP_MAX];
+		int _motorGroupSize;
+		void queueMotorCommand(char devId, unsigned long percent, bool direction);
 		void init_AT30TS750A();
 		/*void RTC_compensate();*/
 };
@@ -0,0 +1,170 @@
+/*
+
+	ThermalGovernor.cpp
+	
+	Slows the motors down as they (or the box they're in) get hot, rather than letting them trip out
+
+	Each zone (every motor, plus the enclosure) has a factor, the % of the commanded speed it's
+	allowed.  That drops in a straight line from 100% at the start temperature to THERMAL_MIN_SPEED
+	at the limit, straight away as it heats up.  Coming back, it's worked out as if the zone were
+	THERMAL_HYSTERESIS hotter than it is, and only rises by THERMAL_RESTORE_STEP at a time, so the
+	speed doesn't hunt up and down around a threshold.  A motor gets the lower of its own factor
+	and the enclosure's.
+	
+*/
+#include "ThermalGovernor.h"
+#include "ConsoleOut.h"
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+#include <Time.h>
+
+// a temperature in 0.1 deg C as the arguments for "%s%d.%d" - the sign goes separately, as -5 / 10 is 0
+#define TENTHS(t) ((t) < 0 ? "-" : ""), abs(t) / 10, abs(t) % 10
+
+ThermalGovernor::ThermalGovernor()
+{
+	int i;
+	for (i=0;i<=THERMAL_MOTOR_ZONES;i++)
+	{
+		_zones[i].temperature = 0;
+		_zones[i].factor = 100;
+		_zones[i].logged = 100;
+		_zones[i].seen = false;
+		_zones[i].id = 0;
+	}
+	_motorStart = THERMAL_MOTOR_START;
+	_motorLimit = THERMAL_MOTOR_LIMIT;
+	_enclosureStart = THERMAL_ENCLOSURE_START;
+	_enclosureLimit = THERMAL_ENCLOSURE_LIMIT;
+	_logNext = 0;
+	_logCount = 0;
+}
+
+void ThermalGovernor::setLimits(bool enclosure, int start, int limit)
+{
+	if (limit <= start)
+		limit = start + 1;
+	if (enclosure)
+	{
+		_enclosureStart = start;
+		_enclosureLimit = limit;
+	} else {
+		_motorStart = start;
+		_motorLimit = limit;
+	}
+}
+
+uint8_t ThermalGovernor::curve(int temperature, int start, int limit)
+{
+	if (temperature <= start)
+		return 100;
+	if (temperature >= limit)
+		return THERMAL_MIN_SPEED;
+	return 100 - ((100 - THERMAL_MIN_SPEED) * (temperature - start)) / (limit - start);
+}
+
+bool ThermalGovernor::update(int zone, int temperature, uint8_t id)
+{
+	// feed in a temperature (0.1 deg C), and the motor's device number; true if the zone's factor changed
+	ThermalZone *z;
+	int start, limit;
+	uint8_t down, up, factor;
+	if (zone < 0 || zone > THERMAL_ENCLOSURE)
+		return false;
+	z = &_zones[zone];
+	start = (zone == THERMAL_ENCLOSURE) ? _enclosureStart : _motorStart;
+	limit = (zone == THERMAL_ENCLOSURE) ? _enclosureLimit : _motorLimit;
+	down = curve(temperature, start, limit);
+	up = curve(temperature + THERMAL_HYSTERESIS, start, limit);
+	factor = z->factor;
+	if (down < factor)
+		factor = down;
+	else if (up > factor)
+		factor = (up - factor > THERMAL_RESTORE_STEP) ? factor + THERMAL_RESTORE_STEP : up;
+	z->temperature = temperature;
+	z->seen = true;
+	z->id = id;
+	if (factor == z->factor)
+		return false;
+	z->factor = factor;
+	// log the start and end of derating, and big moves in between
+	if (factor == 100 || z->logged == 100 || abs(factor - z->logged) >= THERMAL_LOG_STEP)
+		log(zone, z->logged, factor);
+	return true;
+}
+
+void ThermalGovernor::log(int zone, uint8_t from, uint8_t to)
+{
+	ThermalEvent *event = &_log[_logNext];
+	event->time = now();
+	event->zone = zone;
+	event->id = _zones[zone].id;
+	event->temperature = _zones[zone].temperature;
+	event->from = from;
+	event->to = to;
+	_zones[zone].logged = to;
+	_logNext = (_logNext + 1) % THERMAL_LOG_SIZE;
+	if (_logCount < THERMAL_LOG_SIZE)
+		_logCount++;
+	if (from == 100 || to == 100)
+	{
+		if (zone == THERMAL_ENCLOSURE)
+			CONSOLE.printf(F("Enclosure at %s%d.%dC, motors %s %d%%\r\n"), TENTHS(event->temperature), to == 100 ? "back to" : "derated to", to);
+		else
+			CONSOLE.printf(F("Motor %d at %s%d.%dC, %s %d%%\r\n"), event->id, TENTHS(event->temperature), to == 100 ? "back to" : "derated to", to);
+	}
+}
+
+uint8_t ThermalGovernor::factor(int zone)
+{
+	uint8_t enclosure = _zones[THERMAL_ENCLOSURE].factor;
+	if (zone < 0 || zone >= THERMAL_MOTOR_ZONES)
+		return enclosure;
+	return (_zones[zone].factor < enclosure) ? _zones[zone].factor : enclosure;
+}
+
+unsigned long ThermalGovernor::scale(int zone, unsigned long percent)
+{
+	return (percent * factor(zone)) / 100;
+}
+
+bool ThermalGovernor::derating()
+{
+	int i;
+	for (i=0;i<=THERMAL_MOTOR_ZONES;i++)
+	{
+		if (_zones[i].factor < 100)
+			return true;
+	}
+	return false;
+}
+
+void ThermalGovernor::print()
+{
+	int i;
+	ThermalEvent *event;
+	ThermalZone *z = &_zones[THERMAL_ENCLOSURE];
+	CONSOLE.printf(F("Motors derate from %s%d.%dC to %s%d.%dC, enclosure from %s%d.%dC to %s%d.%dC\r\n"),
+		TENTHS(_motorStart), TENTHS(_motorLimit),
+		TENTHS(_enclosureStart), TENTHS(_enclosureLimit));
+	if (z->seen)
+		CONSOLE.printf(F("Enclosure: %s%d.%dC, %d%%\r\n"), TENTHS(z->temperature), z->factor);
+	for (i=0;i<THERMAL_MOTOR_ZONES;i++)
+	{
+		z = &_zones[i];
+		if (z->seen)
+			CONSOLE.printf(F("Motor %d: %s%d.%dC, %d%%\r\n"), z->id, TENTHS(z->temperature), factor(i));
+	}
+	// oldest first
+	for (i=0;i<_logCount;i++)
+	{
+		event = &_log[(_logNext - _logCount + i + THERMAL_LOG_SIZE) % THERMAL_LOG_SIZE];
+		CONSOLE.printf(F("%02d:%02d:%02d %s"), hour(event->time), minute(event->time), second(event->time), event->zone == THERMAL_ENCLOSURE ? "enclosure" : "motor ");
+		if (event->zone != THERMAL_ENCLOSURE)
+			CONSOLE.print(event->id);
+		CONSOLE.printf(F(" %s%d.%dC %d%% -> %d%%\r\n"), TENTHS(event->temperature), event->from, event->to);
+	}
+}
@@ -0,0 +1,65 @@
+/*
+
+	ThermalGovernor.h
+	
+	Slows the motors down as they (or the box they're in) get hot, rather than letting them trip out
+	
+*/
+
+#ifndef THERMALGOVERNOR_H
+#define THERMALGOVERNOR_H
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+#include "SystemConfig.h"
+
+#define THERMAL_MOTOR_ZONES 12			// one per motor, same as MOTORS_MAX_DEVICES
+#define THERMAL_ENCLOSURE THERMAL_MOTOR_ZONES	// zone number for the enclosure
+#define THERMAL_MIN_SPEED 30			// % of the commanded speed left at the limit temperature
+#define THERMAL_HYSTERESIS 30			// 0.1 deg C a zone has to cool by before speed comes back
+#define THERMAL_RESTORE_STEP 5			// most % a zone's speed comes back by per update
+#define THERMAL_LOG_STEP 10				// % change worth logging in the middle of derating
+#define THERMAL_LOG_SIZE 16
+
+typedef struct _thermalZone {
+	int temperature;					// 0.1 deg C, last seen
+	uint8_t factor;						// % of the commanded speed allowed
+	uint8_t logged;						// factor when we last logged this zone
+	bool seen;
+	uint8_t id;							// motor device number, for the logs
+} ThermalZone;
+
+typedef struct _thermalEvent {
+	time_t time;
+	uint8_t zone;
+	uint8_t id;
+	int temperature;
+	uint8_t from;
+	uint8_t to;
+} ThermalEvent;
+
+class ThermalGovernor{
+	public:
+		ThermalGovernor();
+		void setLimits(bool enclosure, int start, int limit);
+		bool update(int zone, int temperature, uint8_t id);
+		uint8_t factor(int zone);
+		unsigned long scale(int zone, unsigned long percent);
+		bool derating();
+		void print();
+	private:
+		ThermalZone _zones[THERMAL_MOTOR_ZONES + 1];
+		int _motorStart;
+		int _motorLimit;
+		int _enclosureStart;
+		int _enclosureLimit;
+		ThermalEvent _log[THERMAL_LOG_SIZE];
+		int _logNext;
+		int _logCount;
+		uint8_t curve(int temperature, int start, int limit);
+		void log(int zone, uint8_t from, uint8_t to);
+};
+
+#endif
@@ -0,0 +1,175 @@
+/*
+
+	TimerWheel.cpp
+	
+	Hierarchical timer wheel for things that have to be undone later, like the end of a relay pulse
+
+	Level 0 has a slot per tick for the next 64 ticks, level 1 a slot per 64 ticks and so on.
+	Adding or cancelling an action is a list insert or remove.  Every tick the current level 0
+	slot expires, and whenever a level wraps the next slot up is spread down into it - so each
+	action is only ever touched a couple of times, however long it waits.
+	
+*/
+#include "TimerWheel.h"
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+
+TimerWheel::TimerWheel()
+{
+	_now = 0;
+	clear();
+}
+
+void TimerWheel::clear()
+{
+	int i;
+	memset(_wheel, -1, sizeof(_wheel));
+	// the free list is threaded through next
+	for (i=0;i<TIMER_MAX_ACTIONS;i++)
+	{
+		_actions[i].active = false;
+		_actions[i].next = (i + 1 < TIMER_MAX_ACTIONS) ? i + 1 : -1;
+		_actions[i].prev = -1;
+	}
+	_free = 0;
+	_pending = 0;
+}
+
+void TimerWheel::link(int handle)
+{
+	// into the slot for its expiry, at the level that covers how far off that is
+	TimedAction *action = &_actions[handle];
+	unsigned long delta = action->expires - _now;
+	int level = 0;
+	int8_t *head;
+	while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1UL << (TIMER_WHEEL_BITS * (level + 1))))
+		level++;
+	head = &_wheel[level][(action->expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK];
+	action->prev = -1;
+	action->next = *head;
+	if (*head >= 0)
+		_actions[*head].prev = handle;
+	*head = handle;
+}
+
+void TimerWheel::unlink(int handle)
+{
+	TimedAction *action = &_actions[handle];
+	int level = 0;
+	if (action->prev >= 0)
+	{
+		_actions[action->prev].next = action->next;
+	} else {
+		// it's the head, so find which slot it heads
+		while (level < TIMER_WHEEL_LEVELS - 1 && _wheel[level][(action->expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK] != handle)
+			level++;
+		_wheel[level][(action->expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK] = action->next;
+	}
+	if (action->next >= 0)
+		_actions[action->next].prev = action->prev;
+}
+
+int TimerWheel::schedule(unsigned long ticks, uint8_t type, uint8_t devId, uint8_t value, bool direction)
+{
+	// returns a handle for cancel(), or -1 if there's no room
+	int handle = _free;
+	TimedAction *action;
+	if (handle < 0)
+		return -1;
+	action = &_actions[handle];
+	_free = action->next;
+	if (ticks < 1)
+		ticks = 1;
+	if (ticks > TIMER_MAX_TICKS)
+		ticks = TIMER_MAX_TICKS;
+	action->expires = _now + ticks;
+	action->type = type;
+	action->devId = devId;
+	action->value = value;
+	action->direction = direction;
+	action->active = true;
+	link(handle);
+	_pending++;
+	return handle;
+}
+
+void TimerWheel::cancel(int handle)
+{
+	if (handle < 0 || handle >= TIMER_MAX_ACTIONS || !_actions[handle].active)
+		return;
+	unlink(handle);
+	_actions[handle].active = false;
+	_actions[handle].next = _free;
+	_free = handle;
+	_pending--;
+}
+
+void TimerWheel::cascade(int level)
+{
+	// move everything in this level's current slot down to where it now belongs
+	int8_t *head = &_wheel[level][(_now >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK];
+	int handle = *head;
+	int next;
+	*head = -1;
+	while (handle >= 0)
+	{
+		next = _actions[handle].next;
+		link(handle);
+		handle = next;
+	}
+}
+
+int TimerWheel::tick(TimedAction* expired, int max)
+{
+	// Moves time on one tick and copies out what's due at the new time, so an action scheduled
+	// for n ticks comes out of the nth call.  Anything past max stays in the current slot, and
+	// the next call (see due()) gets it before the clock moves again.
+	int8_t *head;
+	int handle, count = 0;
+	int level;
+	if (!due())
+	{
+		_now++;
+		for (level=TIMER_WHEEL_LEVELS-1;level>0;level--)
+		{
+			if ((_now & ((1UL << (TIMER_WHEEL_BITS * level)) - 1)) == 0)
+				cascade(level);
+		}
+	}
+	head = &_wheel[0][_now & TIMER_WHEEL_MASK];
+	while (*head >= 0 && count < max)
+	{
+		handle = *head;
+		expired[count++] = _actions[handle];
+		cancel(handle);
+	}
+	return count;
+}
+
+bool TimerWheel::due()
+{
+	// something's left over from the current tick; nothing new can be scheduled into it
+	return _wheel[0][_now & TIMER_WHEEL_MASK] >= 0;
+}
+
+unsigned long TimerWheel::now()
+{
+	return _now;
+}
+
+TimedAction* TimerWheel::getAction(int handle)
+{
+	if (handle < 0 || handle >= TIMER_MAX_ACTIONS || !_actions[handle].active)
+		return NULL;
+	return &_actions[handle];
+}
+
+int TimerWheel::pending()
+{
+	return _pending;
+}
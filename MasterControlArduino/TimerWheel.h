@@ -0,0 +1,62 @@
+/*
+
+	TimerWheel.h
+	
+	Hierarchical timer wheel for things that have to be undone later, like the end of a relay pulse
+	
+*/
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+#include "WProgram.h"
+#endif
+
+#define TIMER_TICK 10					// ms, same as cue offsets and durations
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 3			// 64 ticks, 64^2 ticks, 64^3 ticks - about 45 minutes
+#define TIMER_MAX_TICKS ((1UL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+#define TIMER_MAX_ACTIONS 32
+
+enum TimedActionType {
+	TIMED_RELAY,
+	TIMED_MOTOR
+};
+
+typedef struct _timedAction {
+	unsigned long expires;				// in ticks
+	uint8_t type;
+	uint8_t devId;
+	uint8_t value;						// relay on/off or motor percent to go back to
+	bool direction;
+	bool active;
+	int8_t next;						// neighbours in the same slot, -1 for none
+	int8_t prev;
+} TimedAction;
+
+class TimerWheel{
+	public:
+		TimerWheel();
+		int schedule(unsigned long ticks, uint8_t type, uint8_t devId, uint8_t value, bool direction);
+		void cancel(int handle);
+		void clear();
+		int tick(TimedAction* expired, int max);
+		bool due();
+		unsigned long now();
+		TimedAction* getAction(int handle);
+		int pending();
+	private:
+		TimedAction _actions[TIMER_MAX_ACTIONS];
+		int8_t _wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];	// head of each slot's list
+		int8_t _free;
+		int _pending;
+		unsigned long _now;
+		void link(int handle);
+		void unlink(int handle);
+		void cascade(int level);
+};
+
+#endif